@@ -0,0 +1,86 @@
+/*******************************************************************
+*   BRIEF.h
+*   KORAL
+*******************************************************************/
+//
+// CPU rBRIEF (steered BRIEF, as in ORB) binary descriptor: a cheaper
+// alternative to LATCH on the CPU.
+//
+// Takes the same keypoints (with scale and angle) and pyramid as
+// LATCH, but each level must first be smoothed with BRIEFSmooth(), a
+// 7-tap separable Gaussian (sigma 2) in 8.8 fixed point. Descriptors
+// are 256 bits, 4 uint64_t per keypoint; bit n is SET if the smoothed
+// intensity at the first point of pair n of brief_pattern
+// (BRIEFPattern.h) is less than that at the second.
+//
+// Steering uses BRIEFTables: the pattern pre-rotated to 30 angle bins
+// (12 degrees each, as in ORB), as integer pixel offsets per bin and
+// level stride. Each keypoint's 256 pairs are then read with AVX2
+// gathers, 8 pairs per output byte, with no per-keypoint trig.
+// Keypoints within 18 pixels of the level borders use the same
+// rotated pattern, with clamping. Upright keypoints (angle 0)
+// use bin 0, the unrotated pattern.
+//
+// With multithreading, keypoints (and smoothed rows) are split
+// evenly across hardware threads.
+//
+// BRIEFReference() is a plain scalar implementation of the same
+// computation, for verification.
+//
+// AVX2 is required.
+//
+
+#ifndef KORAL_BRIEF
+#define KORAL_BRIEF
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BRIEFPattern.h"
+#include "DescriptorSet.h"
+#include "ImageLevel.h"
+#include "Keypoint.h"
+
+namespace koral {
+class BRIEFTables {
+public:
+	static constexpr int bins = 30;
+
+	// builds tables for the strides of levels[0] to levels[num_levels - 1]
+	BRIEFTables(const ImageLevel* const levels, const int num_levels);
+
+	int levels() const { return static_cast<int>(strides.size()); }
+	int32_t stride(const int level) const { return strides[level]; }
+
+	// index of the bin nearest to angle
+	static int bin(const float angle);
+
+	// 512 pixel offsets, relative to the keypoint: the first points of all 256 pairs, then the second points
+	const int32_t* offsets(const int level, const int bin) const { return &offs[(static_cast<size_t>(level) * bins + bin) << 9]; }
+
+	// the rotated pattern as 256 (x1, y1, x2, y2), independent of stride
+	const int8_t* deltas(const int bin) const { return &dxy[static_cast<size_t>(bin) << 10]; }
+
+private:
+	std::vector<int32_t> strides;
+	std::vector<int8_t> dxy;
+	std::vector<int32_t> offs;
+};
+}
+
+// smooths level into out, which is level.w x level.h with stride level.w
+template <const bool multithreading>
+void BRIEFSmooth(const koral::ImageLevel& level, uint8_t* const __restrict out);
+
+template <const bool multithreading>
+void BRIEF(const koral::ImageLevel* const __restrict smoothed, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::BRIEFTables& tables);
+
+// resizes desc, which must be 256 bits, to num_kps descriptors
+template <const bool multithreading>
+void BRIEF(const koral::ImageLevel* const __restrict smoothed, const koral::Keypoint* const __restrict kps, const int num_kps, koral::DescriptorSet& desc, const koral::BRIEFTables& tables);
+
+void BRIEFReference(const koral::ImageLevel* const __restrict smoothed, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc);
+
+#endif /* KORAL_BRIEF */
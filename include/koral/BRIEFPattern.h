@@ -0,0 +1,27 @@
+/*******************************************************************
+*   BRIEFPattern.h
+*   KORAL
+*******************************************************************/
+//
+// The 256 point pairs of the CPU rBRIEF describer.
+//
+// Each entry is 4 int8_t: (x1, y1, x2, y2), relative to the keypoint
+// on its scale level. Coordinates were drawn once from an isotropic
+// Gaussian with sigma 31 / 5 (BRIEF's G II sampling for a 31x31
+// patch), rounded, and kept only inside a disc of radius 15, so the
+// pattern stays within 15 pixels of the keypoint at any rotation.
+//
+// Bit n of a descriptor is SET if the smoothed intensity at the first
+// point of pair n is less than that at the second.
+//
+
+#ifndef KORAL_BRIEFPATTERN
+#define KORAL_BRIEFPATTERN
+
+#pragma once
+
+#include <cstdint>
+
+constexpr int8_t brief_pattern[1024]={0,7,4,1,2,10,1,-2,-10,-4,4,9,3,-1,10,-9,3,3,-1,-1,0,5,1,11,-1,-3,6,-4,7,2,4,0,-1,4,3,7,1,-8,8,1,-10,8,-6,6,2,5,7,-7,1,-4,-6,2,1,1,-3,-9,-3,3,-3,-2,0,11,5,-7,-7,2,0,3,-1,-4,-7,2,-3,11,-1,-3,-3,1,-3,5,9,0,1,6,-5,5,-7,-6,-2,-2,-1,1,6,-1,6,-2,1,0,-10,10,5,11,-5,7,2,5,-2,-9,9,-8,1,-4,-8,5,-3,-2,-1,-1,5,-8,0,-8,-4,12,0,3,7,-6,-1,-4,-8,6,-7,10,-6,11,-2,-1,-12,1,3,-7,-7,-5,-7,-11,-4,-4,-1,-3,0,7,-5,-1,-3,5,1,1,-1,-6,0,5,-1,1,-6,-5,4,-2,10,-5,-3,4,8,-8,1,-7,4,-7,5,-4,-1,-3,-4,1,-7,-6,6,-10,12,-1,-4,3,0,-3,6,0,0,-8,-7,-8,1,7,8,-2,-4,-4,-4,0,1,-2,0,-1,-3,2,-7,3,9,5,-8,6,-10,-4,-8,3,2,7,3,-3,0,-3,8,1,-5,6,-6,-2,5,10,0,6,12,-4,-4,4,1,3,12,-3,-7,2,11,-2,1,-2,4,-1,0,4,5,9,-2,-2,0,4,4,7,3,-4,-3,-2,4,2,9,5,5,-4,3,5,-13,2,-5,-4,-1,11,-8,0,8,-7,-8,-6,8,2,4,-5,-1,-2,8,0,-1,0,9,-5,-6,8,12,-1,1,-4,-3,7,-2,13,-1,-2,2,-7,6,10,5,3,4,-3,8,10,5,6,9,2,1,-2,-5,0,-13,-5,-8,-3,-3,7,5,2,14,-5,1,-2,-5,0,-3,-2,0,-1,3,-11,-8,3,4,0,-2,-8,11,-4,3,-9,-2,-5,4,0,-9,-3,-4,-4,5,-1,4,7,5,9,-5,4,-5,13,-6,6,1,5,-3,1,0,5,2,4,1,3,-6,-4,10,8,1,-3,5,1,-1,-8,-7,-7,-9,2,3,7,0,-8,6,0,1,2,-4,0,-4,2,9,1,1,1,5,6,4,-1,-14,-1,3,3,0,3,-9,-2,-6,2,6,-10,0,-9,-4,-2,6,0,-2,-4,2,-6,3,3,-8,3,0,3,1,-2,9,7,-3,8,4,-5,-1,4,-3,-2,-2,-4,2,8,8,-10,11,-7,-6,5,-7,0,6,7,-3,3,13,3,7,-1,6,-2,4,-2,6,3,8,2,-6,-5,-4,2,-12,3,-11,7,-2,-10,1,9,-2,9,-5,-1,3,1,10,0,-3,10,-1,-12,-1,10,-1,9,-12,-7,2,14,1,-1,0,-1,3,-1,7,-5,3,6,2,4,7,5,-11,6,-8,-1,-3,-5,-4,9,6,3,5,4,2,-7,10,1,-5,-4,1,-3,7,0,3,2,4,6,-8,5,-1,5,0,2,-2,7,5,-1,-3,8,6,2,1,-9,0,4,10,2,6,4,-8,10,0,2,7,-3,5,-5,4,-5,-8,-5,13,-6,-6,2,-4,-4,0,-6,-11,-6,-7,6,6,-7,6,-1,3,8,5,-4,5,-2,2,1,-5,4,0,-6,1,1,-2,-1,3,-1,2,-13,-11,8,-3,-4,6,5,-5,6,-8,3,-5,10,2,-3,9,-2,1,4,-4,7,0,-8,0,2,1,-1,-4,1,-2,3,4,7,9,-3,-11,-7,14,-5,9,10,-5,-4,4,-5,12,2,4,7,7,5,2,-9,3,7,-3,-2,-10,-10,0,-1,3,0,-3,-4,-5,5,-7,4,0,1,-1,9,6,1,-6,-9,-5,-7,-1,5,1,3,-2,8,7,-7,-4,0,-1,7,-3,2,3,6,-2,14,-6,-3,-4,-6,-2,2,-8,-4,-9,-1,8,-1,8,-6,1,3,0,4,-3,-2,-7,-7,4,-5,-6,-1,14,-3,-1,3,2,-4,0,0,2,5,-1,3,-6,0,9,-4,0,6,3,-3,6,-10,-2,4,7,-7,0,-2,7,-2,13,-2,6,2,-1,0,9,2,2,-5,-7,6,10,-1,6,-4,-2,-3,3,0,-8,6,3,11,10,-2,2,-8,5,4,-4,0,-3,9,1,5,-7,8,-1,-11,-3,0,5,-3,-2,1,0,8,8,6,7,-4,-8,5,-5,-7,13,-3,8,-2,7,3,-10,-7,-3,-9,1,3,0,-7,5,2,-7,6,10,-2,-4,9,2,-2,2,-3,0,7,-5,-2,1,-8,9,10,-7,-6,2,-8,6,0,-1,-8,-1,1,-8,9,-8,3,2,-3,-8,0,-2,10,-13,-4,3,7,14,5,-7,7,2,-3,-1,-1,4,-7,0,3,0,4,0,-2,3,0,1,9,-4,-7,10,0,1,-1,3,8,2,-11,0,2,3,-6,-7,-2,6,-8,7,-6,4,-1,-4,-8,-3,-5,-3,-4,-4,-4,2,2,-5,4,-14,-5,5,9,-9,-1,6,4,-2,-8,1,-8,4,-2,-4,-6,-3,-2,-3,11,13,0,-3,14,5,-7,6,-5,4,-1,13,-1,5,3,3,-4,-8,1,-5,-4,2,7,-6,7,3,7,-6,-10,-1,10,1,6,3,-4,0,4,1,2,-4,-9,-4,-5,5,2,2,-7,1,-2};
+
+#endif /* KORAL_BRIEFPATTERN */
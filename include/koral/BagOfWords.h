@@ -0,0 +1,128 @@
+/*******************************************************************
+*   BagOfWords.h
+*   KORAL
+*******************************************************************/
+//
+// Bag of binary words (Galvez-Lopez and Tardos, as in DBoW2) for
+// image retrieval: finding which stored images share features with
+// the current frame, for loop closure and relocalization.
+//
+// Vocabulary is a tree of visual words trained on a corpus of
+// descriptors. Each node splits its descriptors into up to
+// 'branching' clusters by k-majority: k-means++ seeding on Hamming
+// distance, then alternating assignment to the nearest center and
+// recomputing each center as the per-bit majority of its cluster,
+// until no assignment changes. Nodes with at most 'branching'
+// descriptors, and nodes at 'depth', are the words. Training runs one
+// tree level at a time; levels with few nodes split each node's
+// assignment across hardware threads, deeper ones split the nodes.
+// A node's clustering depends only on its descriptors and on seed,
+// so training is deterministic regardless of threads.
+//
+// images gives the number of descriptors in each training image, in
+// order; each word is weighted by its inverse document frequency,
+// log(images / images containing the word), over them. With images
+// empty, every word has weight 1.
+//
+// quantize() descends the tree for each descriptor, measuring the
+// children of each node 4 at a time with hamming4() (Hamming.h).
+// transform() turns a frame's descriptors into a BowVector: word
+// ids, ascending, each weighted by term frequency times its weight,
+// and L1-normalized.
+//
+// BowDatabase is an inverted file over the BowVectors of stored
+// images: per word, the images containing it and their weights.
+// query() scores the images sharing words with a query by the DBoW2
+// L1 score, 1 - |v - w| / 2, which for normalized vectors is the sum
+// of min(v_i, w_i) over shared words, and returns the top k, best
+// first. Images get ids in order of add(), starting at 0. When
+// multithreading, each thread scores its own range of images.
+//
+// write() and read() serialize a Vocabulary, which is typically
+// trained once offline, to and from a binary stream.
+//
+
+#ifndef KORAL_BAGOFWORDS
+#define KORAL_BAGOFWORDS
+
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include "DescriptorSet.h"
+
+namespace koral {
+
+// (word, weight) pairs, ascending by word
+typedef std::vector<std::pair<uint32_t, float>> BowVector;
+
+class Vocabulary {
+public:
+	Vocabulary(const DescriptorView& train, const std::vector<uint32_t>& images, const int branching = 10, const int depth = 6, const uint64_t seed = 0);
+
+	uint16_t bits() const { return centers.bits(); }
+	size_t words() const { return weights.size(); }
+	int branching() const { return k; }
+	int depth() const { return levels; }
+	float weight(const uint32_t word) const { return weights[word]; }
+
+	template <const bool multithreading>
+	void quantize(const DescriptorView& desc, uint32_t* const __restrict words) const;
+
+	// words, if not nullptr, receives the word of each descriptor
+	template <const bool multithreading>
+	void transform(const DescriptorView& desc, BowVector& bow, uint32_t* const __restrict words = nullptr) const;
+
+	void write(std::ostream& out) const;
+	static Vocabulary read(std::istream& in);
+
+private:
+	// the children of a node are consecutive nodes; a node without children is a word
+	struct Node {
+		uint32_t first_child;
+		uint32_t num_children;
+		uint32_t word;
+	};
+
+	int k;
+	int levels;
+	std::vector<Node> nodes;
+	// the center of node i is descriptor i (the root's is unused)
+	DescriptorSet centers;
+	std::vector<float> weights;
+
+	// distances from q to 4 descriptors, packed as 16-bit fields
+	uint64_t (*dist4)(const uint64_t* const q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3);
+
+	Vocabulary() : k(0), levels(0), dist4(nullptr) {}
+	void setKernel();
+	void quantizeRange(const DescriptorView& desc, const int start, const int end, uint32_t* const words) const;
+};
+
+class BowDatabase {
+public:
+	explicit BowDatabase(const Vocabulary& voc) : postings(voc.words()), num(0) {}
+
+	size_t size() const { return num; }
+
+	// returns the id of the new image
+	uint32_t add(const BowVector& bow);
+
+	// the top k (image, score) pairs, best first, ties to the lower image
+	template <const bool multithreading>
+	void query(const BowVector& bow, const int k, std::vector<std::pair<uint32_t, float>>& results) const;
+
+private:
+	// per word, (image, weight) pairs, ascending by image
+	std::vector<std::vector<std::pair<uint32_t, float>>> postings;
+	uint32_t num;
+
+	void scoreRange(const BowVector& bow, const uint32_t first, const uint32_t last, float* const scores) const;
+};
+
+}
+#endif /* KORAL_BAGOFWORDS */
@@ -0,0 +1,51 @@
+/*******************************************************************
+*   BitOrder.h
+*   KORAL
+*******************************************************************/
+//
+// A fixed reordering of descriptor bits, by decreasing variance over
+// a sample, for K2NNEarlyExit() (K2NN.h).
+//
+// Hamming distance does not change when both descriptors have their
+// bits permuted the same way, so any K2NN run on reordered training
+// and query sets gives the same matches. Reordering only moves the
+// bits most likely to differ - those with a frequency of ones p
+// closest to 1/2, i.e. the largest p(1 - p) - to the front, so that
+// partial distances over the first chunks grow as fast as possible.
+//
+// The order is computed once, offline, from a sample of training
+// descriptors (ties by bit index; an empty sample gives the identity),
+// and then applied to every training and query set that is to be
+// compared. apply() moves one bit at a time and is meant for that
+// one-off conversion, not for the matching loop.
+//
+
+#ifndef KORAL_BITORDER
+#define KORAL_BITORDER
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "DescriptorSet.h"
+
+namespace koral {
+class BitOrder {
+public:
+	explicit BitOrder(const DescriptorView& sample);
+
+	uint16_t bits() const { return static_cast<uint16_t>(order.size()); }
+
+	// the input bit that becomes bit i of the output
+	int source(const int i) const { return order[i]; }
+
+	// out is resized to in.size(); in must have bits() bits
+	void apply(const DescriptorView& in, DescriptorSet& out) const;
+
+private:
+	std::vector<uint16_t> order;
+};
+
+}
+#endif /* KORAL_BITORDER */
@@ -0,0 +1,58 @@
+/*******************************************************************
+*   BitSliced.h
+*   KORAL
+*******************************************************************/
+//
+// Transposed (bit-sliced) layout of a set of binary descriptors, for
+// large brute-force batches.
+//
+// Descriptors are grouped into blocks of 256. Each block holds one
+// 256-bit plane per descriptor bit: bit i of plane b is bit b of
+// descriptor i of the block. K2NN() (K2NN.h) on a BitSlicedSet then
+// compares a query against a whole block at once: each plane is
+// XORed with the query bit, broadcast, and the 256 one-bit results
+// are summed vertically with carry-save adders, so no horizontal
+// popcounts are needed. A 512-bit block is 16 KiB.
+//
+// Construction transposes 32 descriptors x 8 bits at a time with
+// movemask; toDescriptors() converts back to the normal row-major
+// layout. Lanes past the last descriptor of the last block are zero.
+//
+
+#ifndef KORAL_BITSLICED
+#define KORAL_BITSLICED
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "DescriptorSet.h"
+
+namespace koral {
+class BitSlicedSet {
+public:
+	static constexpr int block = 256;
+
+	BitSlicedSet() : num(0), nbits(512) {}
+	explicit BitSlicedSet(const DescriptorView& desc);
+
+	size_t size() const { return num; }
+	bool empty() const { return num == 0; }
+	uint16_t bits() const { return nbits; }
+	size_t blocks() const { return (num + block - 1) / block; }
+
+	// the 4 words of plane b of block k; the planes of a block are consecutive
+	const uint64_t* plane(const size_t k, const int b) const { return planes.data() + ((k * nbits + b) << 2); }
+
+	// out is resized to size()
+	void toDescriptors(DescriptorSet& out) const;
+
+private:
+	size_t num;
+	uint16_t nbits;
+	std::vector<uint64_t> planes;
+};
+
+}
+#endif /* KORAL_BITSLICED */
@@ -0,0 +1,115 @@
+/*******************************************************************
+*   CPUKORAL.h
+*   KORAL
+*******************************************************************/
+//
+// CPU-only KORAL pipeline, for nodes without a GPU.
+//
+// Builds the scale pyramid with LERP (as KORAL does with CUDALERP),
+// then detects with KFAST, orients with featureAngle, and describes
+// with the CPU LATCH. Usage mirrors KORAL:
+//
+//      CPUKORAL koral(scale_factor, scale_levels);
+//      koral.go(image, width, height, KFAST_threshold);
+//
+// after which keypoints are in koral.kps and descriptors in
+// koral.desc, and desc_bits and upright behave as in KORAL.
+//
+// By default the pipeline is fused. Each scale level is cut into
+// tile_size x tile_size tiles, and a worker runs KFAST, orientation,
+// and description back to back on each tile it owns while the
+// tile's pixels are still in cache, appending to its own outputs.
+// KFAST runs on the tile plus a 4-pixel halo, and keeps only the
+// corners the tile owns, so the detections are exactly those of a
+// whole-level KFAST. The fused outputs are the same keypoints and
+// descriptors as the unfused pipeline (fused = false), in tile
+// order instead of row order.
+//
+// describeKeypoints() describes only given points, with no
+// detection, at a cost proportional to the number of points: on an
+// image (resampling only the levels the points use), on the pyramid
+// of the last frame, or on a caller-supplied pyramid. Points carry
+// scale, x, and y; a NaN angle is computed with featureAngle (or set
+// to 0 in upright mode), and points within 3 pixels of their level's
+// border get angle 0. Results replace kps and desc, in the order given.
+//
+// The describer is LATCH by default. CPUDescriptor::BRIEF selects
+// rBRIEF (see BRIEF.h) instead, which is several times cheaper per
+// keypoint, but requires desc_bits = 256. Its smoothed levels are
+// computed once per frame, before detection, and its rotated-pattern
+// tables are rebuilt only when the level strides change.
+//
+// pyramid() exposes the levels of the last frame.
+//
+// AVX2 is required.
+//
+
+#ifndef KORAL_CPUKORAL
+#define KORAL_CPUKORAL
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "BRIEF.h"
+#include "DescriptorSet.h"
+#include "ImageLevel.h"
+#include "Keypoint.h"
+
+namespace koral {
+enum class CPUDescriptor { LATCH, BRIEF };
+
+class CPUKORAL {
+	// public member variables
+public:
+	std::vector<Keypoint> kps;
+	DescriptorSet desc;
+
+	// private member variables
+private:
+	const float scale_factor;
+	const uint8_t scale_levels;
+	const uint16_t desc_bits;
+	const bool upright;
+	const bool fused;
+	const int32_t tile_size;
+	const CPUDescriptor engine;
+
+	std::vector<ImageLevel> levels;
+	std::vector<std::vector<uint8_t>> level_imgs;
+
+	// BRIEF only
+	std::vector<ImageLevel> smoothed;
+	std::vector<std::vector<uint8_t>> smoothed_imgs;
+	std::unique_ptr<BRIEFTables> brief_tables;
+
+	// public methods
+public:
+	CPUKORAL(const float _scale_factor, const uint8_t _scale_levels, const uint16_t _desc_bits = 512, const bool _upright = false, const bool _fused = true, const int32_t _tile_size = 128, const CPUDescriptor _engine = CPUDescriptor::LATCH);
+
+	void go(const uint8_t* const image, const uint32_t width, const uint32_t height, const uint8_t KFAST_thresh);
+
+	void describeKeypoints(const uint8_t* const image, const uint32_t width, const uint32_t height, const std::vector<Keypoint>& points);
+	void describeKeypoints(const std::vector<Keypoint>& points);
+	void describeKeypoints(const ImageLevel* const pyramid, const uint8_t num_levels, const std::vector<Keypoint>& points);
+
+	const ImageLevel* pyramid() const { return levels.data(); }
+
+	// private methods
+private:
+	// resamples every level, or only those flagged in 'used'
+	void buildPyramid(const uint8_t* const image, const uint32_t width, const uint32_t height, const uint8_t* const used = nullptr);
+	// BRIEF only: smooths the levels that have pixels, and rebuilds the tables if their strides changed
+	void smooth(const ImageLevel* const pyramid, const uint8_t num_levels);
+	void goFused(const uint8_t KFAST_thresh);
+	void goUnfused(const uint8_t KFAST_thresh);
+	void describe(const Keypoint* const kps, const int num_kps, uint64_t* const out) const;
+	// describes all of kps into desc, multithreaded
+	void describeAll(const ImageLevel* const pyramid);
+	void detectTiles(const int32_t* const tiles, const size_t first, const size_t last, const uint8_t KFAST_thresh, std::vector<Keypoint>& out_kps, DescriptorSet& out_desc) const;
+};
+
+}
+#endif /* KORAL_CPUKORAL */
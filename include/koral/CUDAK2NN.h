@@ -54,7 +54,11 @@
 #undef __CUDACC__
 #endif
 
+// bits selects the descriptor length: 128, 256, 384, or 512 (the default).
+// Descriptors are packed at bits / 8 bytes each, and, as for the full
+// 512-bit kernel, one descriptor past the end of the training set is read
+// (but not used), so it must be allocated.
+template <const int bits = 512>
 void CUDAK2NN(const void* const __restrict d_t, const int num_t, const cudaTextureObject_t tex_q, const int num_q, int* const __restrict d_m, const int threshold);
 
-
 #endif /* KORAL_CUDAK2NN */
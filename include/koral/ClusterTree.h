@@ -0,0 +1,87 @@
+/*******************************************************************
+*   ClusterTree.h
+*   KORAL
+*******************************************************************/
+//
+// Randomized hierarchical clustering trees (Muja and Lowe, as in
+// FLANN) over binary descriptors, for approximate nearest-neighbor
+// search at a fraction of the build cost of a graph index.
+//
+// Each tree recursively splits its descriptors into 'branching'
+// clusters around centers that are themselves descriptors, picked
+// by k-means++ seeding on Hamming distance over a random sample of
+// 64 * branching, from a per-tree random stream, with no further
+// refinement (as FLANN does for binary descriptors) - and assigns
+// each descriptor to its nearest center with hamming4()
+// (Hamming.h). Clusters of at most leaf_size descriptors become
+// leaves. The trees differ only in their random
+// centers, and are built in parallel.
+//
+// A search descends every tree to the leaf nearest the query,
+// queueing the clusters it passes over by distance to their centers,
+// then keeps reopening the nearest queued cluster, best-bin-first,
+// until max_checks descriptors have been measured. Larger max_checks
+// trades latency for recall at query time. top2() and match() work
+// as for HNSWIndex.
+//
+// The index does not copy the descriptors: it holds a view of them,
+// which must stay valid and unchanged while it is used, plus 4 bytes
+// per descriptor per tree and a small node array. To follow a changing
+// keyframe database, rebuild it.
+//
+
+#ifndef KORAL_CLUSTERTREE
+#define KORAL_CLUSTERTREE
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "DescriptorSet.h"
+
+namespace koral {
+class ClusterTreeIndex {
+public:
+	explicit ClusterTreeIndex(const DescriptorView& train, const int trees = 4, const int branching = 32, const int leaf_size = 100, const uint64_t seed = 0);
+
+	size_t size() const { return desc.size(); }
+	uint16_t bits() const { return desc.bits(); }
+	int trees() const { return static_cast<int>(forest.size()); }
+
+	// best_d and second_d may be nullptr; a missing second is 200000, and an empty index gives id -1
+	template <const bool multithreading>
+	void top2(const DescriptorView& query, const int max_checks, int* const __restrict best_i, int* const __restrict best_d, int* const __restrict second_d) const;
+
+	template <const bool multithreading>
+	void match(const DescriptorView& query, int* const __restrict matches, const int threshold, const int max_checks) const;
+
+private:
+	// a leaf covers order[begin] to order[end - 1]; the children of a cluster are consecutive nodes
+	struct Node {
+		uint32_t center;
+		uint32_t begin;
+		uint32_t end;
+		uint32_t first_child;
+		uint32_t num_children;
+	};
+
+	struct Tree {
+		std::vector<Node> nodes;
+		std::vector<uint32_t> order;
+	};
+
+	const DescriptorView desc;
+	const int branching;
+	const int leaf_size;
+	std::vector<Tree> forest;
+
+	// distances from q to 4 descriptors, packed as 16-bit fields
+	uint64_t (*dist4)(const uint64_t* const q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3);
+
+	void buildTree(Tree& tree, const uint64_t seed) const;
+	void searchRange(const DescriptorView& query, const int start, const int end, const int max_checks, int* const best_i, int* const best_d, int* const second_d) const;
+};
+
+}
+#endif /* KORAL_CLUSTERTREE */
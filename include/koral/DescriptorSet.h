@@ -0,0 +1,171 @@
+/*******************************************************************
+*   DescriptorSet.h
+*   KORAL
+*******************************************************************/
+//
+// Owning, move-only container for a set of binary descriptors,
+// and DescriptorView, a non-owning view or slice of one.
+//
+// Descriptors are stored as packed rows of bits / 64 uint64_t
+// (bits is 128, 256, 384, or 512), in the layout produced by
+// CLATCH and LATCH. Storage is 64-byte aligned, so full 512-bit
+// rows each start on their own cache line and every row is at least
+// 16-byte aligned. At least 'padding' zeroed rows always follow the
+// last descriptor, so SIMD kernels may over-read past the end, and
+// CUDAK2NN's one-descriptor-ahead prefetch stays in bounds.
+//
+// write() and read() serialize a set to and from a binary stream.
+//
+
+#ifndef KORAL_DESCRIPTORSET
+#define KORAL_DESCRIPTORSET
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+namespace koral {
+
+class DescriptorView {
+public:
+	DescriptorView() : ptr(nullptr), num(0), nbits(512) {}
+	DescriptorView(const uint64_t* const _ptr, const size_t _num, const uint16_t _nbits) : ptr(_ptr), num(_num), nbits(_nbits) {}
+
+	const uint64_t* data() const { return ptr; }
+	size_t size() const { return num; }
+	bool empty() const { return num == 0; }
+	uint16_t bits() const { return nbits; }
+	size_t words() const { return nbits >> 6; }
+	size_t bytes() const { return num * (nbits >> 3); }
+
+	// pointer to the first word of descriptor i
+	const uint64_t* operator[](const size_t i) const { return ptr + i * words(); }
+
+	// count descriptors starting at first, without copying
+	DescriptorView slice(const size_t first, const size_t count) const { return DescriptorView(ptr + first * words(), count, nbits); }
+
+private:
+	const uint64_t* ptr;
+	size_t num;
+	uint16_t nbits;
+};
+
+class DescriptorSet {
+public:
+	static constexpr size_t alignment = 64;
+	static constexpr size_t padding = 8;
+
+	DescriptorSet() : ptr(nullptr), num(0), cap(0), nbits(512) {}
+
+	explicit DescriptorSet(const uint16_t _nbits, const size_t count = 0) : ptr(nullptr), num(0), cap(0), nbits(_nbits) {
+		if (nbits != 128 && nbits != 256 && nbits != 384 && nbits != 512) {
+			throw std::invalid_argument("DescriptorSet: bits must be 128, 256, 384, or 512.");
+		}
+		resize(count);
+	}
+
+	DescriptorSet(DescriptorSet&& other) noexcept : ptr(other.ptr), num(other.num), cap(other.cap), nbits(other.nbits) {
+		other.ptr = nullptr;
+		other.num = other.cap = 0;
+	}
+
+	DescriptorSet& operator=(DescriptorSet&& other) noexcept {
+		if (this != &other) {
+			_mm_free(ptr);
+			ptr = other.ptr;
+			num = other.num;
+			cap = other.cap;
+			nbits = other.nbits;
+			other.ptr = nullptr;
+			other.num = other.cap = 0;
+		}
+		return *this;
+	}
+
+	DescriptorSet(const DescriptorSet&) = delete;
+	DescriptorSet& operator=(const DescriptorSet&) = delete;
+
+	~DescriptorSet() { _mm_free(ptr); }
+
+	uint64_t* data() { return ptr; }
+	const uint64_t* data() const { return ptr; }
+	size_t size() const { return num; }
+	size_t capacity() const { return cap; }
+	bool empty() const { return num == 0; }
+	uint16_t bits() const { return nbits; }
+	size_t words() const { return nbits >> 6; }
+	size_t bytes() const { return num * (nbits >> 3); }
+
+	// pointer to the first word of descriptor i
+	uint64_t* operator[](const size_t i) { return ptr + i * words(); }
+	const uint64_t* operator[](const size_t i) const { return ptr + i * words(); }
+
+	DescriptorView view() const { return DescriptorView(ptr, num, nbits); }
+	DescriptorView slice(const size_t first, const size_t count) const { return view().slice(first, count); }
+	operator DescriptorView() const { return view(); }
+
+	void reserve(const size_t count) {
+		if (count <= cap && ptr) return;
+		const size_t row = nbits >> 3;
+		uint64_t* const p = reinterpret_cast<uint64_t*>(_mm_malloc((count + padding) * row, alignment));
+		if (!p) throw std::bad_alloc();
+		if (num) memcpy(p, ptr, num * row);
+		memset(reinterpret_cast<uint8_t*>(p) + num * row, 0, (count - num + padding) * row);
+		_mm_free(ptr);
+		ptr = p;
+		cap = count;
+	}
+
+	// contents of new descriptors are unspecified (but padding is always zeroed)
+	void resize(const size_t count) {
+		if (count > cap || !ptr) reserve(count > cap << 1 ? count : cap << 1);
+		num = count;
+		memset(ptr + num * words(), 0, padding * (nbits >> 3));
+	}
+
+	void clear() { resize(0); }
+
+	void append(const DescriptorView& other) {
+		if (other.bits() != nbits) throw std::invalid_argument("DescriptorSet: cannot append descriptors of a different length.");
+		const size_t old = num;
+		resize(num + other.size());
+		if (other.size()) memcpy(ptr + old * words(), other.data(), other.bytes());
+	}
+
+	void write(std::ostream& out) const {
+		const uint32_t magic = 0x4353444B; // "KDSC"
+		const uint64_t count = num;
+		out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+		out.write(reinterpret_cast<const char*>(&nbits), sizeof(nbits));
+		out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		out.write(reinterpret_cast<const char*>(ptr), bytes());
+	}
+
+	static DescriptorSet read(std::istream& in) {
+		uint32_t magic = 0;
+		uint16_t b = 0;
+		uint64_t count = 0;
+		in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+		in.read(reinterpret_cast<char*>(&b), sizeof(b));
+		in.read(reinterpret_cast<char*>(&count), sizeof(count));
+		if (!in || magic != 0x4353444B) throw std::runtime_error("DescriptorSet: stream does not contain a descriptor set.");
+		DescriptorSet set(b, static_cast<size_t>(count));
+		in.read(reinterpret_cast<char*>(set.ptr), set.bytes());
+		if (!in) throw std::runtime_error("DescriptorSet: truncated descriptor set.");
+		return set;
+	}
+
+private:
+	uint64_t* ptr;
+	size_t num;
+	size_t cap;
+	uint16_t nbits;
+};
+
+}
+#endif /* KORAL_DESCRIPTORSET */
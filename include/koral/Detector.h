@@ -7,17 +7,20 @@
 #include <opencv2/features2d/features2d.hpp>
 #include "koral/CUDALERP.h"
 #include "koral/CLATCH.h"
+#include "koral/DescriptorSet.h"
 #include "koral/FeatureAngle.h"
 #include "koral/Keypoint.h"
+#include "koral/KeypointSet.h"
 #include "koral/KFAST.h"
 #include <chrono>
+#include <stdexcept>
 
 using namespace std::chrono;
 namespace koral {
 class FeatureDetector {
 public:
 	std::vector<Keypoint> kps;
-	std::vector<uint64_t> desc;
+	DescriptorSet desc;
 	bool receivedImg = false;
 	std::vector<cv::KeyPoint> converted_kps;
 private:
@@ -51,11 +54,22 @@ private:
 	const unsigned int height;
 	const unsigned int maxkp;
 	const uint8_t thresh;
+	const uint16_t desc_bits;
+
+	// scratch for converting keypoints to level-0 coordinates
+	KeypointSet kp_set;
+	std::vector<float> x0, y0;
 
 public:
-	FeatureDetector(const float _scale_factor, const uint8_t _scale_levels, const uint _width, const uint _height, const uint _maxkp, const uint8_t _thresh) : 
-	scale_factor(_scale_factor), scale_levels(_scale_levels), width(_width), height(_height), maxkp(_maxkp), thresh(_thresh)
+	// _desc_bits selects the descriptor length: 128, 256, 384, or 512
+	FeatureDetector(const float _scale_factor, const uint8_t _scale_levels, const uint _width, const uint _height, const uint _maxkp, const uint8_t _thresh, const uint16_t _desc_bits = 512) : 
+	scale_factor(_scale_factor), scale_levels(_scale_levels), width(_width), height(_height), maxkp(_maxkp), thresh(_thresh), desc_bits(_desc_bits), kp_set(_scale_factor, _scale_levels)
 	{
+		if (desc_bits != 128 && desc_bits != 256 && desc_bits != 384 && desc_bits != 512) {
+			throw std::invalid_argument("FeatureDetector: desc_bits must be 128, 256, 384, or 512.");
+		}
+		desc = DescriptorSet(desc_bits);
+
 		// Setting cache and shared modes
 		cudaDeviceSetCacheConfig(cudaFuncCachePreferEqual);
 		cudaDeviceSetSharedMemConfig(cudaSharedMemBankSizeFourByte);
@@ -161,13 +175,16 @@ public:
 		detectAndDescribe(image.data, image.cols, image.rows, thresh);
 		high_resolution_clock::time_point t2 = high_resolution_clock::now();
 		converted_kps.clear();
-		for (const auto& kp : kps) {
-			const float scale = static_cast<float>(
-				std::pow(scale_factor, kp.scale));
-			converted_kps.emplace_back(scale*static_cast<float>(kp.x),
-				scale*static_cast<float>(kp.y), 7.0f*scale,
-				180.0f / 3.1415926535f * kp.angle,
-				static_cast<float>(kp.score));
+		kp_set.clear();
+		kp_set.append(kps);
+		x0.resize(kps.size());
+		y0.resize(kps.size());
+		kp_set.toLevel0(x0.data(), y0.data());
+		for (size_t i = 0; i < kps.size(); ++i) {
+			const float scale = kp_set.scale(kp_set.level[i]);
+			converted_kps.emplace_back(x0[i], y0[i], 7.0f*scale,
+				180.0f / 3.1415926535f * kp_set.angle[i],
+				static_cast<float>(kp_set.score[i]));
 		}
 	}
 
@@ -248,13 +265,17 @@ private:
 			scale_levels * sizeof(cudaTextureObject_t), cudaMemcpyHostToDevice);
 		cudaMemcpy(d_kps, kps.data(), 
 			kps.size() * sizeof(Keypoint), cudaMemcpyHostToDevice);
-		CLATCH(d_all_tex, d_trip_tex, d_kps,
-			static_cast<int>(kps.size()), d_desc);
+		const int num_kps = static_cast<int>(kps.size());
+		switch (desc_bits) {
+		case 128: CLATCH<128>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+		case 256: CLATCH<256>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+		case 384: CLATCH<384>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+		default:  CLATCH<512>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+		}
 
 		// Transfer descriptors to host
-		desc.clear();
-		desc.resize(8 * kps.size());
-		cudaMemcpy(&desc[0], d_desc, 64 * kps.size(), cudaMemcpyDeviceToHost);
+		desc.resize(kps.size());
+		cudaMemcpy(desc.data(), d_desc, desc.bytes(), cudaMemcpyDeviceToHost);
 		
 		cudaDeviceSynchronize();
 	}
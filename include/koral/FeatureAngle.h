@@ -156,7 +156,16 @@
 #include <cfloat>
 #include <cstdint>
 
+#include "ImageLevel.h"
+#include "KeypointSet.h"
+
 float featureAngle(const uint8_t* const __restrict image, const int px, const int py, const int step);
 
+// sets kps.angle for every keypoint in the set, from its level in levels.
+// The moments are gathered per keypoint and the arctangents are
+// evaluated 8 keypoints at a time. Results agree with featureAngle()
+// to within float rounding (about 1e-7 rad).
+void featureAngles(const koral::ImageLevel* const __restrict levels, koral::KeypointSet& kps);
+
 
 #endif /* KORAL_FEATUREANGLE */
@@ -0,0 +1,78 @@
+/*******************************************************************
+*   GuidedMatcher.h
+*   KORAL
+*******************************************************************/
+//
+// Guided 2NN matching for tracking: each query is compared only
+// against training keypoints near where a motion prediction puts
+// it, instead of against the whole training set.
+//
+// The training keypoints are bucketed by pyramid level into a grid
+// of cell x cell pixel cells in level-0 coordinates (see
+// KeypointSet::toLevel0()), stored row-major so that the cells of a
+// grid row are one contiguous run. The descriptors are copied in
+// grid order, so the candidates of a window are mostly contiguous.
+//
+// match() takes, per query, a predicted level-0 position and a
+// search radius, or one global prediction - a homography, or an
+// affine map as a homography with last row (0, 0, 1) - that maps
+// each query keypoint's level-0 position into the training image,
+// with a common radius. Candidates are the training keypoints
+// within the radius of the prediction, on levels within
+// level_window of the query keypoint's level (all levels if
+// level_window is negative). They are measured 4 at a time with
+// hamming4() (Hamming.h).
+//
+// The result follows CUDAK2NN among the candidates: the best
+// training index if the second-best distance is more than threshold
+// bits larger (threshold modulo 256), ties to the lower index, a
+// single candidate always matches, and none gives -1, as does a
+// negative radius or a prediction behind the camera.
+//
+// With multithreading, queries are split across hardware threads.
+//
+
+#ifndef KORAL_GUIDEDMATCHER
+#define KORAL_GUIDEDMATCHER
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "DescriptorSet.h"
+#include "KeypointSet.h"
+
+namespace koral {
+class GuidedMatcher {
+public:
+	// train_kps needs scales for all of its levels
+	GuidedMatcher(const KeypointSet& train_kps, const DescriptorView& train, const int cell = 32);
+
+	size_t size() const { return ids.size(); }
+
+	template <const bool multithreading>
+	void match(const KeypointSet& query_kps, const DescriptorView& query, const float* const __restrict px, const float* const __restrict py, const float* const __restrict radius, int* const __restrict matches, const int threshold, const int level_window = 1) const;
+
+	// H is row-major 3x3, mapping query level-0 positions to training level-0 positions
+	template <const bool multithreading>
+	void match(const KeypointSet& query_kps, const DescriptorView& query, const float* const __restrict H, const float radius, int* const __restrict matches, const int threshold, const int level_window = 1) const;
+
+private:
+	const int cell;
+	float min_x, min_y;
+	int cols, rows, levels;
+	// start of cell (level, row, col) in the grid-ordered arrays, at index (level * rows + row) * cols + col
+	std::vector<uint32_t> starts;
+	std::vector<float> xs, ys;
+	std::vector<uint32_t> ids;
+	DescriptorSet desc;
+
+	// distances from q to 4 descriptors, packed as 16-bit fields
+	uint64_t (*dist4)(const uint64_t* const q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3);
+
+	void matchRange(const KeypointSet& query_kps, const DescriptorView& query, const int start, const int end, const float* const px, const float* const py, const float* const radius, int* const matches, const int threshold, const int level_window) const;
+};
+
+}
+#endif /* KORAL_GUIDEDMATCHER */
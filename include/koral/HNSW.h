@@ -0,0 +1,106 @@
+/*******************************************************************
+*   HNSW.h
+*   KORAL
+*******************************************************************/
+//
+// Hierarchical navigable small-world graph (Malkov and Yashunin)
+// over binary descriptors, for approximate nearest-neighbor search
+// in corpora too large for brute force or MIH.
+//
+// Each descriptor is a node on layers 0 to L, with L drawn from a
+// geometric distribution, and is linked to up to M neighbors per
+// layer (2 * M on layer 0), chosen with the diversity heuristic,
+// whose unused places are filled with the closest candidates it
+// pruned (keepPrunedConnections). An exact duplicate of a descriptor
+// already in the graph is not linked, but chained to it as a twin,
+// so that many copies cannot fill each other's lists and cut
+// themselves off from the rest of the graph. A search descends greedily from the top layer, then runs a best-first
+// search on layer 0 that keeps the ef closest descriptors found. The
+// metric is Hamming distance; the neighbors of each expanded node are
+// measured 4 at a time with hamming4() (Hamming.h).
+//
+// add() inserts descriptors, splitting them across hardware threads
+// when multithreading. Inserting threads lock neighbor lists with
+// striped mutexes. Descriptors get ids in insertion order, starting
+// at 0; the layer of each is drawn from seed before insertion, so a
+// single-threaded build is deterministic. Searches must not run
+// concurrently with add().
+//
+// ef trades recall for latency at query time: larger ef visits more
+// of the graph. top2() returns, per query, the best id and distance
+// and the second-best distance among those found; match() applies the
+// CUDAK2NN threshold rule to them (a match if second - best >
+// threshold, ties in distance go to the lower id). Both are exact only
+// if the true 2 nearest neighbors are found. An ef of at least the
+// index size makes them exact: the graph cannot promise to link to
+// every node, so such a search scans all the descriptors instead.
+//
+
+#ifndef KORAL_HNSW
+#define KORAL_HNSW
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "DescriptorSet.h"
+
+namespace koral {
+class HNSWIndex {
+public:
+	HNSWIndex(const uint16_t bits, const int M = 16, const int ef_construction = 100, const uint64_t seed = 0);
+
+	size_t size() const { return desc.size(); }
+	uint16_t bits() const { return desc.bits(); }
+	const DescriptorSet& descriptors() const { return desc; }
+
+	template <const bool multithreading>
+	void add(const DescriptorView& train);
+
+	// best_d and second_d may be nullptr; a missing second is 200000, and an empty index gives id -1
+	template <const bool multithreading>
+	void top2(const DescriptorView& query, const int ef, int* const __restrict best_i, int* const __restrict best_d, int* const __restrict second_d) const;
+
+	template <const bool multithreading>
+	void match(const DescriptorView& query, int* const __restrict matches, const int threshold, const int ef) const;
+
+private:
+	const int M;
+	const int M0;
+	const int ef_construction;
+	const double level_mult;
+	std::mt19937_64 rng;
+
+	DescriptorSet desc;
+	std::vector<uint8_t> levels;
+	// layer 0: per node, a count then up to M0 ids
+	std::vector<uint32_t> links0;
+	// layers 1 and up: per node, for each of its layers, a count then up to M ids
+	std::vector<std::vector<uint32_t>> links;
+	// per node, the next exact duplicate sharing its links, or UINT32_MAX
+	std::vector<uint32_t> twin;
+
+	int32_t entry;
+	int max_level;
+	std::mutex entry_mutex;
+	std::unique_ptr<std::mutex[]> node_mutex;
+
+	// distances from q to 4 descriptors, packed as 16-bit fields
+	uint64_t (*dist4)(const uint64_t* const q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3);
+
+	uint32_t* neighbors(const uint32_t id, const int layer);
+	const uint32_t* neighbors(const uint32_t id, const int layer) const;
+	std::mutex& lock(const uint32_t id) const;
+
+	struct Search;
+	void insert(const uint32_t id, Search& s);
+	void insertRange(const uint32_t first, const uint32_t last);
+	void searchRange(const DescriptorView& query, const int start, const int end, const int ef, int* const best_i, int* const best_d, int* const second_d) const;
+};
+
+}
+#endif /* KORAL_HNSW */
@@ -0,0 +1,119 @@
+/*******************************************************************
+*   Hamming.h
+*   KORAL
+*******************************************************************/
+//
+// Hamming distance kernels shared by the CPU matchers and indexes.
+//
+// hamming4() takes one query, already loaded into registers with
+// hammingLoad(), against 4 descriptors at once: the XORs are
+// popcounted per byte with vpshufb nibble lookups, summed with
+// vpsadbw, and packed so the 4 distances come back together as the
+// low 4 16-bit fields of an __m128i. At 128 bits, two descriptors
+// share a 256-bit register. hamming() is the scalar popcnt form,
+// for single pairs and tails.
+//
+// bits is 128, 256, 384, or 512, and descriptors are packed at
+// bits / 64 uint64_t, as in DescriptorSet. No kernel reads past the
+// descriptors it is given.
+//
+// AVX2 is required.
+//
+
+#ifndef KORAL_HAMMING
+#define KORAL_HAMMING
+
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+
+namespace koral {
+
+// a descriptor as whole 256-bit chunks plus, for 128 and 384 bits, a zero-extended 128-bit half
+template <const int bits>
+struct HammingChunks {
+	static constexpr int full = bits >> 8;
+	static constexpr int total = (bits + 255) >> 8;
+};
+
+template <const int bits>
+inline void hammingLoad(const uint64_t* const __restrict p, __m256i* const __restrict v) {
+	for (int k = 0; k < HammingChunks<bits>::full; ++k) v[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + (k << 2)));
+	if (HammingChunks<bits>::full != HammingChunks<bits>::total) {
+		v[HammingChunks<bits>::full] = _mm256_inserti128_si256(_mm256_setzero_si256(), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + (HammingChunks<bits>::full << 2))), 0);
+	}
+}
+
+// popcount of each byte of v
+inline __m256i hammingPopcnt8(const __m256i v) {
+	const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i lo = _mm256_set1_epi8(0x0F);
+	return _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(v, lo)), _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), lo)));
+}
+
+// 4 qwords of partial distance between q and descriptor t (at most 16 per byte before the sum)
+template <const int bits>
+inline __m256i hammingPartial(const __m256i* const __restrict q, const uint64_t* const __restrict t) {
+	__m256i v[HammingChunks<bits>::total];
+	hammingLoad<bits>(t, v);
+	__m256i c = hammingPopcnt8(_mm256_xor_si256(q[0], v[0]));
+	for (int k = 1; k < HammingChunks<bits>::total; ++k) c = _mm256_add_epi8(c, hammingPopcnt8(_mm256_xor_si256(q[k], v[k])));
+	return _mm256_sad_epu8(c, _mm256_setzero_si256());
+}
+
+// distances to t0, t1, t2, t3, as the low 4 16-bit fields
+template <const int bits>
+inline __m128i hamming4(const __m256i* const __restrict q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3) {
+	const __m256i d = _mm256_or_si256(
+		_mm256_or_si256(hammingPartial<bits>(q, t0), _mm256_slli_epi64(hammingPartial<bits>(q, t1), 16)),
+		_mm256_or_si256(_mm256_slli_epi64(hammingPartial<bits>(q, t2), 32), _mm256_slli_epi64(hammingPartial<bits>(q, t3), 48)));
+	const __m128i x = _mm_add_epi64(_mm256_castsi256_si128(d), _mm256_extracti128_si256(d, 1));
+	return _mm_add_epi64(x, _mm_unpackhi_epi64(x, x));
+}
+
+// 128-bit distances from two 256-bit registers, each holding two descriptors
+inline __m128i hamming4Pairs(const __m256i qq, const __m256i t01, const __m256i t23) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i a = _mm256_sad_epu8(hammingPopcnt8(_mm256_xor_si256(qq, t01)), zero);
+	const __m256i b = _mm256_sad_epu8(hammingPopcnt8(_mm256_xor_si256(qq, t23)), zero);
+	// qwords (t0 | t2 << 32) twice, then (t1 | t3 << 32) twice
+	const __m256i d = _mm256_or_si256(a, _mm256_slli_epi64(b, 32));
+	const __m128i x = _mm_add_epi64(_mm256_castsi256_si128(d), _mm_slli_epi64(_mm256_extracti128_si256(d, 1), 16));
+	return _mm_add_epi64(x, _mm_unpackhi_epi64(x, x));
+}
+
+template <>
+inline __m128i hamming4<128>(const __m256i* const __restrict q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3) {
+	const __m256i t01 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t0))), _mm_loadu_si128(reinterpret_cast<const __m128i*>(t1)), 1);
+	const __m256i t23 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t2))), _mm_loadu_si128(reinterpret_cast<const __m128i*>(t3)), 1);
+	return hamming4Pairs(_mm256_permute2x128_si256(q[0], q[0], 0), t01, t23);
+}
+
+// distances to the 4 consecutive descriptors starting at t
+template <const int bits>
+inline __m128i hamming4(const __m256i* const __restrict q, const uint64_t* const __restrict t) {
+	constexpr int words = bits >> 6;
+	return hamming4<bits>(q, t, t + words, t + 2 * words, t + 3 * words);
+}
+
+template <>
+inline __m128i hamming4<128>(const __m256i* const __restrict q, const uint64_t* const __restrict t) {
+	return hamming4Pairs(_mm256_permute2x128_si256(q[0], q[0], 0), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(t)), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(t + 4)));
+}
+
+template <const int bits>
+inline int hamming(const uint64_t* const __restrict a, const uint64_t* const __restrict b) {
+	int d = 0;
+	for (int w = 0; w < (bits >> 6); ++w) d += static_cast<int>(_mm_popcnt_u64(a[w] ^ b[w]));
+	return d;
+}
+
+inline int hamming(const uint64_t* const __restrict a, const uint64_t* const __restrict b, const int words) {
+	int d = 0;
+	for (int w = 0; w < words; ++w) d += static_cast<int>(_mm_popcnt_u64(a[w] ^ b[w]));
+	return d;
+}
+
+}
+#endif /* KORAL_HAMMING */
@@ -0,0 +1,32 @@
+/*******************************************************************
+*   ImageLevel.h
+*   KORAL
+*******************************************************************/
+//
+// Host-side view of one scale level of an image pyramid,
+// as consumed by the CPU describers. Does not own its pixels.
+//
+// Keypoint x- and y-coords are on their native scale level,
+// so a keypoint with scale i is looked up in level i.
+//
+
+#ifndef KORAL_IMAGELEVEL
+#define KORAL_IMAGELEVEL
+
+#pragma once
+
+#include <cstdint>
+
+namespace koral {
+struct ImageLevel {
+	const uint8_t* img;
+	int32_t w;
+	int32_t h;
+	int32_t stride;
+
+	ImageLevel() : img(nullptr), w(0), h(0), stride(0) {}
+	ImageLevel(const uint8_t* const _img, const int32_t _w, const int32_t _h, const int32_t _stride) : img(_img), w(_w), h(_h), stride(_stride) {}
+};
+
+}
+#endif /* KORAL_IMAGELEVEL */
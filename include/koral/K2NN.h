@@ -0,0 +1,169 @@
+/*******************************************************************
+*   K2NN.h
+*   KORAL
+*******************************************************************/
+//
+// CPU brute-force matcher for binary descriptors in 2NN mode,
+// for nodes without a GPU.
+//
+// Same semantics as CUDAK2NN: for each query, the training
+// descriptor at the smallest Hamming distance is returned if the
+// second-smallest distance is more than threshold bits larger,
+// and -1 otherwise. Ties go to the lowest training index (so an
+// exact tie is never a match), a training set of one descriptor
+// always matches, and an empty training set never does. As in
+// CUDAK2NN, threshold is taken modulo 256. Output is identical
+// to CUDAK2NN<bits>.
+//
+// Queries are processed in blocks of 64 against tiles of 512
+// training descriptors (32 KiB at 512 bits), so a tile stays in
+// L1/L2 while the whole query block passes over it. Each query is
+// held in registers, and popcounts of its XOR with 4 training
+// descriptors at a time are taken with vpshufb nibble lookups and
+// vpsadbw, then packed so the 4 distances are reduced together.
+// The running best and second-best live in registers within a
+// tile. With multithreading, queries are split evenly across
+// hardware threads.
+//
+// bits selects the descriptor length: 128, 256, 384, or 512 (the
+// default). Descriptors are packed at bits / 8 bytes each, as
+// produced by CLATCH, LATCH, and BRIEF (256 bits). No reads go past
+// the last descriptor.
+//
+// K2NN() computes every distance in full. K2NNEarlyExit() is the
+// opt-in alternative: it sums the distances to 4 training descriptors
+// 128 bits at a time and abandons them as soon as none of the 4
+// partial sums is below the query's second best, which cannot change
+// the result, so the output is identical to K2NN(). It pays only when
+// the first chunks carry most of the distance, so the training and
+// query sets should first have their bits reordered by decreasing
+// variance with the same BitOrder (BitOrder.h). On uniformly random
+// descriptors it is slower than K2NN(): the second best lies in the
+// far lower tail of the distance distribution, partial sums rarely
+// reach it before the last 128 bits, and the data-dependent branch
+// costs more than the chunks it skips. Measure on the real
+// descriptors before switching.
+//
+// K2NNMutual() is the cross-checked form, in one pass: while each
+// distance tile is scanned, the best and second-best query of every
+// training descriptor are kept too (per thread, then merged in query
+// order), and a match is returned only if it passes the threshold
+// both ways and each side is the other's nearest neighbor. Output is
+// the same as intersecting K2NN query -> train with K2NN train ->
+// query, at little more than the cost of one K2NN pass. The training
+// side takes 14 bytes per training descriptor per thread.
+//
+// KNN() returns the k nearest training descriptors of each query
+// (k up to 8) with their Hamming distances, in a MatchSet
+// (MatchSet.h), nearest first, ties to the lower index. It resizes
+// the MatchSet, reusing its storage. It uses the same tiles and
+// kernel, skipping updates unless one of 4 distances beats the k-th
+// best; the 2NN rule is then d[1] - d[0] > threshold.
+//
+// K2NNImages() matches one query frame against several training
+// images in a single scan, e.g. candidate keyframes for place
+// recognition. The training set is the images' descriptors
+// concatenated, with offsets[i] the first descriptor of image i and
+// offsets[images] the total. Each tile is scanned as runs of one
+// image, keeping a best and second best per (query, image), so the
+// 2NN rule applies within each image. Results go to an
+// ImageMatchSet (MatchSet.h): the top 2 of every (query, image) pair,
+// and per image the list of matches passing the threshold.
+//
+// RadiusMatch() returns every training descriptor within Hamming
+// distance radius of each query, in a RadiusMatchSet (MatchSet.h),
+// nearest first. It resizes the RadiusMatchSet, reusing its storage.
+// For 384 and 512 bits, the distances to 4 training descriptors are
+// first taken over 256 bits, and the rest only if one of the 4 is
+// still within the radius; at the small radii used for verification
+// that almost never happens, so most of the work is skipped. With
+// max_results, only the nearest results of each query are kept, in a
+// heap of max_results per query while scanning, so memory does not
+// grow with the radius; once a query's heap is full, the limit drops
+// to the worst distance it holds.
+//
+// K2NN() also runs on a BitSlicedSet (BitSliced.h), the training
+// set transposed into 256-descriptor bit-planes: each query is
+// compared against 256 training descriptors at once by XOR with its
+// broadcast bits and Harley-Seal carry-save adders, and the resulting
+// bit-sliced distances are compared against the second best in the
+// same form, so distances are read out only for the rare lanes below
+// it. Output is identical.
+//
+// K2NN() and KNN() also run on a TrainingStore (TrainingStore.h),
+// skipping its dead slots and returning store ids.
+//
+// K2NNReference() is a plain scalar implementation of the same
+// computation, for verification.
+//
+// AVX2 is required.
+//
+
+#ifndef KORAL_K2NN
+#define KORAL_K2NN
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BitSliced.h"
+#include "DescriptorSet.h"
+#include "MatchSet.h"
+#include "TrainingStore.h"
+
+template <const bool multithreading, const int bits = 512>
+void K2NN(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+
+// dispatches on the descriptor length; train and query must have the same length
+template <const bool multithreading>
+void K2NN(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+
+// on the live descriptors of a TrainingStore; matches are store ids
+template <const bool multithreading>
+void K2NN(const koral::TrainingStore& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+
+// on a transposed training set; same output as on the row-major one
+template <const bool multithreading>
+void K2NN(const koral::BitSlicedSet& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+
+// same output as K2NN; see BitOrder.h for the bit order it is meant for
+template <const bool multithreading, const int bits = 512>
+void K2NNEarlyExit(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+
+template <const bool multithreading>
+void K2NNEarlyExit(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+
+template <const bool multithreading, const int bits = 512>
+void K2NNMutual(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+
+template <const bool multithreading>
+void K2NNMutual(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+
+template <const bool multithreading, const int bits = 512>
+void KNN(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int k, koral::MatchSet& matches);
+
+template <const bool multithreading>
+void KNN(const koral::DescriptorView& train, const koral::DescriptorView& query, const int k, koral::MatchSet& matches);
+
+// on the live descriptors of a TrainingStore; indices are store ids
+template <const bool multithreading>
+void KNN(const koral::TrainingStore& train, const koral::DescriptorView& query, const int k, koral::MatchSet& matches);
+
+template <const bool multithreading, const int bits = 512>
+void K2NNImages(const uint64_t* const __restrict train, const uint32_t* const __restrict offsets, const int num_images, const uint64_t* const __restrict query, const int num_q, const int threshold, koral::ImageMatchSet& matches);
+
+template <const bool multithreading>
+void K2NNImages(const koral::DescriptorView& train, const std::vector<uint32_t>& offsets, const koral::DescriptorView& query, const int threshold, koral::ImageMatchSet& matches);
+
+// max_results = 0 keeps every result; otherwise only the nearest max_results of each query
+template <const bool multithreading, const int bits = 512>
+void RadiusMatch(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int radius, koral::RadiusMatchSet& matches, const int max_results = 0);
+
+template <const bool multithreading>
+void RadiusMatch(const koral::DescriptorView& train, const koral::DescriptorView& query, const int radius, koral::RadiusMatchSet& matches, const int max_results = 0);
+
+template <const int bits = 512>
+void K2NNReference(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+
+#endif /* KORAL_K2NN */
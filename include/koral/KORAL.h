@@ -38,6 +38,45 @@
 // koral.kps, while descriptors are available at
 // koral.desc.
 //
+// On memory-constrained targets, construct with
+//
+//      KORAL koral(scale_factor, scale_levels, true);
+//
+// to enable low-memory streaming mode. Instead of keeping every
+// scale level alive until description, each level is resampled
+// into one of two ping-pong buffers and fully detected, oriented,
+// and described before its buffer is reused, so peak pyramid
+// memory is about two levels beyond the original image. Results
+// are identical to the normal mode.
+//
+// Descriptors are 512 bits by default. For faster matching and
+// smaller feature stores, pass desc_bits = 128, 256, or 384 as the
+// fourth constructor argument to compute only the leading (most
+// discriminative) triplets; descriptors are then packed at
+// desc_bits / 64 uint64_t each, and should be matched with the
+// corresponding CUDAK2NN<desc_bits>.
+//
+// For cameras that see no in-plane rotation (ground robots, fixed
+// mounts), pass upright = true as the fifth constructor argument.
+// Orientation is then skipped entirely, every keypoint gets
+// angle 0, and CLATCH samples axis-aligned patches with the
+// rotation compiled out. Upright descriptors are identical to
+// rotated ones at angle 0, so they are not rotation invariant.
+//
+// To describe known points (tracked features, re-localization)
+// without detecting, call
+//
+//      koral.describeKeypoints(image, width, height, points);
+//
+// with keypoints carrying scale, x, and y, and angle = NAN
+// where orientation should be computed. Only the scale levels
+// the points use are resampled.
+//
+// koral.desc is a DescriptorSet: an aligned, padded, move-only
+// block of descriptors that carries its own bit length and count.
+// Use koral.desc[i] for a pointer to descriptor i, or
+// koral.desc.view() / koral.desc.slice() for zero-copy views.
+//
 // Portions of KORAL require SSE, AVX, AVX2, and CUDA.
 // The author is working on reduced-performance versions
 // with lesser requirements, but as the intent of this work
@@ -155,12 +194,14 @@
 
 #include "CLATCH.h"
 #include "CUDALERP.h"
+#include "DescriptorSet.h"
 #include "FeatureAngle.h"
 #include "KFAST.h"
 
 #include <cstdint>
 #include <cstring>
 #include <cuda_runtime.h>
+#include <stdexcept>
 #include <vector>
 
 namespace koral {
@@ -168,7 +209,7 @@ class KORAL {
 	// public member variables
 public:
 	std::vector<Keypoint> kps;
-	std::vector<uint64_t> desc;
+	DescriptorSet desc;
 
 	// private member variables
 private:
@@ -191,12 +232,20 @@ private:
 	cudaTextureObject_t d_trip_tex;
 	const float scale_factor;
 	const uint8_t scale_levels;
+	const bool low_memory;
+	const uint16_t desc_bits;
+	const bool upright;
 	uint64_t* d_desc;
 	Keypoint* d_kps;
 
 	// public methods
 public:
-	KORAL(const float _scale_factor, const uint8_t _scale_levels) : scale_factor(_scale_factor), scale_levels(_scale_levels) {
+	KORAL(const float _scale_factor, const uint8_t _scale_levels, const bool _low_memory = false, const uint16_t _desc_bits = 512, const bool _upright = false) : scale_factor(_scale_factor), scale_levels(_scale_levels), low_memory(_low_memory), desc_bits(_desc_bits), upright(_upright) {
+		if (desc_bits != 128 && desc_bits != 256 && desc_bits != 384 && desc_bits != 512) {
+			throw std::invalid_argument("KORAL: desc_bits must be 128, 256, 384, or 512.");
+		}
+		desc = DescriptorSet(desc_bits);
+
 		// setting cache and shared modes
 		cudaDeviceSetCacheConfig(cudaFuncCachePreferEqual);
 		cudaDeviceSetSharedMemConfig(cudaSharedMemBankSizeFourByte);
@@ -240,6 +289,11 @@ public:
 	}
 
 	void go(const uint8_t* image, const uint32_t width, const uint32_t height, const uint8_t KFAST_thresh) {
+		if (low_memory) {
+			goStreaming(image, width, height, KFAST_thresh);
+			return;
+		}
+
 		kps.clear();
 		levels[0].h_img = image;
 		levels[0].w = width;
@@ -315,7 +369,7 @@ public:
 			// set scale and compute angles
 			for (auto& kp : local_kps) {
 				kp.scale = i;
-				kp.angle = featureAngle(levels[i].h_img, kp.x, kp.y, static_cast<int>(levels[i].w));
+				kp.angle = upright ? 0.0f : featureAngle(levels[i].h_img, kp.x, kp.y, static_cast<int>(levels[i].w));
 			}
 			//std::cout << "Got " << local_kps.size() << " keypoints from level " << +i << '.' << std::endl;
 			kps.insert(kps.end(), local_kps.begin(), local_kps.end());
@@ -335,13 +389,12 @@ public:
 		cudaMalloc(&d_all_tex, scale_levels * sizeof(cudaTextureObject_t));
 		cudaMemcpy(d_all_tex, all_tex, scale_levels * sizeof(cudaTextureObject_t), cudaMemcpyHostToDevice);
 
-		CLATCH(d_all_tex, d_trip_tex, d_kps, static_cast<int>(kps.size()), d_desc);
+		describe(d_all_tex, static_cast<int>(kps.size()));
 
 		// transfer descriptors
 
-		desc.clear();
-		desc.resize(8 * kps.size());
-		cudaMemcpy(&desc[0], d_desc, 64 * kps.size(), cudaMemcpyDeviceToHost);
+		desc.resize(kps.size());
+		cudaMemcpy(desc.data(), d_desc, desc.bytes(), cudaMemcpyDeviceToHost);
 
 		//for (int i = 0; i < scale_levels; ++i) {
 		//	std::vector<cv::KeyPoint> converted_kps;
@@ -358,10 +411,280 @@ public:
 		//cudaDeviceReset();
 	}
 
+	// describes only the given points on image, with no detection. Each point
+	// needs scale (its level), and x and y on that level. A NaN angle is
+	// computed with featureAngle (or set to 0 in upright mode); points within
+	// 3 pixels of their level's border get angle 0. Only the levels the points
+	// use are resampled, and only those needing angles are copied back to the host.
+	// Results replace kps and desc, in the order given.
+	void describeKeypoints(const uint8_t* image, const uint32_t width, const uint32_t height, const std::vector<Keypoint>& points) {
+		kps = points;
+		desc.clear();
+
+		std::vector<uint8_t> used(scale_levels, 0), need_host(scale_levels, 0);
+		std::vector<uint32_t> w(scale_levels), h(scale_levels);
+		std::vector<float> fs(scale_levels, 1.0f);
+		w[0] = width;
+		h[0] = height;
+		for (int i = 1; i < scale_levels; ++i) {
+			fs[i] = fs[i - 1] * scale_factor;
+			w[i] = static_cast<uint32_t>(static_cast<float>(width) / fs[i] + 0.5f);
+			h[i] = static_cast<uint32_t>(static_cast<float>(height) / fs[i] + 0.5f);
+		}
+		for (auto& kp : kps) {
+			if (kp.scale >= scale_levels || kp.x < 0 || kp.y < 0 || static_cast<uint32_t>(kp.x) >= w[kp.scale] || static_cast<uint32_t>(kp.y) >= h[kp.scale]) {
+				throw std::invalid_argument("KORAL: keypoint outside its scale level.");
+			}
+			used[kp.scale] = 1;
+			if (upright) kp.angle = 0.0f;
+			else if (angleMissing(kp.angle)) need_host[kp.scale] = 1;
+		}
+		if (kps.empty()) return;
+
+		// original image as cudaArray, bound as normalized float (for LERP)
+		// and as ElementType (for CLATCH on level 0)
+		cudaArray* d_img_array;
+		cudaTextureObject_t d_img_tex_nf;
+		{
+			cudaMallocArray(&d_img_array, &chandesc_img, width, height, cudaArrayTextureGather);
+			cudaMemcpyToArray(d_img_array, 0, 0, image, static_cast<size_t>(width) * static_cast<size_t>(height), cudaMemcpyHostToDevice);
+			struct cudaResourceDesc resdesc_img;
+			memset(&resdesc_img, 0, sizeof(resdesc_img));
+			resdesc_img.resType = cudaResourceTypeArray;
+			resdesc_img.res.array.array = d_img_array;
+
+			texdesc_img.readMode = cudaReadModeNormalizedFloat;
+			cudaCreateTextureObject(&d_img_tex_nf, &resdesc_img, &texdesc_img, nullptr);
+
+			texdesc_img.readMode = cudaReadModeElementType;
+			cudaCreateTextureObject(&all_tex[0], &resdesc_img, &texdesc_img, nullptr);
+		}
+
+		// resample only the levels in use. Unused slots alias level 0 and are never read.
+		std::vector<uint8_t*> d_img(scale_levels, nullptr);
+		std::vector<std::vector<uint8_t>> h_img(scale_levels);
+		for (int i = 1; i < scale_levels; ++i) {
+			all_tex[i] = all_tex[0];
+			if (!used[i]) continue;
+			size_t pitch;
+			cudaMallocPitch(&d_img[i], &pitch, w[i], h[i]);
+
+			struct cudaResourceDesc resdesc_img;
+			memset(&resdesc_img, 0, sizeof(resdesc_img));
+			resdesc_img.resType = cudaResourceTypePitch2D;
+			resdesc_img.res.pitch2D.desc = chandesc_img;
+			resdesc_img.res.pitch2D.devPtr = d_img[i];
+			resdesc_img.res.pitch2D.height = h[i];
+			resdesc_img.res.pitch2D.pitchInBytes = pitch;
+			resdesc_img.res.pitch2D.width = w[i];
+			cudaCreateTextureObject(&all_tex[i], &resdesc_img, &texdesc_img, nullptr);
+
+			CUDALERP(d_img_tex_nf, fs[i], fs[i], d_img[i], pitch, w[i], h[i], 0);
+			if (need_host[i]) {
+				h_img[i].resize(static_cast<size_t>(w[i]) * static_cast<size_t>(h[i]) + 1);
+				cudaMemcpy2D(h_img[i].data(), w[i], d_img[i], pitch, w[i], h[i], cudaMemcpyDeviceToHost);
+			}
+		}
+
+		// missing angles
+		if (!upright) {
+			for (auto& kp : kps) {
+				if (!angleMissing(kp.angle)) continue;
+				const uint8_t* const img = kp.scale ? h_img[kp.scale].data() : image;
+				const bool inside = kp.x >= 3 && kp.y >= 3 && static_cast<uint32_t>(kp.x) + 3 < w[kp.scale] && static_cast<uint32_t>(kp.y) + 3 < h[kp.scale];
+				kp.angle = inside ? featureAngle(img, kp.x, kp.y, static_cast<int>(w[kp.scale])) : 0.0f;
+			}
+		}
+
+		cudaMalloc(&d_desc, (desc_bits >> 3) * kps.size());
+		cudaMalloc(&d_kps, kps.size() * sizeof(Keypoint));
+		cudaMemcpy(d_kps, kps.data(), kps.size() * sizeof(Keypoint), cudaMemcpyHostToDevice);
+		cudaTextureObject_t* d_all_tex;
+		cudaMalloc(&d_all_tex, scale_levels * sizeof(cudaTextureObject_t));
+		cudaMemcpy(d_all_tex, all_tex, scale_levels * sizeof(cudaTextureObject_t), cudaMemcpyHostToDevice);
+
+		describe(d_all_tex, static_cast<int>(kps.size()));
+
+		desc.resize(kps.size());
+		cudaMemcpy(desc.data(), d_desc, desc.bytes(), cudaMemcpyDeviceToHost);
+
+		cudaFree(d_desc);
+		cudaFree(d_kps);
+		d_desc = nullptr;
+		d_kps = nullptr;
+		cudaFree(d_all_tex);
+		for (int i = 1; i < scale_levels; ++i) {
+			if (!d_img[i]) continue;
+			cudaDestroyTextureObject(all_tex[i]);
+			cudaFree(d_img[i]);
+		}
+		cudaDestroyTextureObject(all_tex[0]);
+		cudaDestroyTextureObject(d_img_tex_nf);
+		cudaFreeArray(d_img_array);
+	}
+
 	// private methods
 private:
 
+	// runs CLATCH at the configured descriptor length on the num_kps keypoints in d_kps
+	void describe(cudaTextureObject_t* d_all_tex, const int num_kps) {
+		if (upright) {
+			switch (desc_bits) {
+			case 128: CLATCH<128, true>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+			case 256: CLATCH<256, true>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+			case 384: CLATCH<384, true>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+			default:  CLATCH<512, true>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+			}
+			return;
+		}
+		switch (desc_bits) {
+		case 128: CLATCH<128>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+		case 256: CLATCH<256>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+		case 384: CLATCH<384>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+		default:  CLATCH<512>(d_all_tex, d_trip_tex, d_kps, num_kps, d_desc); break;
+		}
+	}
+
+	// low-memory variant of go(): levels 1 and up are resampled (still from the
+	// original image, exactly as in go(), so output is identical) into two
+	// ping-pong buffers, and each level is detected, oriented, and described
+	// before its buffer is recycled for the level after next. While the CPU
+	// runs KFAST on level i, the GPU is already resampling level i + 1.
+	void goStreaming(const uint8_t* image, const uint32_t width, const uint32_t height, const uint8_t KFAST_thresh) {
+		kps.clear();
+		desc.clear();
+		levels[0].h_img = image;
+		levels[0].w = width;
+		levels[0].h = height;
+		levels[0].total = static_cast<size_t>(width) * static_cast<size_t>(height);
+
+		float f = 1.0f;
+		float* fs = new float[scale_levels];
+		fs[0] = 1.0f;
+		for (int i = 1; i < scale_levels; ++i) {
+			fs[i] = (f *= scale_factor);
+			levels[i].w = static_cast<uint32_t>(static_cast<float>(width) / f + 0.5f);
+			levels[i].h = static_cast<uint32_t>(static_cast<float>(height) / f + 0.5f);
+			levels[i].total = static_cast<size_t>(levels[i].w)*static_cast<size_t>(levels[i].h);
+		}
+
+		// original image as cudaArray, bound as normalized float (for LERP)
+		// and as ElementType (for CLATCH on level 0)
+		cudaArray* d_img_array;
+		cudaTextureObject_t d_img_tex_nf;
+		{
+			cudaMallocArray(&d_img_array, &chandesc_img, width, height, cudaArrayTextureGather);
+			cudaMemcpyToArray(d_img_array, 0, 0, image, levels[0].total, cudaMemcpyHostToDevice);
+			struct cudaResourceDesc resdesc_img;
+			memset(&resdesc_img, 0, sizeof(resdesc_img));
+			resdesc_img.resType = cudaResourceTypeArray;
+			resdesc_img.res.array.array = d_img_array;
+
+			texdesc_img.readMode = cudaReadModeNormalizedFloat;
+			cudaCreateTextureObject(&d_img_tex_nf, &resdesc_img, &texdesc_img, nullptr);
+
+			texdesc_img.readMode = cudaReadModeElementType;
+			cudaCreateTextureObject(&all_tex[0], &resdesc_img, &texdesc_img, nullptr);
+		}
+
+		cudaTextureObject_t* d_all_tex;
+		cudaMalloc(&d_all_tex, scale_levels * sizeof(cudaTextureObject_t));
+		cudaMemcpy(d_all_tex, all_tex, sizeof(cudaTextureObject_t), cudaMemcpyHostToDevice);
+
+		// two ping-pong buffers, each sized for level 1 (the largest resampled level).
+		// level i lives in buffer i & 1
+		uint8_t* d_buf[2] = { nullptr, nullptr };
+		uint8_t* h_buf[2] = { nullptr, nullptr };
+		size_t pitch[2] = { 0, 0 };
+		cudaStream_t stream[2];
+		if (scale_levels > 1) {
+			for (int b = 0; b < 2; ++b) {
+				cudaMallocPitch(&d_buf[b], &pitch[b], levels[1].w, levels[1].h);
+				cudaMallocHost(&h_buf[b], levels[1].total + 1);
+				cudaStreamCreateWithFlags(stream + b, cudaStreamNonBlocking);
+			}
+		}
 
+		size_t desc_capacity = 0;
+		d_desc = nullptr;
+		d_kps = nullptr;
+		for (uint8_t i = 0; i < scale_levels; ++i) {
+			const int b = i & 1;
+			if (i) {
+				cudaMemcpy2DAsync(h_buf[b], levels[i].w, d_buf[b], pitch[b], levels[i].w, levels[i].h, cudaMemcpyDeviceToHost, stream[b]);
+				cudaStreamSynchronize(stream[b]);
+				levels[i].h_img = h_buf[b];
+
+				// bind this level's buffer to its texture slot for CLATCH
+				struct cudaResourceDesc resdesc_img;
+				memset(&resdesc_img, 0, sizeof(resdesc_img));
+				resdesc_img.resType = cudaResourceTypePitch2D;
+				resdesc_img.res.pitch2D.desc = chandesc_img;
+				resdesc_img.res.pitch2D.devPtr = d_buf[b];
+				resdesc_img.res.pitch2D.height = levels[i].h;
+				resdesc_img.res.pitch2D.pitchInBytes = pitch[b];
+				resdesc_img.res.pitch2D.width = levels[i].w;
+				cudaCreateTextureObject(&all_tex[i], &resdesc_img, &texdesc_img, nullptr);
+				cudaMemcpy(d_all_tex + i, all_tex + i, sizeof(cudaTextureObject_t), cudaMemcpyHostToDevice);
+			}
+
+			// the other buffer held level i - 1, which is fully described by now,
+			// so the GPU can start on level i + 1 while the CPU works on level i
+			if (i + 1 < scale_levels) {
+				const int nb = (i + 1) & 1;
+				CUDALERP(d_img_tex_nf, fs[i + 1], fs[i + 1], d_buf[nb], pitch[nb], levels[i + 1].w, levels[i + 1].h, stream[nb]);
+			}
+
+			std::vector<Keypoint> local_kps;
+			KFAST<true, true>(levels[i].h_img, levels[i].w, levels[i].h, levels[i].w, local_kps, KFAST_thresh);
+
+			// set scale and compute angles
+			for (auto& kp : local_kps) {
+				kp.scale = i;
+				kp.angle = upright ? 0.0f : featureAngle(levels[i].h_img, kp.x, kp.y, static_cast<int>(levels[i].w));
+			}
+
+			if (!local_kps.empty()) {
+				if (local_kps.size() > desc_capacity) {
+					cudaFree(d_desc);
+					cudaFree(d_kps);
+					desc_capacity = local_kps.size();
+					cudaMalloc(&d_desc, 64 * desc_capacity);
+					cudaMalloc(&d_kps, desc_capacity * sizeof(Keypoint));
+				}
+				cudaMemcpy(d_kps, local_kps.data(), local_kps.size() * sizeof(Keypoint), cudaMemcpyHostToDevice);
+				describe(d_all_tex, static_cast<int>(local_kps.size()));
+
+				// blocks until CLATCH is done with this level's buffer
+				const size_t old = desc.size();
+				desc.resize(old + local_kps.size());
+				cudaMemcpy(desc[old], d_desc, (desc_bits >> 3) * local_kps.size(), cudaMemcpyDeviceToHost);
+				kps.insert(kps.end(), local_kps.begin(), local_kps.end());
+			}
+
+			if (i) cudaDestroyTextureObject(all_tex[i]);
+			levels[i].h_img = nullptr;
+		}
+		levels[0].h_img = image;
+
+		cudaDeviceSynchronize();
+		for (int b = 0; b < 2; ++b) {
+			if (d_buf[b]) {
+				cudaFree(d_buf[b]);
+				cudaFreeHost(h_buf[b]);
+				cudaStreamDestroy(stream[b]);
+			}
+		}
+		cudaFree(d_desc);
+		cudaFree(d_kps);
+		d_desc = nullptr;
+		d_kps = nullptr;
+		cudaFree(d_all_tex);
+		cudaDestroyTextureObject(all_tex[0]);
+		cudaDestroyTextureObject(d_img_tex_nf);
+		cudaFreeArray(d_img_array);
+		delete[] fs;
+	}
 
 };
 }
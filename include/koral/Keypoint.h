@@ -154,6 +154,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 namespace koral {
 struct Keypoint {
 	int32_t x;
@@ -166,5 +167,13 @@ struct Keypoint {
 	Keypoint(const int32_t _x, const int32_t _y, const uint8_t _score) : x(_x), y(_y), score(_score) {}
 };
 
+// true if angle is NaN, i.e. orientation is still to be computed.
+// Tests the bits, as -Ofast (finite-math-only) folds std::isnan to false.
+inline bool angleMissing(const float angle) {
+	uint32_t bits;
+	memcpy(&bits, &angle, sizeof(bits));
+	return (bits & 0x7FFFFFFF) > 0x7F800000;
+}
+
 }
 #endif /* KORAL_KEYPOINT */
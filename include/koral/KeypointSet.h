@@ -0,0 +1,136 @@
+/*******************************************************************
+*   KeypointSet.h
+*   KORAL
+*******************************************************************/
+//
+// Structure-of-arrays keypoint container for vectorized passes.
+//
+// Each keypoint field is its own contiguous column (x, y, score,
+// angle, level), so per-keypoint passes - orientation, selection,
+// description, and conversion to level-0 coordinates - can load
+// 8 keypoints at a time instead of gathering from padded 20-byte
+// Keypoint records.
+//
+// The set also carries a per-level scale table (scale_factor^level),
+// so conversion to level-0 float coordinates is a table lookup and
+// a multiply, done with AVX2 gathers by toLevel0(). retainBest()
+// selects the strongest keypoints with a score histogram and 32-wide
+// compares. featureAngles() (FeatureAngle.h) and LATCH() (LATCH.h)
+// accept a KeypointSet directly.
+//
+// Keypoint remains the compact AoS form for interop: use
+// KeypointSet(kps, ...) / append() to import and toKeypoints() to
+// export.
+//
+
+#ifndef KORAL_KEYPOINTSET
+#define KORAL_KEYPOINTSET
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Keypoint.h"
+
+namespace koral {
+class KeypointSet {
+public:
+	std::vector<int32_t> x;
+	std::vector<int32_t> y;
+	std::vector<uint8_t> score;
+	std::vector<float> angle;
+	std::vector<uint8_t> level;
+
+	KeypointSet() {}
+	KeypointSet(const float scale_factor, const uint8_t scale_levels) { setScales(scale_factor, scale_levels); }
+	KeypointSet(const std::vector<Keypoint>& kps, const float scale_factor, const uint8_t scale_levels) {
+		setScales(scale_factor, scale_levels);
+		append(kps);
+	}
+
+	// scale table entries are built by repeated multiplication,
+	// exactly as the pyramid level sizes are
+	void setScales(const float scale_factor, const uint8_t scale_levels) {
+		level_scales.resize(scale_levels);
+		float f = 1.0f;
+		for (uint8_t i = 0; i < scale_levels; ++i, f *= scale_factor) level_scales[i] = f;
+	}
+
+	// factor from level i coordinates to level 0 coordinates
+	const float* scales() const { return level_scales.data(); }
+	float scale(const uint8_t i) const { return level_scales[i]; }
+	uint8_t levels() const { return static_cast<uint8_t>(level_scales.size()); }
+
+	size_t size() const { return x.size(); }
+	bool empty() const { return x.empty(); }
+
+	void clear() {
+		x.clear();
+		y.clear();
+		score.clear();
+		angle.clear();
+		level.clear();
+	}
+
+	void reserve(const size_t n) {
+		x.reserve(n);
+		y.reserve(n);
+		score.reserve(n);
+		angle.reserve(n);
+		level.reserve(n);
+	}
+
+	void resize(const size_t n) {
+		x.resize(n);
+		y.resize(n);
+		score.resize(n);
+		angle.resize(n);
+		level.resize(n);
+	}
+
+	void push_back(const Keypoint& kp) {
+		x.push_back(kp.x);
+		y.push_back(kp.y);
+		score.push_back(kp.score);
+		angle.push_back(kp.angle);
+		level.push_back(kp.scale);
+	}
+
+	void append(const std::vector<Keypoint>& kps) {
+		reserve(size() + kps.size());
+		for (const auto& kp : kps) push_back(kp);
+	}
+
+	Keypoint operator[](const size_t i) const {
+		Keypoint kp(x[i], y[i], score[i]);
+		kp.angle = angle[i];
+		kp.scale = level[i];
+		return kp;
+	}
+
+	void toKeypoints(Keypoint* const out) const {
+		for (size_t i = 0; i < size(); ++i) out[i] = (*this)[i];
+	}
+
+	std::vector<Keypoint> toKeypoints() const {
+		std::vector<Keypoint> kps(size());
+		toKeypoints(kps.data());
+		return kps;
+	}
+
+	// level-0 float coordinates of all keypoints, i.e. scale(level) * (x, y).
+	// Requires scales for every level in use.
+	void toLevel0(float* const __restrict x0, float* const __restrict y0) const;
+
+	// keeps the n highest-scoring keypoints (all of them if there are at most n),
+	// preserving their relative order. Ties at the cutoff score keep the earliest.
+	void retainBest(const size_t n);
+
+private:
+	std::vector<float> level_scales;
+};
+
+}
+#endif /* KORAL_KEYPOINTSET */
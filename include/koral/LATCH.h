@@ -0,0 +1,106 @@
+/*******************************************************************
+*   LATCH.h
+*   KORAL
+*******************************************************************/
+//
+// CPU implementation of the CLATCH binary descriptor, for
+// nodes without a GPU.
+//
+// Takes the same inputs as CLATCH - host pyramid levels,
+// keypoints with scale and angle, and the same triplets - and
+// produces 512-bit descriptors in exactly the GPU layout:
+// 8 uint64_t per keypoint, bit n of the descriptor (LSB of word 0
+// first) is triplet n. Databases built on either are interchangeable.
+//
+// For each keypoint the rotated 72x64 ROI is sampled just as
+// CLATCH_kernel does, then the 512 triplet SSD comparisons are
+// evaluated with AVX2 integer multiply-add, 8 triplets at a time.
+// With multithreading, keypoints are split evenly across
+// hardware threads.
+//
+// bits selects the descriptor length: 128, 256, 384, or 512 (the default).
+// Shorter descriptors compute only the leading (most discriminative)
+// triplets and are packed at bits / 8 bytes per keypoint; they equal
+// the corresponding prefix of the full descriptor.
+//
+// Optionally, pass LATCHTables to describe with pre-rotated sampling
+// tables instead: kp.angle is quantized into one of 'bins' evenly
+// spaced angles, and the ROI of every keypoint far enough from the
+// level borders is gathered through integer pixel offsets precomputed
+// per bin and level stride, with no per-pixel trig or float math.
+// Keypoints near the borders use the same quantized angle, with
+// clamping. The cost is an angle error of up to +/- pi / bins, i.e.
+// up to 4.4 px (32 bins) or 2.2 px (64 bins) of displacement at the
+// ROI corners. On noisy synthetic test imagery, 32 bins keeps about
+// 92% and 64 bins about 94.5% of descriptor bits identical to exact
+// rotation (vs. about 99% for 1024 bins, the remainder being
+// rounding), while roughly halving the cost per keypoint.
+// Tables take bins * 16 KiB per level.
+//
+// With upright, kp.angle is ignored and tables are unused: the ROI
+// is sampled axis-aligned, as 64 contiguous row copies per keypoint
+// away from the borders, with the rotation compiled out. Upright
+// descriptors equal the rotated ones at angle 0, and match
+// CLATCH<bits, true>.
+//
+// LATCHReference() is a plain scalar implementation of the same
+// computation, for verification.
+//
+// AVX2 is required.
+//
+
+#ifndef KORAL_LATCH
+#define KORAL_LATCH
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "DescriptorSet.h"
+#include "ImageLevel.h"
+#include "Keypoint.h"
+#include "KeypointSet.h"
+#include "Triplets.h"
+
+namespace koral {
+class LATCHTables {
+public:
+	// builds tables for the strides of levels[0] to levels[num_levels - 1]
+	LATCHTables(const ImageLevel* const levels, const int num_levels, const int bins = 32);
+
+	int bins() const { return num_bins; }
+	int levels() const { return static_cast<int>(strides.size()); }
+	int32_t stride(const int level) const { return strides[level]; }
+
+	// index of the bin nearest to angle
+	int bin(const float angle) const;
+
+	// 4096 pixel offsets, relative to the keypoint, of the 64x64 ROI rotated to 'bin', row-major
+	const int32_t* offsets(const int level, const int bin) const { return &offs[(static_cast<size_t>(level) * num_bins + bin) << 12]; }
+
+	// the same ROI as 4096 interleaved (dx, dy) pairs, independent of stride
+	const int8_t* deltas(const int bin) const { return &dxy[static_cast<size_t>(bin) << 13]; }
+
+private:
+	int num_bins;
+	std::vector<int32_t> strides;
+	std::vector<int8_t> dxy;
+	std::vector<int32_t> offs;
+};
+}
+
+template <const bool multithreading, const int bits = 512, const bool upright = false>
+void LATCH(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables = nullptr);
+
+// resizes desc to num_kps descriptors and describes at desc.bits()
+template <const bool multithreading, const bool upright = false>
+void LATCH(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables = nullptr);
+
+// the same, reading keypoints from the columns of a KeypointSet
+template <const bool multithreading, const bool upright = false>
+void LATCH(const koral::ImageLevel* const __restrict levels, const koral::KeypointSet& kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables = nullptr);
+
+void LATCHReference(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const int bits = 512);
+
+#endif /* KORAL_LATCH */
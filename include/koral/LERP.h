@@ -0,0 +1,35 @@
+/*******************************************************************
+*   LERP.h
+*   KORAL
+*******************************************************************/
+//
+// CPU bilinear image resize, for building the scale pyramid on
+// nodes without a GPU.
+//
+// Mirrors CUDALERP: output pixel (x, y) samples the source at
+// ((x + 0.5) * f - 0.5, (y + 0.5) * f - 0.5) with clamp-to-edge
+// addressing, blends the 4 neighbors bilinearly, and rounds.
+// As with CUDALERP, every level should be resampled from the
+// original image with the cumulative factor f. CUDALERP blends
+// through the texture unit's normalized floats, so the two may
+// occasionally differ by 1 in the last bit.
+//
+// Rows are processed 8 output pixels at a time with AVX2 gathers of
+// both neighbors per source row. With multithreading, rows are
+// split evenly across hardware threads.
+//
+// AVX2 is required.
+//
+
+#ifndef KORAL_LERP
+#define KORAL_LERP
+
+#pragma once
+
+#include <cstdint>
+
+template <const bool multithreading>
+void LERP(const uint8_t* __restrict const src, const int32_t w, const int32_t h, const int32_t src_stride, const float f,
+	uint8_t* __restrict const dst, const int32_t neww, const int32_t newh, const int32_t dst_stride);
+
+#endif /* KORAL_LERP */
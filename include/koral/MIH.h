@@ -0,0 +1,82 @@
+/*******************************************************************
+*   MIH.h
+*   KORAL
+*******************************************************************/
+//
+// Multi-index hashing (Norouzi et al.) over a set of binary
+// descriptors, for sublinear 2NN matching against large maps.
+//
+// The descriptor bits are cut into m contiguous substrings of at
+// most 32 bits, and each substring gets its own table from
+// substring value to the descriptors that have it. Any descriptor
+// within Hamming distance d of a query matches it to within
+// floor(d / m) bits on at least one substring, so a search probes
+// every substring at radius 0, 1, 2, ..., computing full distances
+// only for the descriptors it finds. After substring j of radius r,
+// every descriptor not yet seen is at least m * r + j + 1 bits away.
+//
+// match() has exactly the semantics and output of K2NN and
+// CUDAK2NN: it stops as soon as no unseen descriptor can change
+// the result (the best index, or whether the second best is more
+// than threshold bits worse). Probing touches scattered memory, so
+// a query whose probes are estimated to cost more than brute force
+// (one with no close neighbor) stops probing, and all such queries
+// are then matched together with K2NN. MIH pays off when most
+// queries lie within a few bits per substring of their match.
+//
+// substrings = 0 chooses substrings of about log2(size) bits, for
+// which buckets hold about one descriptor each. The index keeps its
+// own copy of the descriptors. Construction builds the substring
+// tables in parallel; with multithreading, match() splits queries
+// evenly across hardware threads.
+//
+
+#ifndef KORAL_MIH
+#define KORAL_MIH
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "DescriptorSet.h"
+
+namespace koral {
+class MIHIndex {
+public:
+	explicit MIHIndex(const DescriptorView& train, const int substrings = 0);
+
+	size_t size() const { return desc.size(); }
+	uint16_t bits() const { return desc.bits(); }
+	int substrings() const { return static_cast<int>(tables.size()); }
+
+	// 2NN match of each query; query must have the same length as the index
+	template <const bool multithreading>
+	void match(const DescriptorView& query, int* const __restrict matches, const int threshold) const;
+
+private:
+	// substring values in sorted order, with ids[starts[k]] to ids[starts[k + 1] - 1] holding keys[k],
+	// and an open-addressed hash from value to k
+	struct Table {
+		int offset;
+		int length;
+		std::vector<uint32_t> keys;
+		std::vector<uint32_t> starts;
+		std::vector<uint32_t> ids;
+		std::vector<int32_t> slots;
+		int shift;
+		// expected cost of probing one bucket, in brute-force distances
+		uint64_t probe_cost;
+	};
+
+	DescriptorSet desc;
+	std::vector<Table> tables;
+
+	uint32_t substring(const uint64_t* const d, const Table& table) const;
+	void buildTable(Table& table) const;
+	int matchOne(const uint64_t* const q, const int threshold, std::vector<uint32_t>& seen, uint32_t& stamp) const;
+	void matchRange(const DescriptorView& query, const int start, const int end, int* const __restrict matches, const int threshold) const;
+};
+
+}
+#endif /* KORAL_MIH */
@@ -0,0 +1,149 @@
+/*******************************************************************
+*   MatchSet.h
+*   KORAL
+*******************************************************************/
+//
+// Reusable structure-of-arrays container for k-nearest-neighbor
+// matches with their Hamming distances, as filled by KNN() (K2NN.h).
+//
+// For each query there is a row of k slots in each of two columns,
+// training indices and distances, plus the number of slots found.
+// Rows are sorted by ascending distance, ties to the lower training
+// index. Slots past count() hold index -1 and distance 0xFFFF.
+//
+// resize() keeps the storage, so a MatchSet reused across frames
+// allocates only when a frame needs more room than any before it.
+//
+// ImageMatchSet is the output of matching one query frame against
+// several training images at once, as by K2NNImages() (K2NN.h). For
+// each (query, image) pair it holds the best training index within
+// that image (-1 if the image is empty) with the best and second-best
+// distances, at index query * images() + image. For each image it
+// lists the matches that pass the 2NN threshold within the image, as
+// (query, training index) pairs ascending by query, ready for
+// geometric verification. Training indices are into the concatenated
+// training set. It is reusable in the same way.
+//
+// RadiusMatchSet holds, for each query, every training descriptor
+// within a Hamming radius, as filled by RadiusMatch() (K2NN.h). It is
+// laid out CSR-style: the results of query q are at positions
+// starts[q] to starts[q + 1] - 1 of the index and distance columns,
+// ascending by distance, ties to the lower training index. It is
+// reusable in the same way.
+//
+
+#ifndef KORAL_MATCHSET
+#define KORAL_MATCHSET
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace koral {
+class MatchSet {
+public:
+	static constexpr int max_k = 8;
+
+	MatchSet() : num(0), nk(0) {}
+	MatchSet(const size_t queries, const int k) : num(0), nk(0) { resize(queries, k); }
+
+	void resize(const size_t queries, const int k) {
+		if (k < 1 || k > max_k) throw std::invalid_argument("MatchSet: k must be between 1 and 8.");
+		num = queries;
+		nk = k;
+		idx.resize(num * nk);
+		dist.resize(num * nk);
+		found.resize(num);
+	}
+
+	size_t size() const { return num; }
+	bool empty() const { return num == 0; }
+	int k() const { return nk; }
+
+	// training indices of the neighbors of query q, nearest first
+	int32_t* indices(const size_t q) { return idx.data() + q * nk; }
+	const int32_t* indices(const size_t q) const { return idx.data() + q * nk; }
+
+	// Hamming distances of the neighbors of query q, ascending
+	uint16_t* distances(const size_t q) { return dist.data() + q * nk; }
+	const uint16_t* distances(const size_t q) const { return dist.data() + q * nk; }
+
+	int count(const size_t q) const { return found[q]; }
+	void setCount(const size_t q, const int n) { found[q] = static_cast<uint8_t>(n); }
+
+	int32_t index(const size_t q, const int i) const { return idx[q * nk + i]; }
+	uint16_t distance(const size_t q, const int i) const { return dist[q * nk + i]; }
+
+private:
+	size_t num;
+	int nk;
+	std::vector<int32_t> idx;
+	std::vector<uint16_t> dist;
+	std::vector<uint8_t> found;
+};
+
+class ImageMatchSet {
+public:
+	ImageMatchSet() : num(0), num_images(0) {}
+
+	void resize(const size_t queries, const size_t images) {
+		num = queries;
+		num_images = images;
+		best_i.resize(num * num_images);
+		best_d.resize(num * num_images);
+		second_d.resize(num * num_images);
+		starts.assign(num_images + 1, 0);
+		match_q.clear();
+		match_t.clear();
+	}
+
+	size_t size() const { return num; }
+	size_t images() const { return num_images; }
+
+	// top 2 of query q within image img
+	int32_t bestIndex(const size_t q, const size_t img) const { return best_i[q * num_images + img]; }
+	int bestDistance(const size_t q, const size_t img) const { return best_d[q * num_images + img]; }
+	int secondDistance(const size_t q, const size_t img) const { return second_d[q * num_images + img]; }
+
+	// matches passing the threshold within image img
+	size_t matches(const size_t img) const { return starts[img + 1] - starts[img]; }
+	const int32_t* matchQueries(const size_t img) const { return match_q.data() + starts[img]; }
+	const int32_t* matchTrain(const size_t img) const { return match_t.data() + starts[img]; }
+
+	// the columns, as filled by K2NNImages()
+	std::vector<int32_t> best_i;
+	std::vector<int32_t> best_d;
+	std::vector<int32_t> second_d;
+	std::vector<uint32_t> starts;
+	std::vector<int32_t> match_q;
+	std::vector<int32_t> match_t;
+
+private:
+	size_t num;
+	size_t num_images;
+};
+
+class RadiusMatchSet {
+public:
+	RadiusMatchSet() : starts(1, 0) {}
+
+	size_t size() const { return starts.size() - 1; }
+	bool empty() const { return starts.size() == 1; }
+	// results over all queries
+	size_t total() const { return starts.back(); }
+
+	size_t count(const size_t q) const { return starts[q + 1] - starts[q]; }
+	const int32_t* indices(const size_t q) const { return idx.data() + starts[q]; }
+	const uint16_t* distances(const size_t q) const { return dist.data() + starts[q]; }
+
+	// the columns, as filled by RadiusMatch()
+	std::vector<uint32_t> starts;
+	std::vector<int32_t> idx;
+	std::vector<uint16_t> dist;
+};
+
+}
+#endif /* KORAL_MATCHSET */
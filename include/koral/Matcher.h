@@ -9,8 +9,10 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include "koral/CUDAK2NN.h"
+#include "koral/DescriptorSet.h"
 #include "koral/Keypoint.h"
 #include <chrono>
+#include <stdexcept>
 
 namespace koral {
 #define cudaCalloc(A, B, STREAM) \
@@ -28,12 +30,7 @@ public:
 private:
 	unsigned int kpTrain, kpQuery;
 	const uint8_t matchThreshold;
-	struct Match {
-		int q, t;
-		Match() {}
-		Match(const int _q, const int _t) : q(_q), t(_t) {}
-	};
-
+	const uint16_t descBits;
 	struct cudaResourceDesc resDesc;
 	struct cudaTextureDesc texDesc;
 	cudaTextureObject_t tex_q = 0;
@@ -43,13 +40,19 @@ private:
 	int* h_matches;
 
 public:
-	FeatureMatcher(const uint _thresh, const uint _kpNum) : matchThreshold(_thresh), maxkpNum(_kpNum)
+	// _descBits is the length of the descriptors to be matched: 128, 256, 384, or 512
+	FeatureMatcher(const uint _thresh, const uint _kpNum, const uint16_t _descBits = 512) : matchThreshold(_thresh), descBits(_descBits), maxkpNum(_kpNum)
 	{
+		if (descBits != 128 && descBits != 256 && descBits != 384 && descBits != 512) {
+			throw std::invalid_argument("FeatureMatcher: descBits must be 128, 256, 384, or 512.");
+		}
+
 		if (cudaStreamCreate(&m_stream1) == cudaErrorInvalidValue || cudaStreamCreate(&m_stream2) == cudaErrorInvalidValue)
 			std::cerr << "Unable to create stream" << std::endl;
 		
-		cudaCalloc((void**) &d_descQ, 64 * maxkpNum, m_stream1);
-		cudaCalloc((void**) &d_descT, 64 * maxkpNum, m_stream2);
+		// room for the zeroed tail padding of a DescriptorSet, which CUDAK2NN reads past the end
+		cudaCalloc((void**) &d_descQ, (descBits >> 3) * (maxkpNum + DescriptorSet::padding), m_stream1);
+		cudaCalloc((void**) &d_descT, (descBits >> 3) * (maxkpNum + DescriptorSet::padding), m_stream2);
 
 		memset(&resDesc, 0, sizeof(resDesc));
 		memset(&texDesc, 0, sizeof(texDesc));
@@ -81,25 +84,27 @@ public:
 		cudaFree(d_matches);
 	}
 
-	// Allocate memory and transfer descriptors for training image
-	void setTrainingImage(std::vector<Keypoint> const &kps, std::vector<uint64_t> const &desc)
+	// Transfer descriptors for training image. The padding rows past the end,
+	// which CUDAK2NN reads ahead into, are zeroed on the device.
+	void setTrainingImage(std::vector<Keypoint> const &kps, DescriptorView const &desc)
 	{
-		kpTrain = kps.size();
-		cudaMemsetAsync(d_descT, 0, 64 * (kpTrain + 8), m_stream1);
-		cudaMemcpyAsync(d_descT, &desc[0], 64 * (kpTrain + 8), cudaMemcpyHostToDevice, m_stream1);
+		checkDescriptors(kps, desc);
+		kpTrain = desc.size();
+		cudaMemsetAsync(d_descT, 0, (descBits >> 3) * (kpTrain + DescriptorSet::padding), m_stream1);
+		cudaMemcpyAsync(d_descT, desc.data(), desc.bytes(), cudaMemcpyHostToDevice, m_stream1);
 		cudaStreamSynchronize(m_stream1);
 	}
 
-	// Allocate memory and transfer descriptors for query image
-	void setQueryImage(std::vector<Keypoint> const &kps, std::vector<uint64_t> const &desc)
+	// Transfer descriptors for query image
+	void setQueryImage(std::vector<Keypoint> const &kps, DescriptorView const &desc)
 	{
-		kpQuery = kps.size();
-		cudaMemsetAsync(d_descQ, 0, 64 * (kpQuery), m_stream2);
-		cudaMemcpyAsync(d_descQ, &desc[0], 64 * (kpQuery), cudaMemcpyHostToDevice, m_stream2);
+		checkDescriptors(kps, desc);
+		kpQuery = desc.size();
+		cudaMemcpyAsync(d_descQ, desc.data(), desc.bytes(), cudaMemcpyHostToDevice, m_stream2);
 		cudaStreamSynchronize(m_stream2);
 
 		resDesc.res.linear.devPtr = d_descQ;
-		resDesc.res.linear.sizeInBytes = 64 * kps.size();
+		resDesc.res.linear.sizeInBytes = desc.bytes();
 
 		cudaCreateTextureObject(&tex_q, &resDesc, &texDesc, nullptr);
 	}
@@ -110,22 +115,36 @@ public:
 		using namespace std::chrono;
 		cudaMemset(d_matches, 0, static_cast<int>(kpQuery));
 		auto start = high_resolution_clock::now();	
-		CUDAK2NN(d_descT, static_cast<int>(kpTrain), tex_q, static_cast<int>(kpQuery), d_matches, matchThreshold);
+		switch (descBits) {
+		case 128: CUDAK2NN<128>(d_descT, static_cast<int>(kpTrain), tex_q, static_cast<int>(kpQuery), d_matches, matchThreshold); break;
+		case 256: CUDAK2NN<256>(d_descT, static_cast<int>(kpTrain), tex_q, static_cast<int>(kpQuery), d_matches, matchThreshold); break;
+		case 384: CUDAK2NN<384>(d_descT, static_cast<int>(kpTrain), tex_q, static_cast<int>(kpQuery), d_matches, matchThreshold); break;
+		default:  CUDAK2NN<512>(d_descT, static_cast<int>(kpTrain), tex_q, static_cast<int>(kpQuery), d_matches, matchThreshold); break;
+		}
 		auto end = high_resolution_clock::now();
 
 		std::vector<int> h_matches(kpQuery);
 		cudaMemcpy(&h_matches[0], d_matches, 4 * kpQuery, cudaMemcpyDeviceToHost);
-		std::vector<Match> matches;
 		dmatches.clear();
 		for (size_t i = 0; i < kpQuery; ++i) {
 			if (h_matches[i] != -1) {
-				matches.emplace_back(i, h_matches[i]);
 				dmatches.emplace_back(h_matches[i], i, 0.0f);
 			}
 		}
 		
 		// auto sec = static_cast<double>(duration_cast<nanoseconds>(end - start).count()) * 1e-9 / static_cast<double>(1);
-		// std::cout << "Computed " << matches.size() << " matches in " << sec * 1e3 << " ms" << std::endl;		
+		// std::cout << "Computed " << dmatches.size() << " matches in " << sec * 1e3 << " ms" << std::endl;		
+	}
+
+private:
+	void checkDescriptors(std::vector<Keypoint> const &kps, DescriptorView const &desc) const
+	{
+		if (desc.bits() != descBits)
+			throw std::invalid_argument("FeatureMatcher: descriptors do not have the configured length.");
+		if (desc.size() != kps.size())
+			throw std::invalid_argument("FeatureMatcher: keypoint and descriptor counts differ.");
+		if (desc.size() > maxkpNum)
+			throw std::length_error("FeatureMatcher: more descriptors than maxkpNum.");
 	}
 };
 }
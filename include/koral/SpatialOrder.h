@@ -0,0 +1,60 @@
+/*******************************************************************
+*   SpatialOrder.h
+*   KORAL
+*******************************************************************/
+//
+// Optional reordering of keypoints into spatial (Morton) order.
+//
+// KFAST emits keypoints in row-band order per thread and per level,
+// so consecutive keypoints often lie far apart and description
+// touches scattered 72x64 patches. spatialOrder() sorts keypoints
+// by level, then by the Z-order (Morton) index of the
+// 2^tile_shift-pixel tile that holds them, and keeps their original
+// order within a tile. Neighboring keypoints then share most of their
+// patch rows, so a describer finds those rows already in cache.
+//
+// The sort is an LSD radix sort on 40-bit (level, Morton) keys,
+// 8 bits per pass. It skips passes where all keys share a digit, so
+// a single-level sort of a VGA frame takes 2 passes.
+//
+// spatialOrder() reorders in place and returns a permutation perm,
+// with sorted[i] == original[perm[i]]. restoreOrder() scatters
+// keypoints or descriptors computed in sorted order back to the
+// original order.
+//
+//      std::vector<uint32_t> perm;
+//      koral::spatialOrder(kps, perm);
+//      LATCH<true>(levels, kps.data(), kps.size(), desc);
+//      koral::restoreOrder(kps, perm);
+//      koral::restoreOrder(desc, perm);
+//
+
+#ifndef KORAL_SPATIALORDER
+#define KORAL_SPATIALORDER
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "DescriptorSet.h"
+#include "Keypoint.h"
+#include "KeypointSet.h"
+
+namespace koral {
+
+// sorted permutation of keypoints by (level, Morton index of (x >> tile_shift, y >> tile_shift))
+void spatialPermutation(const Keypoint* const kps, const size_t num_kps, std::vector<uint32_t>& perm, const int tile_shift = 5);
+void spatialPermutation(const KeypointSet& kps, std::vector<uint32_t>& perm, const int tile_shift = 5);
+
+// sorts in place, returning the permutation applied
+void spatialOrder(std::vector<Keypoint>& kps, std::vector<uint32_t>& perm, const int tile_shift = 5);
+void spatialOrder(KeypointSet& kps, std::vector<uint32_t>& perm, const int tile_shift = 5);
+
+// undo spatialOrder(): element i moves to position perm[i]
+void restoreOrder(std::vector<Keypoint>& kps, const std::vector<uint32_t>& perm);
+void restoreOrder(KeypointSet& kps, const std::vector<uint32_t>& perm);
+void restoreOrder(DescriptorSet& desc, const std::vector<uint32_t>& perm);
+
+}
+#endif /* KORAL_SPATIALORDER */
@@ -0,0 +1,72 @@
+/*******************************************************************
+*   StereoMatcher.h
+*   KORAL
+*******************************************************************/
+//
+// 2NN matching between the two images of a rectified stereo pair.
+// A left keypoint's match lies on nearly the same image row, to its
+// left by a disparity within a known range, so each left keypoint is
+// compared only against the right keypoints in that row band and
+// disparity window, instead of against the whole right image.
+//
+// The right keypoints are bucketed by level-0 row, one bucket per
+// pixel row (see KeypointSet::toLevel0()), and sorted by x within
+// each row, so the disparity window of a row is one contiguous run,
+// found by binary search. The descriptors are copied in the same
+// order.
+//
+// match() compares left keypoint (xl, yl) against the right
+// keypoints (xr, yr) with |yr - yl| <= row_tolerance and
+// min_disparity <= xl - xr <= max_disparity, in level-0 pixels, on
+// levels within level_window of the left keypoint's level (all
+// levels if level_window is negative), 4 at a time with hamming4()
+// (Hamming.h). The result follows CUDAK2NN among the candidates: the
+// best right index if the second-best distance is more than
+// threshold bits larger (threshold modulo 256), ties to the lower
+// index, a single candidate always matches, and none gives -1.
+//
+// With multithreading, the left keypoints are ordered by row and
+// split into row bands, one per hardware thread, so each thread
+// reads its own band of the right image.
+//
+
+#ifndef KORAL_STEREOMATCHER
+#define KORAL_STEREOMATCHER
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "DescriptorSet.h"
+#include "KeypointSet.h"
+
+namespace koral {
+class StereoMatcher {
+public:
+	// right_kps needs scales for all of its levels
+	StereoMatcher(const KeypointSet& right_kps, const DescriptorView& right);
+
+	size_t size() const { return ids.size(); }
+
+	template <const bool multithreading>
+	void match(const KeypointSet& left_kps, const DescriptorView& left, const float min_disparity, const float max_disparity, const float row_tolerance, int* const __restrict matches, const int threshold, const int level_window = 1) const;
+
+private:
+	float min_y;
+	int rows;
+	// start of row r in the row-ordered arrays
+	std::vector<uint32_t> starts;
+	std::vector<float> xs, ys;
+	std::vector<uint8_t> levels;
+	std::vector<uint32_t> ids;
+	DescriptorSet desc;
+
+	// distances from q to 4 descriptors, packed as 16-bit fields
+	uint64_t (*dist4)(const uint64_t* const q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3);
+
+	void matchRange(const KeypointSet& left_kps, const DescriptorView& left, const uint32_t* const order, const int start, const int end, const float* const lx, const float* const ly, const float min_disparity, const float max_disparity, const float row_tolerance, int* const matches, const int threshold, const int level_window) const;
+};
+
+}
+#endif /* KORAL_STEREOMATCHER */
@@ -0,0 +1,75 @@
+/*******************************************************************
+*   TrainingStore.h
+*   KORAL
+*******************************************************************/
+//
+// Incrementally updated set of training descriptors, for a local
+// map that gains and drops descriptors every frame.
+//
+// add() appends descriptors to the end of the slot array, which
+// grows geometrically (see DescriptorSet), and gives them stable ids,
+// consecutive in insertion order. remove() only marks a slot dead.
+// Both cost O(changed), not O(map size). compact() moves the live
+// descriptors to the front, keeping their order, and is run
+// automatically by remove() once dead slots outnumber live ones, so
+// at most half the slots are ever dead.
+//
+// The matchers run on the slot array directly: K2NN() and KNN()
+// (K2NN.h) take a TrainingStore, skip dead slots (checked only when
+// a distance beats the current best two or k, so almost never), and
+// return ids instead of slot indices.
+//
+
+#ifndef KORAL_TRAININGSTORE
+#define KORAL_TRAININGSTORE
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "DescriptorSet.h"
+
+namespace koral {
+class TrainingStore {
+public:
+	explicit TrainingStore(const uint16_t bits, const size_t capacity = 0);
+
+	uint16_t bits() const { return desc.bits(); }
+	// live descriptors
+	size_t size() const { return slot_of.size(); }
+	bool empty() const { return slot_of.empty(); }
+	// slots, live and dead
+	size_t slots() const { return desc.size(); }
+	size_t dead() const { return desc.size() - slot_of.size(); }
+
+	// returns the id of the first; the rest follow consecutively
+	uint32_t add(const DescriptorView& train);
+
+	// false if id is not live
+	bool remove(const uint32_t id);
+
+	void compact();
+
+	bool contains(const uint32_t id) const { return slot_of.count(id) != 0; }
+	// -1 if id is not live
+	int64_t slot(const uint32_t id) const;
+	uint32_t id(const size_t slot) const { return ids[slot]; }
+	bool alive(const size_t slot) const { return live[slot] != 0; }
+
+	// all slots; the descriptors of dead slots are stale
+	DescriptorView view() const { return desc.view(); }
+	const uint8_t* aliveMask() const { return live.data(); }
+	const uint32_t* slotIds() const { return ids.data(); }
+
+private:
+	DescriptorSet desc;
+	std::vector<uint32_t> ids;
+	std::vector<uint8_t> live;
+	std::unordered_map<uint32_t, uint32_t> slot_of;
+	uint32_t next_id;
+};
+
+}
+#endif /* KORAL_TRAININGSTORE */
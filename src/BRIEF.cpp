@@ -0,0 +1,213 @@
+/*******************************************************************
+*   BRIEF.cpp
+*   KORAL
+*******************************************************************/
+//
+// CPU rBRIEF binary descriptor.
+// See BRIEF.h for details.
+//
+
+#include "koral/BRIEF.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <immintrin.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// 7-tap Gaussian, sigma 2, in 8.8 fixed point (sums to 256)
+static const int16_t gauss[7] = { 18, 34, 49, 54, 49, 34, 18 };
+
+// brief_pattern rotated to the center angle of bin b, rounded to whole pixels
+static void rotatePattern(const int b, int8_t* const __restrict out) {
+	const float angle = 6.2831853f * static_cast<float>(b) / static_cast<float>(koral::BRIEFTables::bins);
+	const float s = std::sin(angle), c = std::cos(angle);
+	for (int32_t i = 0; i < 1024; i += 2) {
+		const float x = static_cast<float>(brief_pattern[i]), y = static_cast<float>(brief_pattern[i + 1]);
+		out[i] = static_cast<int8_t>(std::floor((x*c - y*s) + 0.5f));
+		out[i + 1] = static_cast<int8_t>(std::floor((x*s + y*c) + 0.5f));
+	}
+}
+
+koral::BRIEFTables::BRIEFTables(const ImageLevel* const levels, const int num_levels) : strides(num_levels), dxy(static_cast<size_t>(bins) << 10), offs((static_cast<size_t>(num_levels) * bins) << 9) {
+	for (int b = 0; b < bins; ++b) rotatePattern(b, &dxy[static_cast<size_t>(b) << 10]);
+	for (int l = 0; l < num_levels; ++l) {
+		strides[l] = levels[l].stride;
+		for (int b = 0; b < bins; ++b) {
+			const int8_t* d = deltas(b);
+			int32_t* o = &offs[(static_cast<size_t>(l) * bins + b) << 9];
+			for (int32_t n = 0; n < 256; ++n) {
+				o[n] = d[(n << 2) + 1] * strides[l] + d[n << 2];
+				o[n + 256] = d[(n << 2) + 3] * strides[l] + d[(n << 2) + 2];
+			}
+		}
+	}
+}
+
+int koral::BRIEFTables::bin(const float angle) {
+	const int b = static_cast<int>(std::floor(angle * (static_cast<float>(bins) / 6.2831853f) + 0.5f)) % bins;
+	return b < 0 ? b + bins : b;
+}
+
+// one output row of the horizontal pass, from a row padded by 3 pixels on each side
+static inline void smoothRow(const uint8_t* const __restrict pad, uint8_t* const __restrict out, const int32_t w) {
+	const __m256i rnd = _mm256_set1_epi16(128);
+	int32_t x = 0;
+	for (; x + 16 <= w; x += 16) {
+		__m256i sum = rnd;
+		for (int32_t k = 0; k < 7; ++k) {
+			sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pad + x + k))), _mm256_set1_epi16(gauss[k])));
+		}
+		const __m256i r = _mm256_srli_epi16(sum, 8);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(r, r), 0xD8)));
+	}
+	for (; x < w; ++x) {
+		uint32_t sum = 128;
+		for (int32_t k = 0; k < 7; ++k) sum += gauss[k] * pad[x + k];
+		out[x] = static_cast<uint8_t>(sum >> 8);
+	}
+}
+
+// one output row of the vertical pass, from 7 horizontally smoothed rows
+static inline void smoothCol(const uint8_t* const __restrict* const rows, uint8_t* const __restrict out, const int32_t w) {
+	const __m256i rnd = _mm256_set1_epi16(128);
+	int32_t x = 0;
+	for (; x + 16 <= w; x += 16) {
+		__m256i sum = rnd;
+		for (int32_t k = 0; k < 7; ++k) {
+			sum = _mm256_add_epi16(sum, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[k] + x))), _mm256_set1_epi16(gauss[k])));
+		}
+		const __m256i r = _mm256_srli_epi16(sum, 8);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi16(r, r), 0xD8)));
+	}
+	for (; x < w; ++x) {
+		uint32_t sum = 128;
+		for (int32_t k = 0; k < 7; ++k) sum += gauss[k] * rows[k][x];
+		out[x] = static_cast<uint8_t>(sum >> 8);
+	}
+}
+
+static void _BRIEFSmooth(const koral::ImageLevel& level, uint8_t* const __restrict out, const int32_t start_row, const int32_t end_row) {
+	const int32_t w = level.w, h = level.h;
+
+	// horizontally smoothed rows start_row - 3 to end_row + 2 (clamped), then the vertical pass
+	const int32_t first = std::max(start_row - 3, 0), last = std::min(end_row + 3, h);
+	std::vector<uint8_t> hbuf(static_cast<size_t>(last - first) * w);
+	std::vector<uint8_t> pad(w + 6);
+	for (int32_t y = first; y < last; ++y) {
+		const uint8_t* const row = level.img + y*level.stride;
+		memcpy(pad.data() + 3, row, w);
+		pad[0] = pad[1] = pad[2] = row[0];
+		pad[w + 3] = pad[w + 4] = pad[w + 5] = row[w - 1];
+		smoothRow(pad.data(), hbuf.data() + static_cast<size_t>(y - first) * w, w);
+	}
+
+	const uint8_t* rows[7];
+	for (int32_t y = start_row; y < end_row; ++y) {
+		for (int32_t k = 0; k < 7; ++k) rows[k] = hbuf.data() + static_cast<size_t>(std::min(std::max(y + k - 3, 0), h - 1) - first) * w;
+		smoothCol(rows, out + static_cast<size_t>(y) * w, w);
+	}
+}
+
+template <const bool multithreading>
+void BRIEFSmooth(const koral::ImageLevel& level, uint8_t* const __restrict out) {
+	const int32_t hw_concur = multithreading ? std::min(level.h >> 4, static_cast<int32_t>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		_BRIEFSmooth(level, out, 0, level.h);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int32_t start = 0;
+	for (int32_t i = 0; i < hw_concur; ++i) {
+		const int32_t end = start + (level.h - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, _BRIEFSmooth, std::cref(level), out, start, end);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+static void _BRIEF(const koral::ImageLevel* const __restrict smoothed, const koral::Keypoint* const __restrict kps, const int start, const int end, uint64_t* const __restrict desc, const koral::BRIEFTables& tables) {
+	const __m256i lo = _mm256_set1_epi32(0xFF);
+	for (int i = start; i < end; ++i) {
+		const koral::Keypoint& kp = kps[i];
+		const koral::ImageLevel& level = smoothed[kp.scale];
+		const int b = koral::BRIEFTables::bin(kp.angle);
+		uint8_t* const d = reinterpret_cast<uint8_t*>(desc + (static_cast<size_t>(i) << 2));
+
+		// the rotated pattern reaches 15 pixels from the keypoint, and the gathers read 4 bytes per point
+		if (kp.x >= 15 && kp.y >= 15 && kp.x + 18 < level.w && kp.y + 15 < level.h && kp.scale < tables.levels() && tables.stride(kp.scale) == level.stride) {
+			const int32_t* __restrict const o = tables.offsets(kp.scale, b);
+			const int* const base = reinterpret_cast<const int*>(level.img + kp.y*level.stride + kp.x);
+			for (int32_t g = 0; g < 32; ++g) {
+				const __m256i p1 = _mm256_and_si256(_mm256_i32gather_epi32(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(o + (g << 3))), 1), lo);
+				const __m256i p2 = _mm256_and_si256(_mm256_i32gather_epi32(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(o + 256 + (g << 3))), 1), lo);
+				// bit is SET if p1 < p2
+				d[g] = static_cast<uint8_t>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(p2, p1))));
+			}
+		}
+		else {
+			const int8_t* __restrict const p = tables.deltas(b);
+			const int32_t xmax = level.w - 1, ymax = level.h - 1;
+			memset(d, 0, 32);
+			for (int32_t n = 0; n < 256; ++n) {
+				const int8_t* const q = p + (n << 2);
+				const uint8_t v1 = level.img[std::min(std::max(kp.y + q[1], 0), ymax)*level.stride + std::min(std::max(kp.x + q[0], 0), xmax)];
+				const uint8_t v2 = level.img[std::min(std::max(kp.y + q[3], 0), ymax)*level.stride + std::min(std::max(kp.x + q[2], 0), xmax)];
+				d[n >> 3] |= static_cast<uint8_t>(v1 < v2) << (n & 7);
+			}
+		}
+	}
+}
+
+template <const bool multithreading>
+void BRIEF(const koral::ImageLevel* const __restrict smoothed, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::BRIEFTables& tables) {
+	const int hw_concur = multithreading ? std::min(num_kps >> 6, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		_BRIEF(smoothed, kps, 0, num_kps, desc, tables);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (num_kps - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, _BRIEF, smoothed, kps, start, end, desc, std::cref(tables));
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+template <const bool multithreading>
+void BRIEF(const koral::ImageLevel* const __restrict smoothed, const koral::Keypoint* const __restrict kps, const int num_kps, koral::DescriptorSet& desc, const koral::BRIEFTables& tables) {
+	if (desc.bits() != 256) throw std::invalid_argument("BRIEF: descriptors are 256 bits.");
+	desc.resize(num_kps);
+	BRIEF<multithreading>(smoothed, kps, num_kps, desc.data(), tables);
+}
+
+void BRIEFReference(const koral::ImageLevel* const __restrict smoothed, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc) {
+	std::vector<int8_t> p(1024);
+	for (int i = 0; i < num_kps; ++i) {
+		const koral::Keypoint& kp = kps[i];
+		const koral::ImageLevel& level = smoothed[kp.scale];
+		rotatePattern(koral::BRIEFTables::bin(kp.angle), p.data());
+		uint64_t* const d = desc + (static_cast<size_t>(i) << 2);
+		memset(d, 0, 32);
+		for (int32_t n = 0; n < 256; ++n) {
+			const int32_t x1 = std::min(std::max(kp.x + p[n * 4], 0), level.w - 1), y1 = std::min(std::max(kp.y + p[n * 4 + 1], 0), level.h - 1);
+			const int32_t x2 = std::min(std::max(kp.x + p[n * 4 + 2], 0), level.w - 1), y2 = std::min(std::max(kp.y + p[n * 4 + 3], 0), level.h - 1);
+			d[n >> 6] |= static_cast<uint64_t>(level.img[y1*level.stride + x1] < level.img[y2*level.stride + x2]) << (n & 63);
+		}
+	}
+}
+
+template void BRIEFSmooth<true>(const koral::ImageLevel& level, uint8_t* const __restrict out);
+template void BRIEFSmooth<false>(const koral::ImageLevel& level, uint8_t* const __restrict out);
+template void BRIEF<true>(const koral::ImageLevel* const __restrict smoothed, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::BRIEFTables& tables);
+template void BRIEF<false>(const koral::ImageLevel* const __restrict smoothed, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::BRIEFTables& tables);
+template void BRIEF<true>(const koral::ImageLevel* const __restrict smoothed, const koral::Keypoint* const __restrict kps, const int num_kps, koral::DescriptorSet& desc, const koral::BRIEFTables& tables);
+template void BRIEF<false>(const koral::ImageLevel* const __restrict smoothed, const koral::Keypoint* const __restrict kps, const int num_kps, koral::DescriptorSet& desc, const koral::BRIEFTables& tables);
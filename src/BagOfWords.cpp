@@ -0,0 +1,470 @@
+/*******************************************************************
+*   BagOfWords.cpp
+*   KORAL
+*******************************************************************/
+//
+// Bag of binary words vocabulary and inverted file database.
+// See BagOfWords.h for details.
+//
+
+#include "koral/BagOfWords.h"
+
+#include "koral/Hamming.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <immintrin.h>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// k-majority stops after this many center updates even if assignments still change
+static constexpr int max_iterations = 10;
+
+typedef uint64_t (*Dist4)(const uint64_t* const q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3);
+
+template <const int bits>
+static uint64_t dist4(const uint64_t* const q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3) {
+	__m256i qv[koral::HammingChunks<bits>::total];
+	koral::hammingLoad<bits>(q, qv);
+	return static_cast<uint64_t>(_mm_cvtsi128_si64(koral::hamming4<bits>(qv, t0, t1, t2, t3)));
+}
+
+// index of the nearest of k centers, ties to the first
+static inline uint32_t nearest(const Dist4 d4, const uint64_t* const q, const uint64_t* const* const c, const uint32_t k, const int words) {
+	int best = 100000;
+	uint32_t best_c = 0, i = 0;
+	for (; i + 4 <= k; i += 4) {
+		const uint64_t d = d4(q, c[i], c[i + 1], c[i + 2], c[i + 3]);
+		for (uint32_t j = 0; j < 4; ++j) {
+			const int v = static_cast<int>((d >> (j << 4)) & 0xFFFF);
+			if (v < best) {
+				best = v;
+				best_c = i + j;
+			}
+		}
+	}
+	for (; i < k; ++i) {
+		const int v = koral::hamming(q, c[i], words);
+		if (v < best) {
+			best = v;
+			best_c = i;
+		}
+	}
+	return best_c;
+}
+
+// per-bit majority of count descriptors into center. Bits are counted in 8-bit lanes,
+// one 128-bit register per bit of each byte, flushed to sums every 255 descriptors.
+static void majority(const koral::DescriptorView& train, const uint32_t* const ids, const uint32_t count, uint64_t* const center, std::vector<uint32_t>& sums) {
+	const int chunks = static_cast<int>(train.words() >> 1);
+	const __m128i one = _mm_set1_epi8(1);
+	sums.assign(train.bits(), 0);
+	__m128i acc[4][8];
+	alignas(16) uint8_t lanes[16];
+	for (uint32_t i = 0; i < count;) {
+		const uint32_t batch_end = std::min(count, i + 255);
+		for (int c = 0; c < chunks; ++c) for (int s = 0; s < 8; ++s) acc[c][s] = _mm_setzero_si128();
+		for (; i < batch_end; ++i) {
+			const uint64_t* const p = train[ids[i]];
+			for (int c = 0; c < chunks; ++c) {
+				const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + (c << 1)));
+				for (int s = 0; s < 8; ++s) acc[c][s] = _mm_add_epi8(acc[c][s], _mm_and_si128(_mm_srli_epi16(v, s), one));
+			}
+		}
+		for (int c = 0; c < chunks; ++c) {
+			for (int s = 0; s < 8; ++s) {
+				_mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc[c][s]);
+				for (int b = 0; b < 16; ++b) sums[(c << 7) + (b << 3) + s] += lanes[b];
+			}
+		}
+	}
+	memset(center, 0, train.words() * sizeof(uint64_t));
+	for (size_t b = 0; b < sums.size(); ++b) {
+		if ((sums[b] << 1) > count) center[b >> 6] |= 1ULL << (b & 63);
+	}
+}
+
+// Splits ids[0, count) into at most k clusters by k-majority, reordering them by cluster.
+// Returns the centers and sizes of the non-empty clusters.
+static void cluster(const koral::DescriptorView& train, const Dist4 d4, uint32_t* const ids, const uint32_t count, const int k, const uint64_t seed, const bool multithreading, std::vector<uint64_t>& centers, std::vector<uint32_t>& sizes) {
+	const int words = static_cast<int>(train.words());
+	std::mt19937_64 rng(seed);
+
+	// k-means++ seeding on a sample: each further center is drawn with probability
+	// proportional to its squared distance from the nearest center so far
+	const uint32_t sample_n = std::min(count, static_cast<uint32_t>(k) << 6);
+	std::vector<uint32_t> sample(sample_n);
+	for (uint32_t i = 0; i < sample_n; ++i) sample[i] = sample_n == count ? ids[i] : ids[rng() % count];
+	std::vector<uint32_t> seeds(1, sample[rng() % sample_n]);
+	std::vector<int> dist(sample_n);
+	for (uint32_t i = 0; i < sample_n; ++i) dist[i] = koral::hamming(train[sample[i]], train[seeds[0]], words);
+	while (static_cast<int>(seeds.size()) < k) {
+		uint64_t total = 0;
+		for (uint32_t i = 0; i < sample_n; ++i) total += static_cast<uint64_t>(dist[i]) * dist[i];
+		if (total == 0) break;
+		uint64_t pick = std::uniform_int_distribution<uint64_t>(0, total - 1)(rng);
+		uint32_t c = 0;
+		for (;; ++c) {
+			const uint64_t w = static_cast<uint64_t>(dist[c]) * dist[c];
+			if (pick < w) break;
+			pick -= w;
+		}
+		seeds.push_back(sample[c]);
+		for (uint32_t i = 0; i < sample_n; ++i) dist[i] = std::min(dist[i], koral::hamming(train[sample[i]], train[sample[c]], words));
+	}
+	const uint32_t m = static_cast<uint32_t>(seeds.size());
+
+	koral::DescriptorSet cs(train.bits(), m);
+	for (uint32_t c = 0; c < m; ++c) memcpy(cs[c], train[seeds[c]], words * sizeof(uint64_t));
+	std::vector<const uint64_t*> cp(m);
+	for (uint32_t c = 0; c < m; ++c) cp[c] = cs[c];
+
+	std::vector<uint32_t> assigned(count, m), tmp_ids(count), tmp_assigned(count), counts(m), offsets(m + 1), sums;
+	auto assign = [&](const uint32_t start, const uint32_t end) {
+		uint32_t changed = 0;
+		for (uint32_t i = start; i < end; ++i) {
+			const uint32_t c = nearest(d4, train[ids[i]], cp.data(), m, words);
+			changed += c != assigned[i];
+			assigned[i] = c;
+		}
+		return changed;
+	};
+
+	const int hw_concur = multithreading ? std::min(static_cast<int>(count >> 12), static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	for (int iter = 0;; ++iter) {
+		uint32_t changed = 0;
+		if (hw_concur <= 1) {
+			changed = assign(0, count);
+		}
+		else {
+			std::vector<std::future<uint32_t>> fut(hw_concur);
+			uint32_t start = 0;
+			for (int i = 0; i < hw_concur; ++i) {
+				const uint32_t end = start + (count - start) / (hw_concur - i);
+				fut[i] = std::async(std::launch::async, assign, start, end);
+				start = end;
+			}
+			for (auto& f : fut) changed += f.get();
+		}
+
+		// stable partition by cluster
+		counts.assign(m, 0);
+		for (uint32_t i = 0; i < count; ++i) ++counts[assigned[i]];
+		offsets[0] = 0;
+		for (uint32_t c = 0; c < m; ++c) offsets[c + 1] = offsets[c] + counts[c];
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (uint32_t i = 0; i < count; ++i) {
+			const uint32_t j = fill[assigned[i]]++;
+			tmp_ids[j] = ids[i];
+			tmp_assigned[j] = assigned[i];
+		}
+		std::copy(tmp_ids.begin(), tmp_ids.end(), ids);
+		assigned.swap(tmp_assigned);
+
+		if ((iter && !changed) || iter == max_iterations) break;
+		for (uint32_t c = 0; c < m; ++c) {
+			if (counts[c]) majority(train, ids + offsets[c], counts[c], cs[c], sums);
+		}
+	}
+
+	centers.clear();
+	sizes.clear();
+	for (uint32_t c = 0; c < m; ++c) {
+		if (!counts[c]) continue;
+		centers.insert(centers.end(), cs[c], cs[c] + words);
+		sizes.push_back(counts[c]);
+	}
+}
+
+koral::Vocabulary::Vocabulary(const DescriptorView& train, const std::vector<uint32_t>& images, const int branching, const int depth, const uint64_t seed) :
+	k(branching), levels(depth), centers(train.bits()) {
+	if (branching < 2 || depth < 1) throw std::invalid_argument("Vocabulary: need branching of at least 2 and depth of at least 1.");
+	if (train.empty()) throw std::invalid_argument("Vocabulary: no training descriptors.");
+	uint64_t total = 0;
+	for (const uint32_t n : images) total += n;
+	if (!images.empty() && total != train.size()) throw std::invalid_argument("Vocabulary: image sizes do not add up to the training descriptors.");
+	setKernel();
+
+	const uint32_t n = static_cast<uint32_t>(train.size());
+	std::vector<uint32_t> order(n);
+	for (uint32_t i = 0; i < n; ++i) order[i] = i;
+	nodes.assign(1, Node{ 0, 0, 0 });
+	centers.resize(1);
+
+	// nodes to split at the current level, with their ranges of order
+	struct Pending {
+		uint32_t node;
+		uint32_t begin;
+		uint32_t end;
+	};
+	struct Split {
+		std::vector<uint64_t> centers;
+		std::vector<uint32_t> sizes;
+	};
+	std::vector<Pending> pending(1, Pending{ 0, 0, n }), next;
+	const int hw = static_cast<int>(std::thread::hardware_concurrency());
+	for (int level = 0; level < depth && !pending.empty(); ++level) {
+		const int num_p = static_cast<int>(pending.size());
+		std::vector<Split> splits(num_p);
+		// few nodes: split each node's assignment across threads; many: split the nodes
+		const bool inner = num_p < hw;
+		auto splitRange = [&](const int start, const int end) {
+			for (int i = start; i < end; ++i) {
+				const Pending& p = pending[i];
+				if (p.end - p.begin <= static_cast<uint32_t>(k)) continue;
+				cluster(train, dist4, &order[p.begin], p.end - p.begin, k, seed + 0x9E3779B97F4A7C15ULL * (p.node + 1), inner, splits[i].centers, splits[i].sizes);
+			}
+		};
+		const int hw_concur = inner ? 1 : std::min(num_p, hw);
+		if (hw_concur <= 1) {
+			splitRange(0, num_p);
+		}
+		else {
+			std::vector<std::future<void>> fut(hw_concur);
+			int start = 0;
+			for (int i = 0; i < hw_concur; ++i) {
+				const int end = start + (num_p - start) / (hw_concur - i);
+				fut[i] = std::async(std::launch::async, splitRange, start, end);
+				start = end;
+			}
+			for (auto& f : fut) f.wait();
+		}
+
+		next.clear();
+		for (int i = 0; i < num_p; ++i) {
+			const Split& s = splits[i];
+			// a node of identical descriptors stays a word
+			if (s.sizes.size() < 2) continue;
+			const uint32_t first = static_cast<uint32_t>(nodes.size()), m = static_cast<uint32_t>(s.sizes.size());
+			nodes[pending[i].node].first_child = first;
+			nodes[pending[i].node].num_children = m;
+			centers.resize(first + m);
+			memcpy(centers[first], s.centers.data(), s.centers.size() * sizeof(uint64_t));
+			uint32_t begin = pending[i].begin;
+			for (uint32_t c = 0; c < m; ++c) {
+				nodes.push_back(Node{ 0, 0, 0 });
+				next.push_back(Pending{ first + c, begin, begin + s.sizes[c] });
+				begin += s.sizes[c];
+			}
+		}
+		pending.swap(next);
+	}
+
+	uint32_t num_words = 0;
+	for (auto& nd : nodes) {
+		if (!nd.num_children) nd.word = num_words++;
+	}
+
+	// inverse document frequencies over the training images
+	weights.assign(num_words, 1.0f);
+	if (images.empty()) return;
+	std::vector<uint32_t> w(n), df(num_words, 0), last(num_words, UINT32_MAX);
+	quantize<true>(train, w.data());
+	uint32_t d = 0;
+	for (uint32_t img = 0; img < images.size(); ++img) {
+		for (uint32_t e = d + images[img]; d < e; ++d) {
+			if (last[w[d]] != img) {
+				last[w[d]] = img;
+				++df[w[d]];
+			}
+		}
+	}
+	const double num_images = static_cast<double>(images.size());
+	for (uint32_t i = 0; i < num_words; ++i) weights[i] = df[i] ? static_cast<float>(std::log(num_images / df[i])) : 0.0f;
+}
+
+void koral::Vocabulary::setKernel() {
+	switch (centers.bits()) {
+	case 128: dist4 = ::dist4<128>; break;
+	case 256: dist4 = ::dist4<256>; break;
+	case 384: dist4 = ::dist4<384>; break;
+	default:  dist4 = ::dist4<512>; break;
+	}
+}
+
+void koral::Vocabulary::quantizeRange(const DescriptorView& desc, const int start, const int end, uint32_t* const words) const {
+	const int w = static_cast<int>(desc.words());
+	const uint64_t* c[4];
+	for (int i = start; i < end; ++i) {
+		const uint64_t* const q = desc[i];
+		uint32_t node = 0;
+		while (nodes[node].num_children) {
+			const uint32_t first = nodes[node].first_child, m = nodes[node].num_children;
+			int best = 100000;
+			uint32_t best_c = 0, j = 0;
+			for (; j + 4 <= m; j += 4) {
+				for (int t = 0; t < 4; ++t) c[t] = centers[first + j + t];
+				const uint64_t d = dist4(q, c[0], c[1], c[2], c[3]);
+				for (uint32_t t = 0; t < 4; ++t) {
+					const int v = static_cast<int>((d >> (t << 4)) & 0xFFFF);
+					if (v < best) {
+						best = v;
+						best_c = j + t;
+					}
+				}
+			}
+			for (; j < m; ++j) {
+				const int v = hamming(q, centers[first + j], w);
+				if (v < best) {
+					best = v;
+					best_c = j;
+				}
+			}
+			node = first + best_c;
+		}
+		words[i] = nodes[node].word;
+	}
+}
+
+template <const bool multithreading>
+void koral::Vocabulary::quantize(const DescriptorView& desc, uint32_t* const __restrict words) const {
+	if (desc.bits() != centers.bits()) throw std::invalid_argument("Vocabulary: descriptors differ in length from the vocabulary.");
+	const int num = static_cast<int>(desc.size());
+	const int hw_concur = multithreading ? std::min(num >> 8, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		quantizeRange(desc, 0, num, words);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (num - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, &Vocabulary::quantizeRange, this, std::cref(desc), start, end, words);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+template <const bool multithreading>
+void koral::Vocabulary::transform(const DescriptorView& desc, BowVector& bow, uint32_t* const __restrict words) const {
+	std::vector<uint32_t> local;
+	uint32_t* w = words;
+	if (!w) {
+		local.resize(desc.size());
+		w = local.data();
+	}
+	quantize<multithreading>(desc, w);
+
+	std::vector<uint32_t> sorted(w, w + desc.size());
+	std::sort(sorted.begin(), sorted.end());
+	bow.clear();
+	float total = 0.0f;
+	for (size_t i = 0; i < sorted.size();) {
+		size_t j = i + 1;
+		while (j < sorted.size() && sorted[j] == sorted[i]) ++j;
+		const float v = static_cast<float>(j - i) * weights[sorted[i]];
+		if (v > 0.0f) {
+			bow.emplace_back(sorted[i], v);
+			total += v;
+		}
+		i = j;
+	}
+	for (auto& e : bow) e.second /= total;
+}
+
+void koral::Vocabulary::write(std::ostream& out) const {
+	const uint32_t magic = 0x434F564B; // "KVOC"
+	const int32_t header[2] = { k, levels };
+	const uint64_t counts[2] = { nodes.size(), weights.size() };
+	out.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+	out.write(reinterpret_cast<const char*>(header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(counts), sizeof(counts));
+	out.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(Node));
+	out.write(reinterpret_cast<const char*>(weights.data()), weights.size() * sizeof(float));
+	centers.write(out);
+}
+
+koral::Vocabulary koral::Vocabulary::read(std::istream& in) {
+	uint32_t magic = 0;
+	int32_t header[2] = { 0, 0 };
+	uint64_t counts[2] = { 0, 0 };
+	in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	in.read(reinterpret_cast<char*>(header), sizeof(header));
+	in.read(reinterpret_cast<char*>(counts), sizeof(counts));
+	if (!in || magic != 0x434F564B) throw std::runtime_error("Vocabulary: stream does not contain a vocabulary.");
+	Vocabulary voc;
+	voc.k = header[0];
+	voc.levels = header[1];
+	voc.nodes.resize(static_cast<size_t>(counts[0]));
+	voc.weights.resize(static_cast<size_t>(counts[1]));
+	in.read(reinterpret_cast<char*>(voc.nodes.data()), voc.nodes.size() * sizeof(Node));
+	in.read(reinterpret_cast<char*>(voc.weights.data()), voc.weights.size() * sizeof(float));
+	if (!in) throw std::runtime_error("Vocabulary: truncated vocabulary.");
+	voc.centers = DescriptorSet::read(in);
+	if (voc.centers.size() != voc.nodes.size()) throw std::runtime_error("Vocabulary: centers do not match the nodes.");
+	voc.setKernel();
+	return voc;
+}
+
+uint32_t koral::BowDatabase::add(const BowVector& bow) {
+	for (const auto& e : bow) {
+		if (e.first >= postings.size()) throw std::invalid_argument("BowDatabase: word is not in the vocabulary.");
+	}
+	for (const auto& e : bow) postings[e.first].emplace_back(num, e.second);
+	return num++;
+}
+
+void koral::BowDatabase::scoreRange(const BowVector& bow, const uint32_t first, const uint32_t last, float* const scores) const {
+	auto before = [](const std::pair<uint32_t, float>& p, const uint32_t img) { return p.first < img; };
+	for (const auto& e : bow) {
+		if (e.first >= postings.size()) continue;
+		const auto& list = postings[e.first];
+		auto it = first ? std::lower_bound(list.begin(), list.end(), first, before) : list.begin();
+		const float v = e.second;
+		for (; it != list.end() && it->first < last; ++it) scores[it->first] += std::min(v, it->second);
+	}
+}
+
+template <const bool multithreading>
+void koral::BowDatabase::query(const BowVector& bow, const int k, std::vector<std::pair<uint32_t, float>>& results) const {
+	std::vector<float> scores(num, 0.0f);
+	const int hw_concur = multithreading ? std::min(static_cast<int>(num >> 14), static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		scoreRange(bow, 0, num, scores.data());
+	}
+	else {
+		// postings are ascending by image, so each thread scores its own range of images
+		std::vector<std::future<void>> fut(hw_concur);
+		uint32_t start = 0;
+		for (int i = 0; i < hw_concur; ++i) {
+			const uint32_t end = start + (num - start) / (hw_concur - i);
+			fut[i] = std::async(std::launch::async, &BowDatabase::scoreRange, this, std::cref(bow), start, end, scores.data());
+			start = end;
+		}
+		for (auto& f : fut) f.wait();
+	}
+
+	// keep the top k in a heap whose front is the worst of them
+	auto better = [](const std::pair<uint32_t, float>& a, const std::pair<uint32_t, float>& b) {
+		return a.second > b.second || (a.second == b.second && a.first < b.first);
+	};
+	results.clear();
+	if (k <= 0) return;
+	for (uint32_t img = 0; img < num; ++img) {
+		if (scores[img] <= 0.0f) continue;
+		if (results.size() < static_cast<size_t>(k)) {
+			results.emplace_back(img, scores[img]);
+			std::push_heap(results.begin(), results.end(), better);
+		}
+		else if (scores[img] > results.front().second) {
+			std::pop_heap(results.begin(), results.end(), better);
+			results.back() = std::make_pair(img, scores[img]);
+			std::push_heap(results.begin(), results.end(), better);
+		}
+	}
+	std::sort_heap(results.begin(), results.end(), better);
+}
+
+template void koral::Vocabulary::quantize<true>(const DescriptorView& desc, uint32_t* const __restrict words) const;
+template void koral::Vocabulary::quantize<false>(const DescriptorView& desc, uint32_t* const __restrict words) const;
+template void koral::Vocabulary::transform<true>(const DescriptorView& desc, BowVector& bow, uint32_t* const __restrict words) const;
+template void koral::Vocabulary::transform<false>(const DescriptorView& desc, BowVector& bow, uint32_t* const __restrict words) const;
+template void koral::BowDatabase::query<true>(const BowVector& bow, const int k, std::vector<std::pair<uint32_t, float>>& results) const;
+template void koral::BowDatabase::query<false>(const BowVector& bow, const int k, std::vector<std::pair<uint32_t, float>>& results) const;
@@ -0,0 +1,45 @@
+/*******************************************************************
+*   BitOrder.cpp
+*   KORAL
+*******************************************************************/
+//
+// Variance-ordered descriptor bit permutation.
+// See BitOrder.h for details.
+//
+
+#include "koral/BitOrder.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+koral::BitOrder::BitOrder(const DescriptorView& sample) : order(sample.bits()) {
+	const int bits = sample.bits();
+	std::vector<size_t> ones(bits);
+	for (size_t i = 0; i < sample.size(); ++i) {
+		const uint64_t* const d = sample[i];
+		for (int b = 0; b < bits; ++b) ones[b] += (d[b >> 6] >> (b & 63)) & 1;
+	}
+	// p(1 - p) * n^2 = ones * (n - ones), exact in integers
+	const size_t n = sample.size();
+	for (int b = 0; b < bits; ++b) order[b] = static_cast<uint16_t>(b);
+	std::stable_sort(order.begin(), order.end(), [&](const uint16_t a, const uint16_t b) { return ones[a] * (n - ones[a]) > ones[b] * (n - ones[b]); });
+}
+
+void koral::BitOrder::apply(const DescriptorView& in, DescriptorSet& out) const {
+	if (in.bits() != bits()) throw std::invalid_argument("BitOrder: descriptors differ in length from the order.");
+	if (out.bits() != bits()) out = DescriptorSet(bits());
+	out.resize(in.size());
+	const int words = static_cast<int>(in.words());
+	for (size_t i = 0; i < in.size(); ++i) {
+		const uint64_t* const s = in[i];
+		uint64_t* const d = out[i];
+		memset(d, 0, words * sizeof(uint64_t));
+		for (int b = 0; b < bits(); ++b) {
+			const int from = order[b];
+			d[b >> 6] |= ((s[from >> 6] >> (from & 63)) & 1) << (b & 63);
+		}
+	}
+}
@@ -0,0 +1,69 @@
+/*******************************************************************
+*   BitSliced.cpp
+*   KORAL
+*******************************************************************/
+//
+// Transposed (bit-sliced) descriptor layout.
+// See BitSliced.h for details.
+//
+
+#include "koral/BitSliced.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#include <vector>
+
+koral::BitSlicedSet::BitSlicedSet(const DescriptorView& desc) : num(desc.size()), nbits(desc.bits()), planes((blocks() * desc.bits()) << 2) {
+	const int bytes = nbits >> 3;
+	// byte j of descriptor i of a block, at [j * block + i]
+	std::vector<uint8_t> cols(static_cast<size_t>(bytes) * block);
+	uint32_t* const out = reinterpret_cast<uint32_t*>(planes.data());
+	for (size_t k = 0; k < blocks(); ++k) {
+		const int n = static_cast<int>(std::min(static_cast<size_t>(block), num - k * block));
+		std::fill(cols.begin(), cols.end(), 0);
+		for (int i = 0; i < n; ++i) {
+			const uint8_t* const d = reinterpret_cast<const uint8_t*>(desc[k * block + i]);
+			for (int j = 0; j < bytes; ++j) cols[j * block + i] = d[j];
+		}
+		// 32 descriptors x 8 bits per movemask, each into one 32-bit word of a plane
+		for (int j = 0; j < bytes; ++j) {
+			for (int g = 0; g < block / 32; ++g) {
+				const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&cols[j * block + (g << 5)]));
+				for (int b = 0; b < 8; ++b) {
+					out[((k * nbits + (j << 3) + b) << 3) + g] = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_slli_epi16(v, 7 - b)));
+				}
+			}
+		}
+	}
+}
+
+void koral::BitSlicedSet::toDescriptors(DescriptorSet& out) const {
+	if (out.bits() != nbits) out = DescriptorSet(nbits);
+	out.resize(num);
+	const int bytes = nbits >> 3;
+	std::vector<uint8_t> cols(static_cast<size_t>(bytes) * block);
+	const uint32_t* const in = reinterpret_cast<const uint32_t*>(planes.data());
+	// expands 32 mask bits to 32 bytes, 0xFF where set
+	const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+	const __m256i select = _mm256_set1_epi64x(static_cast<int64_t>(0x8040201008040201ULL));
+	for (size_t k = 0; k < blocks(); ++k) {
+		for (int j = 0; j < bytes; ++j) {
+			for (int g = 0; g < block / 32; ++g) {
+				__m256i v = _mm256_setzero_si256();
+				for (int b = 0; b < 8; ++b) {
+					const __m256i m = _mm256_shuffle_epi8(_mm256_set1_epi32(static_cast<int>(in[((k * nbits + (j << 3) + b) << 3) + g])), spread);
+					const __m256i set = _mm256_cmpeq_epi8(_mm256_and_si256(m, select), select);
+					v = _mm256_or_si256(v, _mm256_and_si256(set, _mm256_set1_epi8(static_cast<char>(1 << b))));
+				}
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(&cols[j * block + (g << 5)]), v);
+			}
+		}
+		const int n = static_cast<int>(std::min(static_cast<size_t>(block), num - k * block));
+		for (int i = 0; i < n; ++i) {
+			uint8_t* const d = reinterpret_cast<uint8_t*>(out[k * block + i]);
+			for (int j = 0; j < bytes; ++j) d[j] = cols[j * block + i];
+		}
+	}
+}
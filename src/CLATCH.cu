@@ -151,6 +151,11 @@
 #include "koral/CLATCH.h"
 
 
+// words is the number of 32-bit descriptor words computed per keypoint,
+// one warp (blockDim.y row) per word. Fewer words than the full 16 compute only
+// the first 32 * words triplets, which are the most discriminative ones,
+// and pack them into 4 * words bytes per keypoint.
+template <const int32_t words, const bool upright>
 __global__ void
 #ifndef __INTELLISENSE__
 __launch_bounds__(512, 4)
@@ -160,12 +165,22 @@ CLATCH_kernel(const cudaTextureObject_t d_all_tex[8], const cudaTextureObject_t
 	volatile __shared__ uint8_t s_ROI[4608];
 	const koral::Keypoint pt = d_kps[blockIdx.x];
 	const cudaTextureObject_t d_img_tex = d_all_tex[pt.scale];
-	const float s = sin(pt.angle), c = cos(pt.angle);
-	for (int32_t i = 0; i <= 48; i += 16) {
-		for (int32_t k = 0; k <= 32; k += 32) {
-			const float x_offset = static_cast<float>(static_cast<int>(threadIdx.x) + k - 32);
-			const float y_offset = static_cast<float>(static_cast<int>(threadIdx.y) + i - 32);
-			s_ROI[(threadIdx.y + i) * 72 + threadIdx.x + k] = tex2D<uint8_t>(d_img_tex, static_cast<int>((pt.x + (x_offset*c - y_offset*s)) + 0.5f), static_cast<int>((pt.y + (x_offset*s + y_offset*c)) + 0.5f));
+	if (upright) {
+		// each warp reads straight runs of 32 pixels along a row
+		for (int32_t i = threadIdx.y; i < 64; i += words) {
+			for (int32_t k = 0; k <= 32; k += 32) {
+				s_ROI[i * 72 + threadIdx.x + k] = tex2D<uint8_t>(d_img_tex, pt.x + static_cast<int>(threadIdx.x) + k - 32, pt.y + i - 32);
+			}
+		}
+	}
+	else {
+		const float s = sin(pt.angle), c = cos(pt.angle);
+		for (int32_t i = threadIdx.y; i < 64; i += words) {
+			for (int32_t k = 0; k <= 32; k += 32) {
+				const float x_offset = static_cast<float>(static_cast<int>(threadIdx.x) + k - 32);
+				const float y_offset = static_cast<float>(i - 32);
+				s_ROI[i * 72 + threadIdx.x + k] = tex2D<uint8_t>(d_img_tex, static_cast<int>((pt.x + (x_offset*c - y_offset*s)) + 0.5f), static_cast<int>((pt.y + (x_offset*s + y_offset*c)) + 0.5f));
+			}
 		}
 	}
 	uint32_t ROI_base = 144 * (threadIdx.x & 3) + (threadIdx.x >> 2), triplet_base = threadIdx.y << 5, desc = 0;
@@ -187,10 +202,20 @@ CLATCH_kernel(const cudaTextureObject_t d_all_tex[8], const cudaTextureObject_t
 		desc |= (accum[0] + __shfl_xor(accum[0], 16) < 0) << ((i << 3) + (threadIdx.x & 7));
 	}
 	for (int32_t s = 1; s <= 4; s <<= 1) desc |= __shfl_xor(desc, s);
-	if (threadIdx.x == 0) d_desc[(blockIdx.x << 4) + threadIdx.y] = desc;
+	if (threadIdx.x == 0) d_desc[blockIdx.x * words + threadIdx.y] = desc;
 }
 
-
+template <const int bits, const bool upright>
 void CLATCH(cudaTextureObject_t d_all_tex[8], const cudaTextureObject_t d_triplets, const koral::Keypoint* const __restrict d_kps, const int num_kps, uint64_t* const __restrict d_desc) {
-	CLATCH_kernel<<<num_kps, { 32, 16 } >>>(d_all_tex, d_triplets, d_kps, reinterpret_cast<uint32_t*>(d_desc));
+	static_assert(bits == 128 || bits == 256 || bits == 384 || bits == 512, "CLATCH supports 128, 256, 384, or 512 bits.");
+	CLATCH_kernel<bits / 32, upright><<<num_kps, { 32, bits / 32 } >>>(d_all_tex, d_triplets, d_kps, reinterpret_cast<uint32_t*>(d_desc));
 }
+
+template void CLATCH<128, false>(cudaTextureObject_t d_all_tex[8], const cudaTextureObject_t d_triplets, const koral::Keypoint* const __restrict d_kps, const int num_kps, uint64_t* const __restrict d_desc);
+template void CLATCH<256, false>(cudaTextureObject_t d_all_tex[8], const cudaTextureObject_t d_triplets, const koral::Keypoint* const __restrict d_kps, const int num_kps, uint64_t* const __restrict d_desc);
+template void CLATCH<384, false>(cudaTextureObject_t d_all_tex[8], const cudaTextureObject_t d_triplets, const koral::Keypoint* const __restrict d_kps, const int num_kps, uint64_t* const __restrict d_desc);
+template void CLATCH<512, false>(cudaTextureObject_t d_all_tex[8], const cudaTextureObject_t d_triplets, const koral::Keypoint* const __restrict d_kps, const int num_kps, uint64_t* const __restrict d_desc);
+template void CLATCH<128, true>(cudaTextureObject_t d_all_tex[8], const cudaTextureObject_t d_triplets, const koral::Keypoint* const __restrict d_kps, const int num_kps, uint64_t* const __restrict d_desc);
+template void CLATCH<256, true>(cudaTextureObject_t d_all_tex[8], const cudaTextureObject_t d_triplets, const koral::Keypoint* const __restrict d_kps, const int num_kps, uint64_t* const __restrict d_desc);
+template void CLATCH<384, true>(cudaTextureObject_t d_all_tex[8], const cudaTextureObject_t d_triplets, const koral::Keypoint* const __restrict d_kps, const int num_kps, uint64_t* const __restrict d_desc);
+template void CLATCH<512, true>(cudaTextureObject_t d_all_tex[8], const cudaTextureObject_t d_triplets, const koral::Keypoint* const __restrict d_kps, const int num_kps, uint64_t* const __restrict d_desc);
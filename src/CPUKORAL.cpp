@@ -0,0 +1,241 @@
+/*******************************************************************
+*   CPUKORAL.cpp
+*   KORAL
+*******************************************************************/
+//
+// CPU-only KORAL pipeline.
+// See CPUKORAL.h for details.
+//
+
+#include "koral/CPUKORAL.h"
+
+#include "koral/BRIEF.h"
+#include "koral/FeatureAngle.h"
+#include "koral/KFAST.h"
+#include "koral/LATCH.h"
+#include "koral/LERP.h"
+
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+koral::CPUKORAL::CPUKORAL(const float _scale_factor, const uint8_t _scale_levels, const uint16_t _desc_bits, const bool _upright, const bool _fused, const int32_t _tile_size, const CPUDescriptor _engine) :
+	scale_factor(_scale_factor), scale_levels(_scale_levels), desc_bits(_desc_bits), upright(_upright), fused(_fused), tile_size(_tile_size), engine(_engine), levels(_scale_levels), level_imgs(_scale_levels) {
+	if (desc_bits != 128 && desc_bits != 256 && desc_bits != 384 && desc_bits != 512) {
+		throw std::invalid_argument("CPUKORAL: desc_bits must be 128, 256, 384, or 512.");
+	}
+	if (tile_size < 16) {
+		throw std::invalid_argument("CPUKORAL: tile_size must be at least 16.");
+	}
+	if (engine == CPUDescriptor::BRIEF && desc_bits != 256) {
+		throw std::invalid_argument("CPUKORAL: BRIEF descriptors are 256 bits.");
+	}
+	desc = DescriptorSet(desc_bits);
+}
+
+void koral::CPUKORAL::go(const uint8_t* const image, const uint32_t width, const uint32_t height, const uint8_t KFAST_thresh) {
+	buildPyramid(image, width, height);
+	if (engine == CPUDescriptor::BRIEF) smooth(levels.data(), scale_levels);
+	if (fused) {
+		goFused(KFAST_thresh);
+	}
+	else {
+		goUnfused(KFAST_thresh);
+	}
+}
+
+void koral::CPUKORAL::buildPyramid(const uint8_t* const image, const uint32_t width, const uint32_t height, const uint8_t* const used) {
+	levels[0] = ImageLevel(image, static_cast<int32_t>(width), static_cast<int32_t>(height), static_cast<int32_t>(width));
+	float f = 1.0f;
+	for (uint8_t i = 1; i < scale_levels; ++i) {
+		f *= scale_factor;
+		const int32_t w = static_cast<int32_t>(static_cast<float>(width) / f + 0.5f);
+		const int32_t h = static_cast<int32_t>(static_cast<float>(height) / f + 0.5f);
+		if (used && !used[i]) {
+			levels[i] = ImageLevel(nullptr, w, h, w);
+			continue;
+		}
+		// KFAST's last vector loads run up to 32 bytes past the last row
+		level_imgs[i].resize(static_cast<size_t>(w) * h + 64);
+		LERP<true>(image, static_cast<int32_t>(width), static_cast<int32_t>(height), static_cast<int32_t>(width), f, level_imgs[i].data(), w, h, w);
+		levels[i] = ImageLevel(level_imgs[i].data(), w, h, w);
+	}
+}
+
+void koral::CPUKORAL::smooth(const ImageLevel* const pyramid, const uint8_t num_levels) {
+	smoothed.resize(num_levels);
+	smoothed_imgs.resize(num_levels);
+	for (uint8_t i = 0; i < num_levels; ++i) {
+		const ImageLevel& l = pyramid[i];
+		if (!l.img) {
+			smoothed[i] = ImageLevel(nullptr, l.w, l.h, l.w);
+			continue;
+		}
+		smoothed_imgs[i].resize(static_cast<size_t>(l.w) * l.h);
+		BRIEFSmooth<true>(l, smoothed_imgs[i].data());
+		smoothed[i] = ImageLevel(smoothed_imgs[i].data(), l.w, l.h, l.w);
+	}
+
+	bool stale = !brief_tables || brief_tables->levels() != num_levels;
+	for (uint8_t i = 0; !stale && i < num_levels; ++i) stale = brief_tables->stride(i) != smoothed[i].stride;
+	if (stale) brief_tables.reset(new BRIEFTables(smoothed.data(), num_levels));
+}
+
+void koral::CPUKORAL::describe(const Keypoint* const kps, const int num_kps, uint64_t* const out) const {
+	if (engine == CPUDescriptor::BRIEF) {
+		BRIEF<false>(smoothed.data(), kps, num_kps, out, *brief_tables);
+		return;
+	}
+	if (upright) {
+		switch (desc_bits) {
+		case 128: LATCH<false, 128, true>(levels.data(), kps, num_kps, out); break;
+		case 256: LATCH<false, 256, true>(levels.data(), kps, num_kps, out); break;
+		case 384: LATCH<false, 384, true>(levels.data(), kps, num_kps, out); break;
+		default:  LATCH<false, 512, true>(levels.data(), kps, num_kps, out); break;
+		}
+		return;
+	}
+	switch (desc_bits) {
+	case 128: LATCH<false, 128>(levels.data(), kps, num_kps, out); break;
+	case 256: LATCH<false, 256>(levels.data(), kps, num_kps, out); break;
+	case 384: LATCH<false, 384>(levels.data(), kps, num_kps, out); break;
+	default:  LATCH<false, 512>(levels.data(), kps, num_kps, out); break;
+	}
+}
+
+void koral::CPUKORAL::goUnfused(const uint8_t KFAST_thresh) {
+	kps.clear();
+	for (uint8_t i = 0; i < scale_levels; ++i) {
+		const ImageLevel& l = levels[i];
+		std::vector<Keypoint> local_kps;
+		KFAST<true, true>(l.img, l.w, l.h, l.stride, local_kps, KFAST_thresh);
+
+		// set scale and compute angles
+		for (auto& kp : local_kps) {
+			kp.scale = i;
+			kp.angle = upright ? 0.0f : featureAngle(l.img, kp.x, kp.y, l.stride);
+		}
+		kps.insert(kps.end(), local_kps.begin(), local_kps.end());
+	}
+
+	describeAll(levels.data());
+}
+
+void koral::CPUKORAL::describeAll(const ImageLevel* const pyramid) {
+	if (engine == CPUDescriptor::BRIEF) {
+		BRIEF<true>(smoothed.data(), kps.data(), static_cast<int>(kps.size()), desc, *brief_tables);
+	}
+	else if (upright) {
+		LATCH<true, true>(pyramid, kps.data(), static_cast<int>(kps.size()), desc);
+	}
+	else {
+		LATCH<true>(pyramid, kps.data(), static_cast<int>(kps.size()), desc);
+	}
+}
+
+void koral::CPUKORAL::detectTiles(const int32_t* const tiles, const size_t first, const size_t last, const uint8_t KFAST_thresh, std::vector<Keypoint>& out_kps, DescriptorSet& out_desc) const {
+	std::vector<Keypoint> found;
+	for (size_t t = first; t < last; ++t) {
+		const int32_t* const tile = tiles + 5 * t;
+		const uint8_t i = static_cast<uint8_t>(tile[0]);
+		const ImageLevel& l = levels[i];
+		const int32_t tx0 = tile[1], ty0 = tile[2], tx1 = tile[3], ty1 = tile[4];
+
+		// 3 pixels of halo for the FAST circle, plus 1 for nonmax suppression
+		const int32_t rx0 = std::max(tx0 - 4, 0), ry0 = std::max(ty0 - 4, 0);
+		const int32_t rx1 = std::min(tx1 + 4, l.w), ry1 = std::min(ty1 + 4, l.h);
+		found.clear();
+		KFAST<false, true>(l.img + ry0*l.stride + rx0, rx1 - rx0, ry1 - ry0, l.stride, found, KFAST_thresh);
+
+		// keep the corners this tile owns, then orient and describe them while the tile is hot
+		const size_t old = out_kps.size();
+		for (auto kp : found) {
+			kp.x += rx0;
+			kp.y += ry0;
+			if (kp.x < tx0 || kp.x >= tx1 || kp.y < ty0 || kp.y >= ty1) continue;
+			kp.scale = i;
+			kp.angle = upright ? 0.0f : featureAngle(l.img, kp.x, kp.y, l.stride);
+			out_kps.push_back(kp);
+		}
+		const int n = static_cast<int>(out_kps.size() - old);
+		if (n) {
+			out_desc.resize(old + n);
+			describe(out_kps.data() + old, n, out_desc[old]);
+		}
+	}
+}
+
+void koral::CPUKORAL::goFused(const uint8_t KFAST_thresh) {
+	// tiles as (level, x0, y0, x1, y1). A remainder narrower than a tile
+	// joins the last full tile, so no tile is too small for KFAST.
+	std::vector<int32_t> tiles;
+	for (uint8_t i = 0; i < scale_levels; ++i) {
+		const int32_t nx = std::max(levels[i].w / tile_size, 1), ny = std::max(levels[i].h / tile_size, 1);
+		for (int32_t ty = 0; ty < ny; ++ty) {
+			for (int32_t tx = 0; tx < nx; ++tx) {
+				tiles.insert(tiles.end(), { i, tx*tile_size, ty*tile_size, tx == nx - 1 ? levels[i].w : (tx + 1)*tile_size, ty == ny - 1 ? levels[i].h : (ty + 1)*tile_size });
+			}
+		}
+	}
+	const size_t num_tiles = tiles.size() / 5;
+
+	kps.clear();
+	desc.clear();
+	const int hw_concur = std::min(static_cast<int>(num_tiles), static_cast<int>(std::thread::hardware_concurrency()));
+	if (hw_concur <= 1) {
+		detectTiles(tiles.data(), 0, num_tiles, KFAST_thresh, kps, desc);
+		return;
+	}
+
+	// each worker takes a contiguous run of tiles; outputs are joined in tile order
+	std::vector<std::vector<Keypoint>> thread_kps(hw_concur);
+	std::vector<DescriptorSet> thread_desc;
+	for (int i = 0; i < hw_concur; ++i) thread_desc.emplace_back(desc_bits);
+	std::vector<std::future<void>> fut(hw_concur);
+	size_t start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const size_t end = start + (num_tiles - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, &CPUKORAL::detectTiles, this, tiles.data(), start, end, KFAST_thresh, std::ref(thread_kps[i]), std::ref(thread_desc[i]));
+		start = end;
+	}
+	for (int i = 0; i < hw_concur; ++i) {
+		fut[i].wait();
+		kps.insert(kps.end(), thread_kps[i].begin(), thread_kps[i].end());
+		desc.append(thread_desc[i]);
+	}
+}
+
+void koral::CPUKORAL::describeKeypoints(const uint8_t* const image, const uint32_t width, const uint32_t height, const std::vector<Keypoint>& points) {
+	std::vector<uint8_t> used(scale_levels, 0);
+	for (const auto& kp : points) {
+		if (kp.scale >= scale_levels) throw std::invalid_argument("CPUKORAL: keypoint outside its scale level.");
+		used[kp.scale] = 1;
+	}
+	buildPyramid(image, width, height, used.data());
+	describeKeypoints(levels.data(), scale_levels, points);
+}
+
+void koral::CPUKORAL::describeKeypoints(const std::vector<Keypoint>& points) {
+	describeKeypoints(levels.data(), scale_levels, points);
+}
+
+void koral::CPUKORAL::describeKeypoints(const ImageLevel* const pyramid, const uint8_t num_levels, const std::vector<Keypoint>& points) {
+	kps = points;
+	for (auto& kp : kps) {
+		if (kp.scale >= num_levels || !pyramid[kp.scale].img || kp.x < 0 || kp.y < 0 || kp.x >= pyramid[kp.scale].w || kp.y >= pyramid[kp.scale].h) {
+			throw std::invalid_argument("CPUKORAL: keypoint outside its scale level.");
+		}
+		if (upright) {
+			kp.angle = 0.0f;
+		}
+		else if (angleMissing(kp.angle)) {
+			const ImageLevel& l = pyramid[kp.scale];
+			const bool inside = kp.x >= 3 && kp.y >= 3 && kp.x + 3 < l.w && kp.y + 3 < l.h;
+			kp.angle = inside ? featureAngle(l.img, kp.x, kp.y, l.stride) : 0.0f;
+		}
+	}
+
+	if (engine == CPUDescriptor::BRIEF) smooth(pyramid, num_levels);
+	describeAll(pyramid);
+}
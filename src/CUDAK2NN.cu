@@ -75,7 +75,70 @@ CUDAK2NN_kernel(const cudaTextureObject_t tex_q, const int num_q, const uint64_t
 	if (idx < num_q) g_match[idx] = second_v - best_v > threshold ? best_i : -1;
 }
 
+// Generic variant for truncated descriptors of 'words' 64-bit words.
+// Each descriptor is handled by a group of G lanes, where G is words rounded up
+// to a power of 2; lane w of a group holds word w of the training descriptor and
+// word w of each of the group's G queries (lanes with w >= words hold zeros).
+// The per-query partial popcounts are then reduced and transposed across the group
+// so that every lane ends up with the full distance for its own query.
+template <const int words>
+__global__ void
+#ifndef __INTELLISENSE__
+__launch_bounds__(256, 0)
+#endif
+CUDAK2NN_kernel_T(const cudaTextureObject_t tex_q, const int num_q, const uint64_t* __restrict__ g_training, const int num_t, int* const __restrict__ g_match, const uint8_t threshold) {
+	constexpr int G = words <= 2 ? 2 : words <= 4 ? 4 : 8;
+	const int w = threadIdx.x & (G - 1);
+	const bool active = w < words;
+	uint64_t train = active ? g_training[w] : 0;
+	g_training += words;
+	uint64_t q[G];
+	const int q_base = (blockIdx.x << 8) + (threadIdx.y << 5) + (threadIdx.x & ~(G - 1));
+#pragma unroll
+	for (int i = 0; i < G; ++i) {
+		q[i] = 0;
+		if (active) {
+			const uint2 buf = tex1Dfetch<uint2>(tex_q, (q_base + i) * words + w);
+			asm("mov.b64 %0, {%1,%2};" : "=l"(q[i]) : "r"(buf.x), "r"(buf.y));
+		}
+	}
+	int best_i = -1, best_v = 100000, second_v = 200000;
+	for (int t = 0; t < num_t; ++t, g_training += words) {
+		int dist[G];
+#pragma unroll
+		for (int i = 0; i < G; ++i) dist[i] = __popcll(q[i] ^ train);
+#pragma unroll
+		for (int k = 1; k < G; k <<= 1) {
+#pragma unroll
+			for (int s = 0; s < G; s += k) dist[s] += __shfl_xor(dist[s], k);
+#pragma unroll
+			for (int s = 0; s < G; s += k << 1) if (threadIdx.x & k) dist[s] = dist[s + k];
+		}
+		train = active ? g_training[w] : 0;
+		second_v = min(dist[0], second_v);
+		if (dist[0] < best_v) {
+			second_v = best_v;
+			best_i = t;
+			best_v = dist[0];
+		}
+	}
+	const int idx = (blockIdx.x << 8) + (threadIdx.y << 5) + threadIdx.x;
+	if (idx < num_q) g_match[idx] = second_v - best_v > threshold ? best_i : -1;
+}
+
+template <const int bits>
 void CUDAK2NN(const void* const __restrict d_t, const int num_t, const cudaTextureObject_t tex_q, const int num_q, int* const __restrict d_m, const int threshold) {
-	CUDAK2NN_kernel<<<((num_q - 1) >> 8) + 1, { 32, 8 }>>>(tex_q, num_q, reinterpret_cast<const uint64_t*>(d_t), num_t, d_m, threshold);
+	static_assert(bits == 128 || bits == 256 || bits == 384 || bits == 512, "CUDAK2NN supports 128, 256, 384, or 512 bits.");
+	if (bits == 512) {
+		CUDAK2NN_kernel<<<((num_q - 1) >> 8) + 1, { 32, 8 }>>>(tex_q, num_q, reinterpret_cast<const uint64_t*>(d_t), num_t, d_m, threshold);
+	}
+	else {
+		CUDAK2NN_kernel_T<bits / 64><<<((num_q - 1) >> 8) + 1, { 32, 8 }>>>(tex_q, num_q, reinterpret_cast<const uint64_t*>(d_t), num_t, d_m, threshold);
+	}
 	cudaDeviceSynchronize();
 }
+
+template void CUDAK2NN<128>(const void* const __restrict d_t, const int num_t, const cudaTextureObject_t tex_q, const int num_q, int* const __restrict d_m, const int threshold);
+template void CUDAK2NN<256>(const void* const __restrict d_t, const int num_t, const cudaTextureObject_t tex_q, const int num_q, int* const __restrict d_m, const int threshold);
+template void CUDAK2NN<384>(const void* const __restrict d_t, const int num_t, const cudaTextureObject_t tex_q, const int num_q, int* const __restrict d_m, const int threshold);
+template void CUDAK2NN<512>(const void* const __restrict d_t, const int num_t, const cudaTextureObject_t tex_q, const int num_q, int* const __restrict d_m, const int threshold);
@@ -0,0 +1,262 @@
+/*******************************************************************
+*   ClusterTree.cpp
+*   KORAL
+*******************************************************************/
+//
+// Randomized hierarchical clustering trees.
+// See ClusterTree.h for details.
+//
+
+#include "koral/ClusterTree.h"
+
+#include "koral/Hamming.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <immintrin.h>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+template <const int bits>
+static uint64_t dist4(const uint64_t* const q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3) {
+	__m256i qv[koral::HammingChunks<bits>::total];
+	koral::hammingLoad<bits>(q, qv);
+	return static_cast<uint64_t>(_mm_cvtsi128_si64(koral::hamming4<bits>(qv, t0, t1, t2, t3)));
+}
+
+koral::ClusterTreeIndex::ClusterTreeIndex(const DescriptorView& train, const int trees, const int _branching, const int _leaf_size, const uint64_t seed) :
+	desc(train), branching(_branching), leaf_size(_leaf_size) {
+	if (trees < 1 || branching < 2 || leaf_size < 1) throw std::invalid_argument("ClusterTreeIndex: need at least 1 tree, branching 2, and leaf size 1.");
+	forest.resize(desc.empty() ? 0 : trees);
+	switch (desc.bits()) {
+	case 128: dist4 = ::dist4<128>; break;
+	case 256: dist4 = ::dist4<256>; break;
+	case 384: dist4 = ::dist4<384>; break;
+	default:  dist4 = ::dist4<512>; break;
+	}
+
+	const int hw_concur = std::min(static_cast<int>(forest.size()), static_cast<int>(std::thread::hardware_concurrency()));
+	if (hw_concur <= 1) {
+		for (size_t t = 0; t < forest.size(); ++t) buildTree(forest[t], seed + t);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (static_cast<int>(forest.size()) - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, [this, start, end, seed]() { for (int t = start; t < end; ++t) buildTree(forest[t], seed + t); });
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+void koral::ClusterTreeIndex::buildTree(Tree& tree, const uint64_t seed) const {
+	const int words = static_cast<int>(desc.words());
+	const uint32_t n = static_cast<uint32_t>(desc.size());
+	std::mt19937_64 rng(seed);
+
+	tree.order.resize(n);
+	for (uint32_t i = 0; i < n; ++i) tree.order[i] = i;
+	tree.nodes.assign(1, Node{ 0, 0, n, 0, 0 });
+
+	std::vector<uint32_t> sample, centers, assigned, counts, tmp;
+	std::vector<int> nearest;
+	std::vector<uint32_t> stack(1, 0);
+	while (!stack.empty()) {
+		const uint32_t node = stack.back();
+		stack.pop_back();
+		const uint32_t begin = tree.nodes[node].begin, end = tree.nodes[node].end, count = end - begin;
+		const uint32_t* const ids = &tree.order[begin];
+		if (count <= static_cast<uint32_t>(std::max(leaf_size, branching))) continue;
+
+		// k-means++ seeding on a sample of the cluster: each further center is drawn with
+		// probability proportional to its squared distance from the nearest center so far
+		const uint32_t sample_n = std::min(count, static_cast<uint32_t>(branching) << 6);
+		sample.resize(sample_n);
+		for (uint32_t i = 0; i < sample_n; ++i) sample[i] = sample_n == count ? ids[i] : ids[rng() % count];
+		centers.assign(1, sample[rng() % sample_n]);
+		nearest.resize(sample_n);
+		for (uint32_t i = 0; i < sample_n; ++i) nearest[i] = hamming(desc[sample[i]], desc[centers[0]], words);
+		while (static_cast<int>(centers.size()) < branching) {
+			uint64_t total = 0;
+			for (uint32_t i = 0; i < sample_n; ++i) total += static_cast<uint64_t>(nearest[i]) * nearest[i];
+			if (total == 0) break;
+			uint64_t pick = std::uniform_int_distribution<uint64_t>(0, total - 1)(rng);
+			uint32_t c = 0;
+			for (;; ++c) {
+				const uint64_t w = static_cast<uint64_t>(nearest[c]) * nearest[c];
+				if (pick < w) break;
+				pick -= w;
+			}
+			centers.push_back(sample[c]);
+			for (uint32_t i = 0; i < sample_n; ++i) nearest[i] = std::min(nearest[i], hamming(desc[sample[i]], desc[sample[c]], words));
+		}
+		const uint32_t k = static_cast<uint32_t>(centers.size());
+		if (k < 2) continue;
+
+		// assign each descriptor to its nearest center, 4 centers at a time, ties to the first
+		assigned.resize(count);
+		counts.assign(k, 0);
+		for (uint32_t i = 0; i < count; ++i) {
+			const uint64_t* const d = desc[ids[i]];
+			int best = 100000;
+			uint32_t best_c = 0, c = 0;
+			for (; c + 4 <= k; c += 4) {
+				const uint64_t d4 = dist4(d, desc[centers[c]], desc[centers[c + 1]], desc[centers[c + 2]], desc[centers[c + 3]]);
+				for (uint32_t j = 0; j < 4; ++j) {
+					const int v = static_cast<int>((d4 >> (j << 4)) & 0xFFFF);
+					if (v < best) {
+						best = v;
+						best_c = c + j;
+					}
+				}
+			}
+			for (; c < k; ++c) {
+				const int v = hamming(d, desc[centers[c]], words);
+				if (v < best) {
+					best = v;
+					best_c = c;
+				}
+			}
+			assigned[i] = best_c;
+			++counts[best_c];
+		}
+
+		// stable partition of this node's range by cluster, then one child per cluster
+		tmp.resize(count);
+		std::vector<uint32_t> offsets(k + 1, 0);
+		for (uint32_t c = 0; c < k; ++c) offsets[c + 1] = offsets[c] + counts[c];
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (uint32_t i = 0; i < count; ++i) tmp[fill[assigned[i]]++] = ids[i];
+		std::copy(tmp.begin(), tmp.end(), tree.order.begin() + begin);
+
+		const uint32_t first = static_cast<uint32_t>(tree.nodes.size());
+		tree.nodes[node].first_child = first;
+		tree.nodes[node].num_children = k;
+		for (uint32_t c = 0; c < k; ++c) {
+			tree.nodes.push_back(Node{ centers[c], begin + offsets[c], begin + offsets[c + 1], 0, 0 });
+			// a cluster holding everything (duplicates) would never shrink
+			if (counts[c] < count) stack.push_back(first + c);
+		}
+	}
+}
+
+void koral::ClusterTreeIndex::searchRange(const DescriptorView& query, const int start, const int end, const int max_checks, int* const best_i, int* const best_d, int* const second_d) const {
+	const int words = static_cast<int>(desc.words());
+	// (distance to center, tree, node) of clusters passed over, nearest first
+	typedef std::tuple<int, uint32_t, uint32_t> Branch;
+	std::vector<Branch> heap;
+	std::vector<uint32_t> seen(desc.size(), 0);
+	uint32_t stamp = 0;
+
+	for (int qi = start; qi < end; ++qi) {
+		const uint64_t* const q = query[qi];
+		int bi = -1, bd = 100000, sd = 200000;
+		if (++stamp == 0) {
+			std::fill(seen.begin(), seen.end(), 0);
+			stamp = 1;
+		}
+		heap.clear();
+		int checks = 0;
+
+		auto descend = [&](const uint32_t t, uint32_t node) {
+			const Tree& tree = forest[t];
+			while (tree.nodes[node].num_children) {
+				const Node& nd = tree.nodes[node];
+				int best = 100000;
+				uint32_t best_c = 0, c = 0;
+				auto consider = [&](const int v, const uint32_t child) {
+					if (v < best) {
+						if (best < 100000) {
+							heap.emplace_back(best, t, best_c);
+							std::push_heap(heap.begin(), heap.end(), std::greater<Branch>());
+						}
+						best = v;
+						best_c = child;
+					}
+					else {
+						heap.emplace_back(v, t, child);
+						std::push_heap(heap.begin(), heap.end(), std::greater<Branch>());
+					}
+				};
+				for (; c + 4 <= nd.num_children; c += 4) {
+					const Node* const ch = &tree.nodes[nd.first_child + c];
+					const uint64_t d4 = dist4(q, desc[ch[0].center], desc[ch[1].center], desc[ch[2].center], desc[ch[3].center]);
+					for (uint32_t j = 0; j < 4; ++j) consider(static_cast<int>((d4 >> (j << 4)) & 0xFFFF), nd.first_child + c + j);
+				}
+				for (; c < nd.num_children; ++c) consider(hamming(q, desc[tree.nodes[nd.first_child + c].center], words), nd.first_child + c);
+				node = best_c;
+			}
+
+			// the whole leaf is measured
+			const Node& leaf = tree.nodes[node];
+			for (uint32_t e = leaf.begin; e < leaf.end; ++e) {
+				const uint32_t id = tree.order[e];
+				if (seen[id] == stamp) continue;
+				seen[id] = stamp;
+				++checks;
+				const int d = hamming(q, desc[id], words);
+				if (d < bd || (d == bd && static_cast<int>(id) < bi)) {
+					sd = bd;
+					bd = d;
+					bi = static_cast<int>(id);
+				}
+				else {
+					sd = std::min(sd, d);
+				}
+			}
+		};
+
+		for (uint32_t t = 0; t < forest.size(); ++t) descend(t, 0);
+		while (!heap.empty() && checks < max_checks) {
+			const Branch b = heap.front();
+			std::pop_heap(heap.begin(), heap.end(), std::greater<Branch>());
+			heap.pop_back();
+			descend(std::get<1>(b), std::get<2>(b));
+		}
+
+		best_i[qi] = bi;
+		if (best_d) best_d[qi] = bd;
+		if (second_d) second_d[qi] = sd;
+	}
+}
+
+template <const bool multithreading>
+void koral::ClusterTreeIndex::top2(const DescriptorView& query, const int max_checks, int* const __restrict best_i, int* const __restrict best_d, int* const __restrict second_d) const {
+	if (query.bits() != desc.bits()) throw std::invalid_argument("ClusterTreeIndex: query descriptors differ in length from the index.");
+	const int num_q = static_cast<int>(query.size());
+	const int hw_concur = multithreading ? std::min(num_q >> 4, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		searchRange(query, 0, num_q, max_checks, best_i, best_d, second_d);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (num_q - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, &ClusterTreeIndex::searchRange, this, std::cref(query), start, end, max_checks, best_i, best_d, second_d);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+template <const bool multithreading>
+void koral::ClusterTreeIndex::match(const DescriptorView& query, int* const __restrict matches, const int threshold, const int max_checks) const {
+	std::vector<int> best_d(query.size()), second_d(query.size());
+	top2<multithreading>(query, max_checks, matches, best_d.data(), second_d.data());
+	for (size_t i = 0; i < query.size(); ++i) {
+		if (second_d[i] - best_d[i] <= static_cast<uint8_t>(threshold)) matches[i] = -1;
+	}
+}
+
+template void koral::ClusterTreeIndex::top2<true>(const DescriptorView& query, const int max_checks, int* const __restrict best_i, int* const __restrict best_d, int* const __restrict second_d) const;
+template void koral::ClusterTreeIndex::top2<false>(const DescriptorView& query, const int max_checks, int* const __restrict best_i, int* const __restrict best_d, int* const __restrict second_d) const;
+template void koral::ClusterTreeIndex::match<true>(const DescriptorView& query, int* const __restrict matches, const int threshold, const int max_checks) const;
+template void koral::ClusterTreeIndex::match<false>(const DescriptorView& query, int* const __restrict matches, const int threshold, const int max_checks) const;
@@ -195,7 +195,8 @@ static const __m128i ywt0 = _mm_setr_epi16(0, 0, 3, 3, 3, 0, 0, 0);
 static const __m128i ywt1 = _mm_setr_epi16(0, 2, 2, 2, 2, 2, 0, 0);
 static const __m128i ywt2 = _mm_setr_epi16(1, 1, 1, 1, 1, 1, 1, 0);
 
-float featureAngle(const uint8_t* const __restrict image, const int px, const int py, const int step) {
+// x and y intensity moments of the 7x7 disc above
+static inline void moments(const uint8_t* const __restrict image, const int px, const int py, const int step, float& x_sum, float& y_sum) {
 	const uint8_t* __restrict p = image + (py - 3)*step + (px - 3);
 	__m128i x = _mm_setzero_si128();
 	__m128i y = _mm_setzero_si128();
@@ -237,12 +238,54 @@ float featureAngle(const uint8_t* const __restrict image, const int px, const in
 	x = _mm_add_epi16(x, _mm_shuffle_epi32(x, 78));
 	x = _mm_hadd_epi16(x, x);
 	x = _mm_add_epi16(x, _mm_shufflelo_epi16(x, 225));
-	const float x_sum = static_cast<float>(static_cast<int16_t>(_mm_cvtsi128_si32(x)));
+	x_sum = static_cast<float>(static_cast<int16_t>(_mm_cvtsi128_si32(x)));
 
 	y = _mm_add_epi16(y, _mm_shuffle_epi32(y, 78));
 	y = _mm_hadd_epi16(y, y);
 	y = _mm_add_epi16(y, _mm_shufflelo_epi16(y, 225));
-	const float y_sum = static_cast<float>(static_cast<int16_t>(_mm_cvtsi128_si32(y)));
+	y_sum = static_cast<float>(static_cast<int16_t>(_mm_cvtsi128_si32(y)));
+}
 
+float featureAngle(const uint8_t* const __restrict image, const int px, const int py, const int step) {
+	float x_sum, y_sum;
+	moments(image, px, py, step, x_sum, y_sum);
 	return fastAtan2(y_sum, x_sum);
 }
+
+// fastAtan2 on 8 lanes
+static inline __m256 fastAtan2(const __m256 y, const __m256 x) {
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 ax = _mm256_andnot_ps(sign, x);
+	const __m256 ay = _mm256_andnot_ps(sign, y);
+	const __m256 x_major = _mm256_cmp_ps(ax, ay, _CMP_GE_OQ);
+	const __m256 c = _mm256_div_ps(_mm256_blendv_ps(ax, ay, x_major), _mm256_add_ps(_mm256_blendv_ps(ay, ax, x_major), _mm256_set1_ps(FLT_MIN)));
+	const __m256 cc = _mm256_mul_ps(c, c);
+	__m256 t = _mm256_fmadd_ps(_mm256_set1_ps(-0.0443265555479f), cc, _mm256_set1_ps(0.1555786518f));
+	t = _mm256_fmsub_ps(t, cc, _mm256_set1_ps(0.325808397f));
+	t = _mm256_fmadd_ps(t, cc, _mm256_set1_ps(0.9997878412f));
+	__m256 a = _mm256_blendv_ps(_mm256_fnmadd_ps(t, c, _mm256_set1_ps(PI * 0.5f)), _mm256_mul_ps(t, c), x_major);
+	a = _mm256_blendv_ps(a, _mm256_sub_ps(_mm256_set1_ps(PI), a), _mm256_cmp_ps(x, zero, _CMP_LT_OQ));
+	return _mm256_blendv_ps(a, _mm256_sub_ps(zero, a), _mm256_cmp_ps(y, zero, _CMP_LT_OQ));
+}
+
+void featureAngles(const koral::ImageLevel* const __restrict levels, koral::KeypointSet& kps) {
+	const int n = static_cast<int>(kps.size());
+	const int32_t* const __restrict px = kps.x.data();
+	const int32_t* const __restrict py = kps.y.data();
+	const uint8_t* const __restrict pl = kps.level.data();
+	float* const __restrict angle = kps.angle.data();
+	alignas(32) float xs[8], ys[8];
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		for (int j = 0; j < 8; ++j) {
+			const koral::ImageLevel& l = levels[pl[i + j]];
+			moments(l.img, px[i + j], py[i + j], l.stride, xs[j], ys[j]);
+		}
+		_mm256_storeu_ps(angle + i, fastAtan2(_mm256_load_ps(ys), _mm256_load_ps(xs)));
+	}
+	for (; i < n; ++i) {
+		const koral::ImageLevel& l = levels[pl[i]];
+		angle[i] = featureAngle(l.img, px[i], py[i], l.stride);
+	}
+}
@@ -0,0 +1,183 @@
+/*******************************************************************
+*   GuidedMatcher.cpp
+*   KORAL
+*******************************************************************/
+//
+// Guided 2NN matching within predicted search windows.
+// See GuidedMatcher.h for details.
+//
+
+#include "koral/GuidedMatcher.h"
+
+#include "koral/Hamming.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <immintrin.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+template <const int bits>
+static uint64_t dist4(const uint64_t* const q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3) {
+	__m256i qv[koral::HammingChunks<bits>::total];
+	koral::hammingLoad<bits>(q, qv);
+	return static_cast<uint64_t>(_mm_cvtsi128_si64(koral::hamming4<bits>(qv, t0, t1, t2, t3)));
+}
+
+koral::GuidedMatcher::GuidedMatcher(const KeypointSet& train_kps, const DescriptorView& train, const int _cell) :
+	cell(_cell), min_x(0.0f), min_y(0.0f), cols(1), rows(1), levels(1), desc(train.bits()) {
+	if (cell < 1) throw std::invalid_argument("GuidedMatcher: cell must be at least 1 pixel.");
+	if (train_kps.size() != train.size()) throw std::invalid_argument("GuidedMatcher: keypoint and descriptor counts differ.");
+	switch (desc.bits()) {
+	case 128: dist4 = ::dist4<128>; break;
+	case 256: dist4 = ::dist4<256>; break;
+	case 384: dist4 = ::dist4<384>; break;
+	default:  dist4 = ::dist4<512>; break;
+	}
+
+	const size_t n = train.size();
+	std::vector<float> x0(n), y0(n);
+	train_kps.toLevel0(x0.data(), y0.data());
+	float max_x = 0.0f, max_y = 0.0f;
+	if (n) {
+		min_x = max_x = x0[0];
+		min_y = max_y = y0[0];
+	}
+	for (size_t i = 0; i < n; ++i) {
+		min_x = std::min(min_x, x0[i]);
+		max_x = std::max(max_x, x0[i]);
+		min_y = std::min(min_y, y0[i]);
+		max_y = std::max(max_y, y0[i]);
+		levels = std::max(levels, train_kps.level[i] + 1);
+	}
+	cols = static_cast<int>((max_x - min_x) / static_cast<float>(cell)) + 1;
+	rows = static_cast<int>((max_y - min_y) / static_cast<float>(cell)) + 1;
+
+	// counting sort by (level, row, col)
+	std::vector<uint32_t> key(n);
+	starts.assign(static_cast<size_t>(levels) * rows * cols + 1, 0);
+	for (size_t i = 0; i < n; ++i) {
+		const int c = std::min(static_cast<int>((x0[i] - min_x) / static_cast<float>(cell)), cols - 1);
+		const int r = std::min(static_cast<int>((y0[i] - min_y) / static_cast<float>(cell)), rows - 1);
+		key[i] = static_cast<uint32_t>((train_kps.level[i] * rows + r) * cols + c);
+		++starts[key[i] + 1];
+	}
+	for (size_t k = 1; k < starts.size(); ++k) starts[k] += starts[k - 1];
+	std::vector<uint32_t> fill(starts.begin(), starts.end() - 1);
+	xs.resize(n);
+	ys.resize(n);
+	ids.resize(n);
+	desc.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		const uint32_t j = fill[key[i]]++;
+		xs[j] = x0[i];
+		ys[j] = y0[i];
+		ids[j] = static_cast<uint32_t>(i);
+		memcpy(desc[j], train[i], train.words() * sizeof(uint64_t));
+	}
+}
+
+void koral::GuidedMatcher::matchRange(const KeypointSet& query_kps, const DescriptorView& query, const int start, const int end, const float* const px, const float* const py, const float* const radius, int* const matches, const int threshold, const int level_window) const {
+	const int words = static_cast<int>(desc.words());
+	const float inv_cell = 1.0f / static_cast<float>(cell);
+	for (int qi = start; qi < end; ++qi) {
+		const uint64_t* const q = query[qi];
+		int bi = -1, bd = 100000, sd = 200000;
+		auto update = [&](const int d, const int id) {
+			if (d < bd || (d == bd && id < bi)) {
+				sd = bd;
+				bd = d;
+				bi = id;
+			}
+			else {
+				sd = std::min(sd, d);
+			}
+		};
+
+		const float r = radius[qi];
+		if (!ids.empty() && r >= 0.0f) {
+			const int l0 = level_window < 0 ? 0 : std::max(query_kps.level[qi] - level_window, 0);
+			const int l1 = level_window < 0 ? levels - 1 : std::min(query_kps.level[qi] + level_window, levels - 1);
+			const float fx0 = std::max((px[qi] - r - min_x) * inv_cell, 0.0f), fx1 = std::min((px[qi] + r - min_x) * inv_cell, static_cast<float>(cols - 1));
+			const float fy0 = std::max((py[qi] - r - min_y) * inv_cell, 0.0f), fy1 = std::min((py[qi] + r - min_y) * inv_cell, static_cast<float>(rows - 1));
+			const float r2 = r * r;
+			// the window overlaps the grid; clamped bounds are compared before truncation
+			if (fx0 < static_cast<float>(cols) && fx1 >= 0.0f && fy0 < static_cast<float>(rows) && fy1 >= 0.0f) {
+				const int c0 = static_cast<int>(fx0), c1 = static_cast<int>(fx1);
+				const int row0 = static_cast<int>(fy0), row1 = static_cast<int>(fy1);
+				uint32_t cand[4];
+				int num_c = 0;
+				for (int l = l0; l <= l1; ++l) {
+					for (int row = row0; row <= row1; ++row) {
+						const size_t base = static_cast<size_t>(l * rows + row) * cols;
+						for (uint32_t e = starts[base + c0]; e < starts[base + c1 + 1]; ++e) {
+							const float dx = xs[e] - px[qi], dy = ys[e] - py[qi];
+							if (dx * dx + dy * dy > r2) continue;
+							cand[num_c++] = e;
+							if (num_c == 4) {
+								const uint64_t d4 = dist4(q, desc[cand[0]], desc[cand[1]], desc[cand[2]], desc[cand[3]]);
+								for (int j = 0; j < 4; ++j) update(static_cast<int>((d4 >> (j << 4)) & 0xFFFF), static_cast<int>(ids[cand[j]]));
+								num_c = 0;
+							}
+						}
+					}
+				}
+				for (int j = 0; j < num_c; ++j) update(hamming(q, desc[cand[j]], words), static_cast<int>(ids[cand[j]]));
+			}
+		}
+		matches[qi] = sd - bd > static_cast<uint8_t>(threshold) ? bi : -1;
+	}
+}
+
+template <const bool multithreading>
+void koral::GuidedMatcher::match(const KeypointSet& query_kps, const DescriptorView& query, const float* const __restrict px, const float* const __restrict py, const float* const __restrict radius, int* const __restrict matches, const int threshold, const int level_window) const {
+	if (query.bits() != desc.bits()) throw std::invalid_argument("GuidedMatcher: query descriptors differ in length from the training descriptors.");
+	if (query_kps.size() != query.size()) throw std::invalid_argument("GuidedMatcher: keypoint and descriptor counts differ.");
+	const int num_q = static_cast<int>(query.size());
+	const int hw_concur = multithreading ? std::min(num_q >> 6, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		matchRange(query_kps, query, 0, num_q, px, py, radius, matches, threshold, level_window);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (num_q - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, &GuidedMatcher::matchRange, this, std::cref(query_kps), std::cref(query), start, end, px, py, radius, matches, threshold, level_window);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+template <const bool multithreading>
+void koral::GuidedMatcher::match(const KeypointSet& query_kps, const DescriptorView& query, const float* const __restrict H, const float radius, int* const __restrict matches, const int threshold, const int level_window) const {
+	const size_t n = query_kps.size();
+	// predicted x, then y, then radius, in one allocation
+	std::vector<float> predicted(3 * n, radius);
+	float* const px = predicted.data();
+	float* const py = px + n;
+	float* const r = py + n;
+	query_kps.toLevel0(px, py);
+	for (size_t i = 0; i < n; ++i) {
+		const float x = px[i], y = py[i];
+		const float w = H[6] * x + H[7] * y + H[8];
+		if (w <= 0.0f) {
+			r[i] = -1.0f;
+			continue;
+		}
+		px[i] = (H[0] * x + H[1] * y + H[2]) / w;
+		py[i] = (H[3] * x + H[4] * y + H[5]) / w;
+	}
+	match<multithreading>(query_kps, query, px, py, r, matches, threshold, level_window);
+}
+
+template void koral::GuidedMatcher::match<true>(const KeypointSet& query_kps, const DescriptorView& query, const float* const __restrict px, const float* const __restrict py, const float* const __restrict radius, int* const __restrict matches, const int threshold, const int level_window) const;
+template void koral::GuidedMatcher::match<false>(const KeypointSet& query_kps, const DescriptorView& query, const float* const __restrict px, const float* const __restrict py, const float* const __restrict radius, int* const __restrict matches, const int threshold, const int level_window) const;
+template void koral::GuidedMatcher::match<true>(const KeypointSet& query_kps, const DescriptorView& query, const float* const __restrict H, const float radius, int* const __restrict matches, const int threshold, const int level_window) const;
+template void koral::GuidedMatcher::match<false>(const KeypointSet& query_kps, const DescriptorView& query, const float* const __restrict H, const float radius, int* const __restrict matches, const int threshold, const int level_window) const;
@@ -0,0 +1,397 @@
+/*******************************************************************
+*   HNSW.cpp
+*   KORAL
+*******************************************************************/
+//
+// HNSW graph index for approximate binary descriptor search.
+// See HNSW.h for details.
+//
+
+#include "koral/HNSW.h"
+
+#include "koral/Hamming.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <immintrin.h>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+static constexpr uint32_t lock_stripes = 1 << 12;
+static constexpr int max_levels = 32;
+
+template <const int bits>
+static uint64_t dist4(const uint64_t* const q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3) {
+	__m256i qv[koral::HammingChunks<bits>::total];
+	koral::hammingLoad<bits>(q, qv);
+	return static_cast<uint64_t>(_mm_cvtsi128_si64(koral::hamming4<bits>(qv, t0, t1, t2, t3)));
+}
+
+typedef std::pair<int, uint32_t> Candidate;
+
+// per-thread scratch for graph searches
+struct koral::HNSWIndex::Search {
+	// visited ids, as an open-addressed set, and the slots used, to clear it after each search
+	std::vector<uint32_t> table;
+	std::vector<uint32_t> used;
+
+	// max-heap of the closest found, and min-heap of those still to expand
+	std::vector<Candidate> result;
+	std::vector<Candidate> frontier;
+
+	std::vector<uint32_t> ids;
+	std::vector<uint32_t> selected;
+	std::vector<uint32_t> pruned;
+
+	Search() : table(1024, UINT32_MAX) {}
+
+	// true if id had not been visited
+	bool visit(const uint32_t id) {
+		if ((used.size() << 1) >= table.size()) {
+			std::vector<uint32_t> old;
+			for (const uint32_t u : used) old.push_back(table[u]);
+			table.assign(table.size() << 1, UINT32_MAX);
+			used.clear();
+			for (const uint32_t o : old) place(o);
+		}
+		return place(id);
+	}
+
+	bool place(const uint32_t id) {
+		const uint32_t mask = static_cast<uint32_t>(table.size() - 1);
+		uint32_t s = (id * 0x9E3779B1U) & mask;
+		while (table[s] != UINT32_MAX) {
+			if (table[s] == id) return false;
+			s = (s + 1) & mask;
+		}
+		table[s] = id;
+		used.push_back(s);
+		return true;
+	}
+
+	void clear() {
+		for (const uint32_t u : used) table[u] = UINT32_MAX;
+		used.clear();
+	}
+
+	// best-first search of one layer from the entries in result, keeping the ef closest in result
+	template <const bool locked>
+	void layer(const HNSWIndex& h, const uint64_t* const q, const int ef, const int lay) {
+		const int words = static_cast<int>(h.desc.words());
+		clear();
+		for (const auto& c : result) visit(c.second);
+		std::make_heap(result.begin(), result.end());
+		frontier = result;
+		std::make_heap(frontier.begin(), frontier.end(), std::greater<Candidate>());
+
+		while (!frontier.empty()) {
+			const Candidate c = frontier.front();
+			std::pop_heap(frontier.begin(), frontier.end(), std::greater<Candidate>());
+			frontier.pop_back();
+			if (static_cast<int>(result.size()) >= ef && c.first > result.front().first) break;
+
+			ids.clear();
+			{
+				std::unique_lock<std::mutex> l;
+				if (locked) l = std::unique_lock<std::mutex>(h.lock(c.second));
+				const uint32_t* const n = h.neighbors(c.second, lay);
+				for (uint32_t i = 1; i <= n[0]; ++i) {
+					if (visit(n[i])) ids.push_back(n[i]);
+				}
+			}
+
+			auto consider = [&](const int d, const uint32_t id) {
+				if (static_cast<int>(result.size()) < ef || d < result.front().first) {
+					frontier.emplace_back(d, id);
+					std::push_heap(frontier.begin(), frontier.end(), std::greater<Candidate>());
+					result.emplace_back(d, id);
+					std::push_heap(result.begin(), result.end());
+					if (static_cast<int>(result.size()) > ef) {
+						std::pop_heap(result.begin(), result.end());
+						result.pop_back();
+					}
+				}
+			};
+			size_t i = 0;
+			for (; i + 4 <= ids.size(); i += 4) {
+				const uint64_t d = h.dist4(q, h.desc[ids[i]], h.desc[ids[i + 1]], h.desc[ids[i + 2]], h.desc[ids[i + 3]]);
+				for (int k = 0; k < 4; ++k) consider(static_cast<int>((d >> (k << 4)) & 0xFFFF), ids[i + k]);
+			}
+			for (; i < ids.size(); ++i) consider(hamming(q, h.desc[ids[i]], words), ids[i]);
+		}
+	}
+
+	// greedy descent through one layer from result[0], leaving the closest found in result[0]
+	void greedy(const HNSWIndex& h, const uint64_t* const q, const int lay, const bool locked) {
+		const int words = static_cast<int>(h.desc.words());
+		Candidate cur = result[0];
+		for (bool changed = true; changed;) {
+			changed = false;
+			ids.clear();
+			{
+				std::unique_lock<std::mutex> l;
+				if (locked) l = std::unique_lock<std::mutex>(h.lock(cur.second));
+				const uint32_t* const n = h.neighbors(cur.second, lay);
+				ids.assign(n + 1, n + 1 + n[0]);
+			}
+			for (const uint32_t id : ids) {
+				const Candidate c(hamming(q, h.desc[id], words), id);
+				if (c < cur) {
+					cur = c;
+					changed = true;
+				}
+			}
+		}
+		result.assign(1, cur);
+	}
+
+	// the diversity heuristic: keeps a candidate only if it is closer to q than to any already kept,
+	// then fills the slots left with the closest candidates it pruned (keepPrunedConnections)
+	void select(const HNSWIndex& h, std::vector<Candidate>& sorted, const int max_count) {
+		const int words = static_cast<int>(h.desc.words());
+		std::sort(sorted.begin(), sorted.end());
+		selected.clear();
+		pruned.clear();
+		for (const auto& c : sorted) {
+			bool keep = true;
+			for (const uint32_t s : selected) {
+				if (hamming(h.desc[c.second], h.desc[s], words) < c.first) {
+					keep = false;
+					break;
+				}
+			}
+			if (keep) {
+				selected.push_back(c.second);
+				if (static_cast<int>(selected.size()) == max_count) return;
+			}
+			else {
+				pruned.push_back(c.second);
+			}
+		}
+		const size_t fill = std::min(pruned.size(), static_cast<size_t>(max_count) - selected.size());
+		selected.insert(selected.end(), pruned.begin(), pruned.begin() + fill);
+	}
+};
+
+koral::HNSWIndex::HNSWIndex(const uint16_t bits, const int _M, const int _ef_construction, const uint64_t seed) :
+	M(_M), M0(_M << 1), ef_construction(_ef_construction), level_mult(1.0 / std::log(static_cast<double>(std::max(_M, 2)))), rng(seed),
+	desc(bits), entry(-1), max_level(-1), node_mutex(new std::mutex[lock_stripes]) {
+	if (M < 2 || ef_construction < 1) throw std::invalid_argument("HNSWIndex: M must be at least 2, and ef_construction at least 1.");
+	switch (bits) {
+	case 128: dist4 = ::dist4<128>; break;
+	case 256: dist4 = ::dist4<256>; break;
+	case 384: dist4 = ::dist4<384>; break;
+	default:  dist4 = ::dist4<512>; break;
+	}
+}
+
+uint32_t* koral::HNSWIndex::neighbors(const uint32_t id, const int layer) {
+	return layer == 0 ? &links0[static_cast<size_t>(id) * (M0 + 1)] : &links[id][static_cast<size_t>(layer - 1) * (M + 1)];
+}
+
+const uint32_t* koral::HNSWIndex::neighbors(const uint32_t id, const int layer) const {
+	return layer == 0 ? &links0[static_cast<size_t>(id) * (M0 + 1)] : &links[id][static_cast<size_t>(layer - 1) * (M + 1)];
+}
+
+std::mutex& koral::HNSWIndex::lock(const uint32_t id) const {
+	return node_mutex[id & (lock_stripes - 1)];
+}
+
+void koral::HNSWIndex::insert(const uint32_t id, Search& s) {
+	const uint64_t* const q = desc[id];
+	const int words = static_cast<int>(desc.words());
+	const int level = levels[id];
+
+	int32_t ep;
+	int top;
+	{
+		std::lock_guard<std::mutex> l(entry_mutex);
+		if (entry < 0) {
+			entry = static_cast<int32_t>(id);
+			max_level = level;
+			return;
+		}
+		ep = entry;
+		top = max_level;
+	}
+
+	s.result.assign(1, Candidate(hamming(q, desc[ep], words), static_cast<uint32_t>(ep)));
+	for (int lay = top; lay > level; --lay) s.greedy(*this, q, lay, true);
+
+	std::vector<Candidate> sorted;
+	for (int lay = std::min(level, top); lay >= 0; --lay) {
+		s.layer<true>(*this, q, ef_construction, lay);
+
+		// an exact duplicate of a linked node joins its twin list instead of the graph
+		if (lay == std::min(level, top)) {
+			const auto same = std::find_if(s.result.begin(), s.result.end(), [](const Candidate& c) { return c.first == 0; });
+			if (same != s.result.end()) {
+				std::lock_guard<std::mutex> l(lock(same->second));
+				twin[id] = twin[same->second];
+				twin[same->second] = id;
+				return;
+			}
+		}
+
+		sorted = s.result;
+		s.select(*this, sorted, M);
+		const std::vector<uint32_t> chosen = s.selected;
+		{
+			std::lock_guard<std::mutex> l(lock(id));
+			uint32_t* const n = neighbors(id, lay);
+			n[0] = static_cast<uint32_t>(chosen.size());
+			std::copy(chosen.begin(), chosen.end(), n + 1);
+		}
+
+		// link back, shrinking full lists with the same heuristic
+		const int max_count = lay == 0 ? M0 : M;
+		for (const uint32_t other : chosen) {
+			std::lock_guard<std::mutex> l(lock(other));
+			uint32_t* const n = neighbors(other, lay);
+			if (static_cast<int>(n[0]) < max_count) {
+				n[++n[0]] = id;
+				continue;
+			}
+			sorted.clear();
+			sorted.emplace_back(hamming(desc[other], q, words), id);
+			for (uint32_t i = 1; i <= n[0]; ++i) sorted.emplace_back(hamming(desc[other], desc[n[i]], words), n[i]);
+			s.select(*this, sorted, max_count);
+			n[0] = static_cast<uint32_t>(s.selected.size());
+			std::copy(s.selected.begin(), s.selected.end(), n + 1);
+		}
+	}
+
+	if (level > top) {
+		std::lock_guard<std::mutex> l(entry_mutex);
+		if (level > max_level) {
+			entry = static_cast<int32_t>(id);
+			max_level = level;
+		}
+	}
+}
+
+void koral::HNSWIndex::insertRange(const uint32_t first, const uint32_t last) {
+	Search s;
+	for (uint32_t id = first; id < last; ++id) insert(id, s);
+}
+
+template <const bool multithreading>
+void koral::HNSWIndex::add(const DescriptorView& train) {
+	if (train.bits() != desc.bits()) throw std::invalid_argument("HNSWIndex: descriptors differ in length from the index.");
+	const size_t first = desc.size();
+	desc.append(train);
+	const size_t n = desc.size();
+
+	levels.resize(n);
+	links0.resize(n * (M0 + 1), 0);
+	links.resize(n);
+	twin.resize(n, UINT32_MAX);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	for (size_t i = first; i < n; ++i) {
+		levels[i] = static_cast<uint8_t>(std::min(static_cast<int>(-std::log(1.0 - uniform(rng)) * level_mult), max_levels - 1));
+		if (levels[i]) links[i].assign(static_cast<size_t>(levels[i]) * (M + 1), 0);
+	}
+
+	const uint32_t count = static_cast<uint32_t>(n - first);
+	const int hw_concur = multithreading ? std::min(static_cast<int>(count >> 8), static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		insertRange(static_cast<uint32_t>(first), static_cast<uint32_t>(n));
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	uint32_t start = static_cast<uint32_t>(first);
+	for (int i = 0; i < hw_concur; ++i) {
+		const uint32_t end = start + (static_cast<uint32_t>(n) - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, &HNSWIndex::insertRange, this, start, end);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+void koral::HNSWIndex::searchRange(const DescriptorView& query, const int start, const int end, const int ef, int* const best_i, int* const best_d, int* const second_d) const {
+	const int words = static_cast<int>(desc.words());
+	Search s;
+	for (int i = start; i < end; ++i) {
+		int bi = -1, bd = 100000, sd = 200000;
+		if (entry >= 0 && static_cast<size_t>(ef) >= desc.size()) {
+			// ef covers the whole index, and a scan reaches even nodes that every list has dropped
+			const uint64_t* const q = query[i];
+			for (size_t id = 0; id < desc.size(); ++id) {
+				const int d = hamming(q, desc[id], words);
+				if (d < bd) {
+					sd = bd;
+					bd = d;
+					bi = static_cast<int>(id);
+				}
+				else {
+					sd = std::min(sd, d);
+				}
+			}
+		}
+		else if (entry >= 0) {
+			const uint64_t* const q = query[i];
+			s.result.assign(1, Candidate(hamming(q, desc[entry], words), static_cast<uint32_t>(entry)));
+			for (int lay = max_level; lay > 0; --lay) s.greedy(*this, q, lay, false);
+			s.layer<false>(*this, q, std::max(ef, 2), 0);
+
+			// the 2 smallest (distance, id) found, counting the twins of each
+			for (const auto& c : s.result) {
+				for (uint32_t id = c.second; id != UINT32_MAX; id = twin[id]) {
+					if (c.first < bd || (c.first == bd && static_cast<int>(id) < bi)) {
+						sd = bd;
+						bd = c.first;
+						bi = static_cast<int>(id);
+					}
+					else {
+						sd = std::min(sd, c.first);
+					}
+				}
+			}
+		}
+		best_i[i] = bi;
+		if (best_d) best_d[i] = bd;
+		if (second_d) second_d[i] = sd;
+	}
+}
+
+template <const bool multithreading>
+void koral::HNSWIndex::top2(const DescriptorView& query, const int ef, int* const __restrict best_i, int* const __restrict best_d, int* const __restrict second_d) const {
+	if (query.bits() != desc.bits()) throw std::invalid_argument("HNSWIndex: query descriptors differ in length from the index.");
+	const int num_q = static_cast<int>(query.size());
+	const int hw_concur = multithreading ? std::min(num_q >> 4, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		searchRange(query, 0, num_q, ef, best_i, best_d, second_d);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (num_q - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, &HNSWIndex::searchRange, this, std::cref(query), start, end, ef, best_i, best_d, second_d);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+template <const bool multithreading>
+void koral::HNSWIndex::match(const DescriptorView& query, int* const __restrict matches, const int threshold, const int ef) const {
+	std::vector<int> best_d(query.size()), second_d(query.size());
+	top2<multithreading>(query, ef, matches, best_d.data(), second_d.data());
+	for (size_t i = 0; i < query.size(); ++i) {
+		if (second_d[i] - best_d[i] <= static_cast<uint8_t>(threshold)) matches[i] = -1;
+	}
+}
+
+template void koral::HNSWIndex::add<true>(const DescriptorView& train);
+template void koral::HNSWIndex::add<false>(const DescriptorView& train);
+template void koral::HNSWIndex::top2<true>(const DescriptorView& query, const int ef, int* const __restrict best_i, int* const __restrict best_d, int* const __restrict second_d) const;
+template void koral::HNSWIndex::top2<false>(const DescriptorView& query, const int ef, int* const __restrict best_i, int* const __restrict best_d, int* const __restrict second_d) const;
+template void koral::HNSWIndex::match<true>(const DescriptorView& query, int* const __restrict matches, const int threshold, const int ef) const;
+template void koral::HNSWIndex::match<false>(const DescriptorView& query, int* const __restrict matches, const int threshold, const int ef) const;
@@ -0,0 +1,922 @@
+/*******************************************************************
+*   K2NN.cpp
+*   KORAL
+*******************************************************************/
+//
+// CPU brute-force 2NN matcher.
+// See K2NN.h for details.
+//
+
+#include "koral/K2NN.h"
+
+#include "koral/BitSliced.h"
+#include "koral/Hamming.h"
+#include "koral/MatchSet.h"
+#include "koral/TrainingStore.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <future>
+#include <immintrin.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+static constexpr int query_block = 64;
+static constexpr int train_tile = 512;
+
+// as CUDAK2NN: ties keep the earlier index, and also set second = best
+static inline void update(const int d, const int t, int& best_v, int& second_v, int& best_i) {
+	if (d < second_v) {
+		if (d < best_v) {
+			second_v = best_v;
+			best_v = d;
+			best_i = t;
+		}
+		else {
+			second_v = d;
+		}
+	}
+}
+
+// distances to the 4 consecutive descriptors at t, summed 128 bits at a time from the broadcast query chunks qc;
+// false, abandoning them, as soon as none of the 4 partial sums is below svv
+template <const int bits>
+static inline bool hamming4EarlyExit(const __m256i* const __restrict qc, const uint64_t* const __restrict t, const __m128i svv, __m128i& dv) {
+	constexpr int words = bits >> 6;
+	dv = _mm_setzero_si128();
+	for (int c = 0; c < (bits >> 7); ++c) {
+		const uint64_t* const p = t + (c << 1);
+		const __m256i t01 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + words)), 1);
+		const __m256i t23 = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 2 * words))), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 3 * words)), 1);
+		dv = _mm_add_epi16(dv, koral::hamming4Pairs(qc[c], t01, t23));
+		if (!(_mm_movemask_epi8(_mm_cmpgt_epi16(svv, dv)) & 0xFF)) return false;
+	}
+	return true;
+}
+
+template <const int bits, const bool early_exit>
+static void _K2NN(const uint64_t* const __restrict train, const int num_t, const uint8_t* const __restrict alive, const uint64_t* const __restrict query, const int start, const int end, int* const __restrict matches, const int threshold) {
+	constexpr int words = bits >> 6;
+	int best_v[query_block], second_v[query_block], best_i[query_block];
+	for (int qb = start; qb < end; qb += query_block) {
+		const int nq = std::min(query_block, end - qb);
+		for (int j = 0; j < nq; ++j) {
+			best_v[j] = 100000;
+			second_v[j] = 200000;
+			best_i[j] = -1;
+		}
+
+		for (int tb = 0; tb < num_t; tb += train_tile) {
+			const int tend = std::min(tb + train_tile, num_t);
+			for (int j = 0; j < nq; ++j) {
+				const uint64_t* const q = query + static_cast<size_t>(qb + j) * words;
+				__m256i qv[koral::HammingChunks<bits>::total], qc[bits >> 7];
+				if (early_exit) {
+					for (int c = 0; c < (bits >> 7); ++c) qc[c] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(q + (c << 1))));
+				}
+				else {
+					koral::hammingLoad<bits>(q, qv);
+				}
+				int bv = best_v[j], sv = second_v[j], bi = best_i[j];
+				// second best, saturated to 16 bits, in every field
+				__m128i svv = _mm_set1_epi16(static_cast<int16_t>(std::min(sv, 0x7FFF)));
+				int t = tb;
+				for (; t + 4 <= tend; t += 4) {
+					__m128i dv;
+					if (early_exit) {
+						if (!hamming4EarlyExit<bits>(qc, train + static_cast<size_t>(t) * words, svv, dv)) continue;
+					}
+					else {
+						dv = koral::hamming4<bits>(qv, train + static_cast<size_t>(t) * words);
+						// nothing to do unless one of the 4 beats the second best
+						if (!(_mm_movemask_epi8(_mm_cmpgt_epi16(svv, dv)) & 0xFF)) continue;
+					}
+					const uint64_t d = static_cast<uint64_t>(_mm_cvtsi128_si64(dv));
+					if (!alive) {
+						update(static_cast<int>(d & 0xFFFF), t, bv, sv, bi);
+						update(static_cast<int>((d >> 16) & 0xFFFF), t + 1, bv, sv, bi);
+						update(static_cast<int>((d >> 32) & 0xFFFF), t + 2, bv, sv, bi);
+						update(static_cast<int>(d >> 48), t + 3, bv, sv, bi);
+					}
+					else {
+						for (int k = 0; k < 4; ++k) {
+							if (alive[t + k]) update(static_cast<int>((d >> (k << 4)) & 0xFFFF), t + k, bv, sv, bi);
+						}
+					}
+					svv = _mm_set1_epi16(static_cast<int16_t>(std::min(sv, 0x7FFF)));
+				}
+				for (; t < tend; ++t) {
+					if (!alive || alive[t]) update(koral::hamming<bits>(q, train + static_cast<size_t>(t) * words), t, bv, sv, bi);
+				}
+				best_v[j] = bv;
+				second_v[j] = sv;
+				best_i[j] = bi;
+			}
+		}
+
+		for (int j = 0; j < nq; ++j) matches[qb + j] = second_v[j] - best_v[j] > static_cast<uint8_t>(threshold) ? best_i[j] : -1;
+	}
+}
+
+// alive, if not nullptr, marks the training descriptors that may match
+template <const bool multithreading, const int bits, const bool early_exit = false>
+static void runK2NN(const uint64_t* const __restrict train, const int num_t, const uint8_t* const __restrict alive, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold) {
+	const int hw_concur = multithreading ? std::min(num_q / query_block, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		_K2NN<bits, early_exit>(train, num_t, alive, query, 0, num_q, matches, threshold);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (num_q - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, _K2NN<bits, early_exit>, train, num_t, alive, query, start, end, matches, threshold);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+template <const bool multithreading, const int bits>
+void K2NN(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold) {
+	static_assert(bits == 128 || bits == 256 || bits == 384 || bits == 512, "K2NN supports 128, 256, 384, or 512 bits.");
+	runK2NN<multithreading, bits>(train, num_t, nullptr, query, num_q, matches, threshold);
+}
+
+template <const bool multithreading, const int bits>
+void K2NNEarlyExit(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold) {
+	static_assert(bits == 128 || bits == 256 || bits == 384 || bits == 512, "K2NNEarlyExit supports 128, 256, 384, or 512 bits.");
+	runK2NN<multithreading, bits, true>(train, num_t, nullptr, query, num_q, matches, threshold);
+}
+
+// inserts d, known to beat kd[k - 1], keeping kd ascending; ties keep the earlier index first
+static inline void insert(const int d, const int t, int* const __restrict kd, int* const __restrict ki, const int k) {
+	int p = k - 1;
+	for (; p > 0 && kd[p - 1] > d; --p) {
+		kd[p] = kd[p - 1];
+		ki[p] = ki[p - 1];
+	}
+	kd[p] = d;
+	ki[p] = t;
+}
+
+template <const int bits>
+static void _KNN(const uint64_t* const __restrict train, const int num_t, const uint8_t* const __restrict alive, const uint64_t* const __restrict query, const int start, const int end, const int k, koral::MatchSet* const out) {
+	constexpr int words = bits >> 6;
+	int kd[query_block][koral::MatchSet::max_k], ki[query_block][koral::MatchSet::max_k];
+	for (int qb = start; qb < end; qb += query_block) {
+		const int nq = std::min(query_block, end - qb);
+		for (int j = 0; j < nq; ++j) {
+			for (int i = 0; i < k; ++i) {
+				kd[j][i] = 0xFFFF;
+				ki[j][i] = -1;
+			}
+		}
+
+		for (int tb = 0; tb < num_t; tb += train_tile) {
+			const int tend = std::min(tb + train_tile, num_t);
+			for (int j = 0; j < nq; ++j) {
+				const uint64_t* const q = query + static_cast<size_t>(qb + j) * words;
+				__m256i qv[koral::HammingChunks<bits>::total];
+				koral::hammingLoad<bits>(q, qv);
+				int* const d_j = kd[j];
+				int* const i_j = ki[j];
+				// k-th best, saturated to 16 bits, in every field
+				__m128i worst = _mm_set1_epi16(static_cast<int16_t>(std::min(d_j[k - 1], 0x7FFF)));
+				int t = tb;
+				for (; t + 4 <= tend; t += 4) {
+					const __m128i dv = koral::hamming4<bits>(qv, train + static_cast<size_t>(t) * words);
+					if (!(_mm_movemask_epi8(_mm_cmpgt_epi16(worst, dv)) & 0xFF)) continue;
+					const uint64_t d = static_cast<uint64_t>(_mm_cvtsi128_si64(dv));
+					for (int i = 0; i < 4; ++i) {
+						const int di = static_cast<int>((d >> (i << 4)) & 0xFFFF);
+						if (di < d_j[k - 1] && (!alive || alive[t + i])) insert(di, t + i, d_j, i_j, k);
+					}
+					worst = _mm_set1_epi16(static_cast<int16_t>(std::min(d_j[k - 1], 0x7FFF)));
+				}
+				for (; t < tend; ++t) {
+					if (alive && !alive[t]) continue;
+					const int d = koral::hamming<bits>(q, train + static_cast<size_t>(t) * words);
+					if (d < d_j[k - 1]) insert(d, t, d_j, i_j, k);
+				}
+			}
+		}
+
+		for (int j = 0; j < nq; ++j) {
+			int32_t* const oi = out->indices(qb + j);
+			uint16_t* const od = out->distances(qb + j);
+			int found = 0;
+			for (int i = 0; i < k; ++i) {
+				oi[i] = ki[j][i];
+				od[i] = static_cast<uint16_t>(kd[j][i]);
+				found += ki[j][i] >= 0;
+			}
+			out->setCount(qb + j, found);
+		}
+	}
+}
+
+template <const bool multithreading, const int bits>
+static void runKNN(const uint64_t* const __restrict train, const int num_t, const uint8_t* const __restrict alive, const uint64_t* const __restrict query, const int num_q, const int k, koral::MatchSet& matches) {
+	matches.resize(num_q, k);
+	const int hw_concur = multithreading ? std::min(num_q / query_block, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		_KNN<bits>(train, num_t, alive, query, 0, num_q, k, &matches);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (num_q - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, _KNN<bits>, train, num_t, alive, query, start, end, k, &matches);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+template <const bool multithreading, const int bits>
+void KNN(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int k, koral::MatchSet& matches) {
+	static_assert(bits == 128 || bits == 256 || bits == 384 || bits == 512, "KNN supports 128, 256, 384, or 512 bits.");
+	runKNN<multithreading, bits>(train, num_t, nullptr, query, num_q, k, matches);
+}
+
+template <const int bits>
+static void _K2NNImages(const uint64_t* const __restrict train, const uint32_t* const __restrict offsets, const int num_images, const uint64_t* const __restrict query, const int start, const int end, koral::ImageMatchSet* const out) {
+	constexpr int words = bits >> 6;
+	const int num_t = static_cast<int>(offsets[num_images]);
+	// per image, then per query of the block
+	std::vector<int> best_v(static_cast<size_t>(query_block) * num_images), second_v(best_v.size()), best_i(best_v.size());
+	for (int qb = start; qb < end; qb += query_block) {
+		const int nq = std::min(query_block, end - qb);
+		std::fill(best_v.begin(), best_v.end(), 100000);
+		std::fill(second_v.begin(), second_v.end(), 200000);
+		std::fill(best_i.begin(), best_i.end(), -1);
+
+		for (int tb = 0; tb < num_t; tb += train_tile) {
+			const int tend = std::min(tb + train_tile, num_t);
+			// the tile splits into runs of one image each; the image holding tb is the last one starting at or before it
+			int img = static_cast<int>(std::upper_bound(offsets, offsets + num_images + 1, static_cast<uint32_t>(tb)) - offsets) - 1;
+			for (int seg = tb; seg < tend; ++img) {
+				const int seg_end = std::min(static_cast<int>(offsets[img + 1]), tend);
+				if (seg_end <= seg) continue;
+				int* const __restrict img_bv = &best_v[static_cast<size_t>(img) * query_block];
+				int* const __restrict img_sv = &second_v[static_cast<size_t>(img) * query_block];
+				int* const __restrict img_bi = &best_i[static_cast<size_t>(img) * query_block];
+				for (int j = 0; j < nq; ++j) {
+					const uint64_t* const q = query + static_cast<size_t>(qb + j) * words;
+					__m256i qv[koral::HammingChunks<bits>::total];
+					koral::hammingLoad<bits>(q, qv);
+					int bv = img_bv[j], sv = img_sv[j], bi = img_bi[j];
+					__m128i svv = _mm_set1_epi16(static_cast<int16_t>(std::min(sv, 0x7FFF)));
+					int t = seg;
+					for (; t + 4 <= seg_end; t += 4) {
+						const __m128i dv = koral::hamming4<bits>(qv, train + static_cast<size_t>(t) * words);
+						if (!(_mm_movemask_epi8(_mm_cmpgt_epi16(svv, dv)) & 0xFF)) continue;
+						const uint64_t d = static_cast<uint64_t>(_mm_cvtsi128_si64(dv));
+						update(static_cast<int>(d & 0xFFFF), t, bv, sv, bi);
+						update(static_cast<int>((d >> 16) & 0xFFFF), t + 1, bv, sv, bi);
+						update(static_cast<int>((d >> 32) & 0xFFFF), t + 2, bv, sv, bi);
+						update(static_cast<int>(d >> 48), t + 3, bv, sv, bi);
+						svv = _mm_set1_epi16(static_cast<int16_t>(std::min(sv, 0x7FFF)));
+					}
+					for (; t < seg_end; ++t) update(koral::hamming<bits>(q, train + static_cast<size_t>(t) * words), t, bv, sv, bi);
+					img_bv[j] = bv;
+					img_sv[j] = sv;
+					img_bi[j] = bi;
+				}
+				seg = seg_end;
+			}
+		}
+
+		for (int j = 0; j < nq; ++j) {
+			const size_t o = static_cast<size_t>(qb + j) * num_images;
+			for (int i = 0; i < num_images; ++i) {
+				const size_t s = static_cast<size_t>(i) * query_block + j;
+				out->best_i[o + i] = best_i[s];
+				out->best_d[o + i] = best_v[s];
+				out->second_d[o + i] = second_v[s];
+			}
+		}
+	}
+}
+
+template <const bool multithreading, const int bits>
+void K2NNImages(const uint64_t* const __restrict train, const uint32_t* const __restrict offsets, const int num_images, const uint64_t* const __restrict query, const int num_q, const int threshold, koral::ImageMatchSet& matches) {
+	static_assert(bits == 128 || bits == 256 || bits == 384 || bits == 512, "K2NNImages supports 128, 256, 384, or 512 bits.");
+	if (num_images < 0 || offsets[0] != 0) throw std::invalid_argument("K2NNImages: image offsets must start at 0.");
+	for (int i = 0; i < num_images; ++i) {
+		if (offsets[i + 1] < offsets[i]) throw std::invalid_argument("K2NNImages: image offsets must not decrease.");
+	}
+	matches.resize(num_q, num_images);
+	const int hw_concur = multithreading ? std::min(num_q / query_block, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		_K2NNImages<bits>(train, offsets, num_images, query, 0, num_q, &matches);
+	}
+	else {
+		std::vector<std::future<void>> fut(hw_concur);
+		int start = 0;
+		for (int i = 0; i < hw_concur; ++i) {
+			const int end = start + (num_q - start) / (hw_concur - i);
+			fut[i] = std::async(std::launch::async, _K2NNImages<bits>, train, offsets, num_images, query, start, end, &matches);
+			start = end;
+		}
+		for (auto& f : fut) f.wait();
+	}
+
+	// per-image lists of the matches passing the threshold, ascending by query
+	const size_t n = static_cast<size_t>(num_q) * num_images;
+	auto passes = [&](const size_t s) { return matches.best_i[s] >= 0 && matches.second_d[s] - matches.best_d[s] > static_cast<uint8_t>(threshold); };
+	for (size_t s = 0; s < n; ++s) matches.starts[s % num_images + 1] += passes(s);
+	for (int i = 0; i < num_images; ++i) matches.starts[i + 1] += matches.starts[i];
+	matches.match_q.resize(matches.starts[num_images]);
+	matches.match_t.resize(matches.starts[num_images]);
+	std::vector<uint32_t> fill(matches.starts.begin(), matches.starts.end() - 1);
+	for (int q = 0; q < num_q; ++q) {
+		for (int i = 0; i < num_images; ++i) {
+			const size_t s = static_cast<size_t>(q) * num_images + i;
+			if (!passes(s)) continue;
+			matches.match_q[fill[i]] = q;
+			matches.match_t[fill[i]++] = matches.best_i[s];
+		}
+	}
+}
+
+// appends the results of queries start to end - 1 to idx and dist, and their counts to counts[start + 1] onward
+template <const int bits>
+static void _RadiusMatch(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int start, const int end, const int radius, const int max_results, uint32_t* const __restrict counts, std::vector<int32_t>* const idx, std::vector<uint16_t>* const dist) {
+	constexpr int words = bits >> 6;
+	// the first 256 bits, then the rest only if one of 4 is still within the limit
+	constexpr int first = bits > 256 ? 256 : bits;
+	constexpr int rest = bits - first;
+	// without max_results, every result of the block as (query in block, distance, training index), so sorting orders them.
+	// With it, each query keeps a max-heap of its nearest max_results as (distance, training index); once the heap is
+	// full, the limit drops to the worst distance kept, as training indices only increase and so lose ties.
+	const bool capped = max_results > 0;
+	std::vector<uint64_t> found;
+	std::vector<uint64_t> heaps(capped ? static_cast<size_t>(query_block) * max_results : 0);
+	int heap_n[query_block];
+	for (int qb = start; qb < end; qb += query_block) {
+		const int nq = std::min(query_block, end - qb);
+		found.clear();
+		std::fill(heap_n, heap_n + nq, 0);
+
+		for (int tb = 0; tb < num_t; tb += train_tile) {
+			const int tend = std::min(tb + train_tile, num_t);
+			for (int j = 0; j < nq; ++j) {
+				const uint64_t* const q = query + static_cast<size_t>(qb + j) * words;
+				__m256i qa[koral::HammingChunks<first>::total], qr[koral::HammingChunks<rest ? rest : 128>::total];
+				koral::hammingLoad<first>(q, qa);
+				if (rest) koral::hammingLoad<rest ? rest : 128>(q + (first >> 6), qr);
+				const uint64_t key = static_cast<uint64_t>(j) << 42;
+				uint64_t* const heap = capped ? &heaps[static_cast<size_t>(j) * max_results] : nullptr;
+				int& hn = heap_n[j];
+				// distances below limit are kept
+				int limit = capped && hn == max_results ? static_cast<int>(heap[0] >> 32) : std::min(radius, 0x7FFE) + 1;
+				__m128i limit_v = _mm_set1_epi16(static_cast<int16_t>(limit));
+				auto keep = [&](const int d, const int t) {
+					if (!capped) {
+						found.push_back(key | (static_cast<uint64_t>(d) << 32) | static_cast<uint64_t>(t));
+						return;
+					}
+					if (hn == max_results) {
+						std::pop_heap(heap, heap + hn);
+						--hn;
+					}
+					heap[hn++] = (static_cast<uint64_t>(d) << 32) | static_cast<uint64_t>(t);
+					std::push_heap(heap, heap + hn);
+					if (hn == max_results) {
+						limit = static_cast<int>(heap[0] >> 32);
+						limit_v = _mm_set1_epi16(static_cast<int16_t>(limit));
+					}
+				};
+				int t = tb;
+				for (; t + 4 <= tend; t += 4) {
+					const uint64_t* const t0 = train + static_cast<size_t>(t) * words;
+					__m128i dv = koral::hamming4<first>(qa, t0, t0 + words, t0 + 2 * words, t0 + 3 * words);
+					if (!(_mm_movemask_epi8(_mm_cmplt_epi16(dv, limit_v)) & 0xFF)) continue;
+					if (rest) {
+						dv = _mm_add_epi16(dv, koral::hamming4<rest ? rest : 128>(qr, t0 + (first >> 6), t0 + words + (first >> 6), t0 + 2 * words + (first >> 6), t0 + 3 * words + (first >> 6)));
+						if (!(_mm_movemask_epi8(_mm_cmplt_epi16(dv, limit_v)) & 0xFF)) continue;
+					}
+					// the limit can drop between lanes
+					const uint64_t d = static_cast<uint64_t>(_mm_cvtsi128_si64(dv));
+					for (int k = 0; k < 4; ++k) {
+						const int dk = static_cast<int>((d >> (k << 4)) & 0xFFFF);
+						if (dk < limit) keep(dk, t + k);
+					}
+				}
+				for (; t < tend; ++t) {
+					const int d = koral::hamming<bits>(q, train + static_cast<size_t>(t) * words);
+					if (d < limit) keep(d, t);
+				}
+			}
+		}
+
+		if (capped) {
+			for (int j = 0; j < nq; ++j) {
+				uint64_t* const heap = &heaps[static_cast<size_t>(j) * max_results];
+				std::sort_heap(heap, heap + heap_n[j]);
+				counts[qb + j + 1] = static_cast<uint32_t>(heap_n[j]);
+				for (int i = 0; i < heap_n[j]; ++i) {
+					idx->push_back(static_cast<int32_t>(heap[i] & 0xFFFFFFFF));
+					dist->push_back(static_cast<uint16_t>(heap[i] >> 32));
+				}
+			}
+			continue;
+		}
+		std::sort(found.begin(), found.end());
+		std::fill(counts + qb + 1, counts + qb + nq + 1, 0);
+		for (const uint64_t f : found) {
+			++counts[qb + static_cast<int>(f >> 42) + 1];
+			idx->push_back(static_cast<int32_t>(f & 0xFFFFFFFF));
+			dist->push_back(static_cast<uint16_t>((f >> 32) & 0x3FF));
+		}
+	}
+}
+
+template <const bool multithreading, const int bits>
+void RadiusMatch(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int radius, koral::RadiusMatchSet& matches, const int max_results) {
+	static_assert(bits == 128 || bits == 256 || bits == 384 || bits == 512, "RadiusMatch supports 128, 256, 384, or 512 bits.");
+	if (radius < 0) throw std::invalid_argument("RadiusMatch: radius must not be negative.");
+	if (max_results < 0) throw std::invalid_argument("RadiusMatch: max_results must not be negative.");
+	matches.starts.resize(num_q + 1);
+	matches.starts[0] = 0;
+	matches.idx.clear();
+	matches.dist.clear();
+	const int hw_concur = multithreading ? std::min(num_q / query_block, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		_RadiusMatch<bits>(train, num_t, query, 0, num_q, radius, max_results, matches.starts.data(), &matches.idx, &matches.dist);
+	}
+	else {
+		// the first thread writes into matches directly, the others into their own columns, appended in query order
+		std::vector<std::vector<int32_t>> idx(hw_concur - 1);
+		std::vector<std::vector<uint16_t>> dist(hw_concur - 1);
+		std::vector<std::future<void>> fut(hw_concur);
+		int start = 0;
+		for (int i = 0; i < hw_concur; ++i) {
+			const int end = start + (num_q - start) / (hw_concur - i);
+			fut[i] = std::async(std::launch::async, _RadiusMatch<bits>, train, num_t, query, start, end, radius, max_results, matches.starts.data(), i ? &idx[i - 1] : &matches.idx, i ? &dist[i - 1] : &matches.dist);
+			start = end;
+		}
+		for (auto& f : fut) f.wait();
+		for (int i = 0; i < hw_concur - 1; ++i) {
+			matches.idx.insert(matches.idx.end(), idx[i].begin(), idx[i].end());
+			matches.dist.insert(matches.dist.end(), dist[i].begin(), dist[i].end());
+		}
+	}
+	for (int q = 0; q < num_q; ++q) matches.starts[q + 1] += matches.starts[q];
+}
+
+// a + b + c as bits (h, l)
+static inline void csa(__m256i& h, __m256i& l, const __m256i a, const __m256i b, const __m256i c) {
+	const __m256i u = _mm256_xor_si256(a, b);
+	h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+	l = _mm256_xor_si256(u, c);
+}
+
+static constexpr int sliced_query_block = 16;
+
+template <const int bits>
+static void _K2NNSliced(const koral::BitSlicedSet* const train, const uint64_t* const __restrict query, const int start, const int end, int* const __restrict matches, const int threshold) {
+	constexpr int words = bits >> 6;
+	// distances need 4 bits below the sixteens and enough above for bits / 16 of them
+	constexpr int high = bits == 512 ? 6 : bits == 128 ? 4 : 5;
+	constexpr int dbits = 4 + high;
+	const int num_t = static_cast<int>(train->size());
+	const int num_blocks = static_cast<int>(train->blocks());
+	// per query of the block, 0 or -1 for each bit, for broadcasting
+	std::vector<int32_t> qmask(static_cast<size_t>(sliced_query_block) * bits);
+	int best_v[sliced_query_block], second_v[sliced_query_block], best_i[sliced_query_block];
+	alignas(32) uint64_t dp[dbits][4];
+	alignas(32) uint64_t lt[4];
+	for (int qb = start; qb < end; qb += sliced_query_block) {
+		const int nq = std::min(sliced_query_block, end - qb);
+		for (int j = 0; j < nq; ++j) {
+			const uint64_t* const q = query + static_cast<size_t>(qb + j) * words;
+			for (int b = 0; b < bits; ++b) qmask[j * bits + b] = -static_cast<int32_t>((q[b >> 6] >> (b & 63)) & 1);
+			best_v[j] = 100000;
+			second_v[j] = 200000;
+			best_i[j] = -1;
+		}
+
+		for (int k = 0; k < num_blocks; ++k) {
+			const uint64_t* const planes = train->plane(k, 0);
+			// lanes holding descriptors
+			const int valid = std::min(koral::BitSlicedSet::block, num_t - k * koral::BitSlicedSet::block);
+			alignas(32) uint64_t vm[4];
+			for (int w = 0; w < 4; ++w) vm[w] = valid >= (w + 1) << 6 ? ~uint64_t(0) : valid <= w << 6 ? 0 : (uint64_t(1) << (valid - (w << 6))) - 1;
+			const __m256i valid_v = _mm256_load_si256(reinterpret_cast<const __m256i*>(vm));
+			for (int j = 0; j < nq; ++j) {
+				const int32_t* const m = &qmask[j * bits];
+				__m256i d[dbits];
+				for (int i = 0; i < dbits; ++i) d[i] = _mm256_setzero_si256();
+				// Harley-Seal: ones, twos, fours, eights in d[0..3], and the count of sixteens in d[4..]
+				for (int b = 0; b < bits; b += 16) {
+					const uint64_t* const p = planes + (b << 2);
+					auto in = [&](const int i) { return _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + (i << 2))), _mm256_set1_epi32(m[b + i])); };
+					__m256i twos_a, twos_b, fours_a, fours_b, eights_a, eights_b, sixteens;
+					csa(twos_a, d[0], d[0], in(0), in(1));
+					csa(twos_b, d[0], d[0], in(2), in(3));
+					csa(fours_a, d[1], d[1], twos_a, twos_b);
+					csa(twos_a, d[0], d[0], in(4), in(5));
+					csa(twos_b, d[0], d[0], in(6), in(7));
+					csa(fours_b, d[1], d[1], twos_a, twos_b);
+					csa(eights_a, d[2], d[2], fours_a, fours_b);
+					csa(twos_a, d[0], d[0], in(8), in(9));
+					csa(twos_b, d[0], d[0], in(10), in(11));
+					csa(fours_a, d[1], d[1], twos_a, twos_b);
+					csa(twos_a, d[0], d[0], in(12), in(13));
+					csa(twos_b, d[0], d[0], in(14), in(15));
+					csa(fours_b, d[1], d[1], twos_a, twos_b);
+					csa(eights_b, d[2], d[2], fours_a, fours_b);
+					csa(sixteens, d[3], d[3], eights_a, eights_b);
+					for (int i = 4; i < dbits; ++i) {
+						const __m256i c = _mm256_and_si256(d[i], sixteens);
+						d[i] = _mm256_xor_si256(d[i], sixteens);
+						sixteens = c;
+					}
+				}
+
+				// lanes below the second best, compared from the top bit down
+				const int sv = second_v[j];
+				__m256i below = valid_v;
+				if (sv <= bits) {
+					__m256i less = _mm256_setzero_si256(), equal = valid_v;
+					for (int i = dbits - 1; i >= 0; --i) {
+						if ((sv >> i) & 1) {
+							less = _mm256_or_si256(less, _mm256_andnot_si256(d[i], equal));
+							equal = _mm256_and_si256(equal, d[i]);
+						}
+						else {
+							equal = _mm256_andnot_si256(d[i], equal);
+						}
+					}
+					below = less;
+				}
+				if (_mm256_testz_si256(below, below)) continue;
+
+				// rare: read those distances out, in lane order so ties keep the earlier index
+				_mm256_store_si256(reinterpret_cast<__m256i*>(lt), below);
+				for (int i = 0; i < dbits; ++i) _mm256_store_si256(reinterpret_cast<__m256i*>(dp[i]), d[i]);
+				int bv = best_v[j], sv2 = second_v[j], bi = best_i[j];
+				for (int w = 0; w < 4; ++w) {
+					for (uint64_t l = lt[w]; l; l &= l - 1) {
+						const int lane = static_cast<int>(_tzcnt_u64(l));
+						int dist = 0;
+						for (int i = 0; i < dbits; ++i) dist |= static_cast<int>((dp[i][w] >> lane) & 1) << i;
+						update(dist, k * koral::BitSlicedSet::block + (w << 6) + lane, bv, sv2, bi);
+					}
+				}
+				best_v[j] = bv;
+				second_v[j] = sv2;
+				best_i[j] = bi;
+			}
+		}
+
+		for (int j = 0; j < nq; ++j) matches[qb + j] = second_v[j] - best_v[j] > static_cast<uint8_t>(threshold) ? best_i[j] : -1;
+	}
+}
+
+template <const bool multithreading, const int bits>
+static void runK2NNSliced(const koral::BitSlicedSet& train, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold) {
+	const int hw_concur = multithreading ? std::min(num_q / query_block, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		_K2NNSliced<bits>(&train, query, 0, num_q, matches, threshold);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (num_q - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, _K2NNSliced<bits>, &train, query, start, end, matches, threshold);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+// per-training-descriptor best query, best and second-best distances, from one range of queries
+struct TrainBest {
+	std::vector<int> best_v, second_v, best_i;
+	// second_v saturated to 16 bits, for vector compares
+	std::vector<int16_t> second16;
+
+	explicit TrainBest(const int num_t) : best_v(num_t, 100000), second_v(num_t, 200000), best_i(num_t, -1), second16(num_t + 4, 0x7FFF) {}
+};
+
+template <const int bits>
+static void _K2NNMutual(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int start, const int end, int* const __restrict matches, const int threshold, TrainBest* const tr) {
+	constexpr int words = bits >> 6;
+	int best_v[query_block], second_v[query_block], best_i[query_block];
+	int* const __restrict tbv = tr->best_v.data();
+	int* const __restrict tsv = tr->second_v.data();
+	int* const __restrict tbi = tr->best_i.data();
+	int16_t* const __restrict ts16 = tr->second16.data();
+	auto trainUpdate = [&](const int d, const int t, const int q) {
+		update(d, q, tbv[t], tsv[t], tbi[t]);
+		ts16[t] = static_cast<int16_t>(std::min(tsv[t], 0x7FFF));
+	};
+
+	for (int qb = start; qb < end; qb += query_block) {
+		const int nq = std::min(query_block, end - qb);
+		for (int j = 0; j < nq; ++j) {
+			best_v[j] = 100000;
+			second_v[j] = 200000;
+			best_i[j] = -1;
+		}
+
+		for (int tb = 0; tb < num_t; tb += train_tile) {
+			const int tend = std::min(tb + train_tile, num_t);
+			// queries ascend within a thread, so ties on the training side also keep the earlier index
+			for (int j = 0; j < nq; ++j) {
+				const int qi = qb + j;
+				const uint64_t* const q = query + static_cast<size_t>(qi) * words;
+				__m256i qv[koral::HammingChunks<bits>::total];
+				koral::hammingLoad<bits>(q, qv);
+				int bv = best_v[j], sv = second_v[j], bi = best_i[j];
+				__m128i svv = _mm_set1_epi16(static_cast<int16_t>(std::min(sv, 0x7FFF)));
+				int t = tb;
+				for (; t + 4 <= tend; t += 4) {
+					const __m128i dv = koral::hamming4<bits>(qv, train + static_cast<size_t>(t) * words);
+					// nothing to do unless one of the 4 beats the query's second best or its own
+					const __m128i tsvv = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(ts16 + t));
+					const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi16(svv, dv), _mm_cmpgt_epi16(tsvv, dv))) & 0xFF;
+					if (!mask) continue;
+					const uint64_t d = static_cast<uint64_t>(_mm_cvtsi128_si64(dv));
+					for (int k = 0; k < 4; ++k) {
+						const int dk = static_cast<int>((d >> (k << 4)) & 0xFFFF);
+						update(dk, t + k, bv, sv, bi);
+						if (dk < tsv[t + k]) trainUpdate(dk, t + k, qi);
+					}
+					svv = _mm_set1_epi16(static_cast<int16_t>(std::min(sv, 0x7FFF)));
+				}
+				for (; t < tend; ++t) {
+					const int d = koral::hamming<bits>(q, train + static_cast<size_t>(t) * words);
+					update(d, t, bv, sv, bi);
+					if (d < tsv[t]) trainUpdate(d, t, qi);
+				}
+				best_v[j] = bv;
+				second_v[j] = sv;
+				best_i[j] = bi;
+			}
+		}
+
+		for (int j = 0; j < nq; ++j) matches[qb + j] = second_v[j] - best_v[j] > static_cast<uint8_t>(threshold) ? best_i[j] : -1;
+	}
+}
+
+template <const bool multithreading, const int bits>
+void K2NNMutual(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold) {
+	static_assert(bits == 128 || bits == 256 || bits == 384 || bits == 512, "K2NNMutual supports 128, 256, 384, or 512 bits.");
+	const int hw_concur = std::max(multithreading ? std::min(num_q / query_block, static_cast<int>(std::thread::hardware_concurrency())) : 1, 1);
+	std::vector<TrainBest> tr(hw_concur, TrainBest(num_t));
+	if (hw_concur == 1) {
+		_K2NNMutual<bits>(train, num_t, query, 0, num_q, matches, threshold, &tr[0]);
+	}
+	else {
+		std::vector<std::future<void>> fut(hw_concur);
+		int start = 0;
+		for (int i = 0; i < hw_concur; ++i) {
+			const int end = start + (num_q - start) / (hw_concur - i);
+			fut[i] = std::async(std::launch::async, _K2NNMutual<bits>, train, num_t, query, start, end, matches, threshold, &tr[i]);
+			start = end;
+		}
+		for (auto& f : fut) f.wait();
+
+		// merge in query order: a later thread's best replaces only a strictly smaller distance
+		for (int i = 1; i < hw_concur; ++i) {
+			for (int t = 0; t < num_t; ++t) {
+				int& bv = tr[0].best_v[t];
+				int& sv = tr[0].second_v[t];
+				if (tr[i].best_v[t] < bv) {
+					sv = std::min(bv, tr[i].second_v[t]);
+					bv = tr[i].best_v[t];
+					tr[0].best_i[t] = tr[i].best_i[t];
+				}
+				else {
+					sv = std::min(sv, tr[i].best_v[t]);
+				}
+			}
+		}
+	}
+
+	const TrainBest& t0 = tr[0];
+	for (int q = 0; q < num_q; ++q) {
+		const int t = matches[q];
+		if (t >= 0 && (t0.best_i[t] != q || t0.second_v[t] - t0.best_v[t] <= static_cast<uint8_t>(threshold))) matches[q] = -1;
+	}
+}
+
+template <const bool multithreading>
+void K2NN(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold) {
+	if (train.bits() != query.bits()) throw std::invalid_argument("K2NN: training and query descriptors differ in length.");
+	const int num_t = static_cast<int>(train.size()), num_q = static_cast<int>(query.size());
+	switch (train.bits()) {
+	case 128: K2NN<multithreading, 128>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	case 256: K2NN<multithreading, 256>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	case 384: K2NN<multithreading, 384>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	default:  K2NN<multithreading, 512>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	}
+}
+
+template <const bool multithreading>
+void K2NNEarlyExit(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold) {
+	if (train.bits() != query.bits()) throw std::invalid_argument("K2NNEarlyExit: training and query descriptors differ in length.");
+	const int num_t = static_cast<int>(train.size()), num_q = static_cast<int>(query.size());
+	switch (train.bits()) {
+	case 128: K2NNEarlyExit<multithreading, 128>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	case 256: K2NNEarlyExit<multithreading, 256>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	case 384: K2NNEarlyExit<multithreading, 384>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	default:  K2NNEarlyExit<multithreading, 512>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	}
+}
+
+template <const bool multithreading>
+void K2NNMutual(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold) {
+	if (train.bits() != query.bits()) throw std::invalid_argument("K2NNMutual: training and query descriptors differ in length.");
+	const int num_t = static_cast<int>(train.size()), num_q = static_cast<int>(query.size());
+	switch (train.bits()) {
+	case 128: K2NNMutual<multithreading, 128>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	case 256: K2NNMutual<multithreading, 256>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	case 384: K2NNMutual<multithreading, 384>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	default:  K2NNMutual<multithreading, 512>(train.data(), num_t, query.data(), num_q, matches, threshold); break;
+	}
+}
+
+template <const bool multithreading>
+void KNN(const koral::DescriptorView& train, const koral::DescriptorView& query, const int k, koral::MatchSet& matches) {
+	if (train.bits() != query.bits()) throw std::invalid_argument("KNN: training and query descriptors differ in length.");
+	const int num_t = static_cast<int>(train.size()), num_q = static_cast<int>(query.size());
+	switch (train.bits()) {
+	case 128: KNN<multithreading, 128>(train.data(), num_t, query.data(), num_q, k, matches); break;
+	case 256: KNN<multithreading, 256>(train.data(), num_t, query.data(), num_q, k, matches); break;
+	case 384: KNN<multithreading, 384>(train.data(), num_t, query.data(), num_q, k, matches); break;
+	default:  KNN<multithreading, 512>(train.data(), num_t, query.data(), num_q, k, matches); break;
+	}
+}
+
+template <const bool multithreading>
+void K2NNImages(const koral::DescriptorView& train, const std::vector<uint32_t>& offsets, const koral::DescriptorView& query, const int threshold, koral::ImageMatchSet& matches) {
+	if (train.bits() != query.bits()) throw std::invalid_argument("K2NNImages: training and query descriptors differ in length.");
+	if (offsets.empty() || offsets.back() != train.size()) throw std::invalid_argument("K2NNImages: image offsets must end at the number of training descriptors.");
+	const int num_images = static_cast<int>(offsets.size()) - 1, num_q = static_cast<int>(query.size());
+	switch (train.bits()) {
+	case 128: K2NNImages<multithreading, 128>(train.data(), offsets.data(), num_images, query.data(), num_q, threshold, matches); break;
+	case 256: K2NNImages<multithreading, 256>(train.data(), offsets.data(), num_images, query.data(), num_q, threshold, matches); break;
+	case 384: K2NNImages<multithreading, 384>(train.data(), offsets.data(), num_images, query.data(), num_q, threshold, matches); break;
+	default:  K2NNImages<multithreading, 512>(train.data(), offsets.data(), num_images, query.data(), num_q, threshold, matches); break;
+	}
+}
+
+template <const bool multithreading>
+void RadiusMatch(const koral::DescriptorView& train, const koral::DescriptorView& query, const int radius, koral::RadiusMatchSet& matches, const int max_results) {
+	if (train.bits() != query.bits()) throw std::invalid_argument("RadiusMatch: training and query descriptors differ in length.");
+	const int num_t = static_cast<int>(train.size()), num_q = static_cast<int>(query.size());
+	switch (train.bits()) {
+	case 128: RadiusMatch<multithreading, 128>(train.data(), num_t, query.data(), num_q, radius, matches, max_results); break;
+	case 256: RadiusMatch<multithreading, 256>(train.data(), num_t, query.data(), num_q, radius, matches, max_results); break;
+	case 384: RadiusMatch<multithreading, 384>(train.data(), num_t, query.data(), num_q, radius, matches, max_results); break;
+	default:  RadiusMatch<multithreading, 512>(train.data(), num_t, query.data(), num_q, radius, matches, max_results); break;
+	}
+}
+
+template <const bool multithreading>
+void K2NN(const koral::TrainingStore& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold) {
+	if (train.bits() != query.bits()) throw std::invalid_argument("K2NN: training and query descriptors differ in length.");
+	const koral::DescriptorView t = train.view();
+	const int num_t = static_cast<int>(t.size()), num_q = static_cast<int>(query.size());
+	const uint8_t* const alive = train.aliveMask();
+	switch (t.bits()) {
+	case 128: runK2NN<multithreading, 128>(t.data(), num_t, alive, query.data(), num_q, matches, threshold); break;
+	case 256: runK2NN<multithreading, 256>(t.data(), num_t, alive, query.data(), num_q, matches, threshold); break;
+	case 384: runK2NN<multithreading, 384>(t.data(), num_t, alive, query.data(), num_q, matches, threshold); break;
+	default:  runK2NN<multithreading, 512>(t.data(), num_t, alive, query.data(), num_q, matches, threshold); break;
+	}
+	const uint32_t* const ids = train.slotIds();
+	for (int i = 0; i < num_q; ++i) {
+		if (matches[i] >= 0) matches[i] = static_cast<int>(ids[matches[i]]);
+	}
+}
+
+template <const bool multithreading>
+void KNN(const koral::TrainingStore& train, const koral::DescriptorView& query, const int k, koral::MatchSet& matches) {
+	if (train.bits() != query.bits()) throw std::invalid_argument("KNN: training and query descriptors differ in length.");
+	const koral::DescriptorView t = train.view();
+	const int num_t = static_cast<int>(t.size()), num_q = static_cast<int>(query.size());
+	const uint8_t* const alive = train.aliveMask();
+	switch (t.bits()) {
+	case 128: runKNN<multithreading, 128>(t.data(), num_t, alive, query.data(), num_q, k, matches); break;
+	case 256: runKNN<multithreading, 256>(t.data(), num_t, alive, query.data(), num_q, k, matches); break;
+	case 384: runKNN<multithreading, 384>(t.data(), num_t, alive, query.data(), num_q, k, matches); break;
+	default:  runKNN<multithreading, 512>(t.data(), num_t, alive, query.data(), num_q, k, matches); break;
+	}
+	const uint32_t* const ids = train.slotIds();
+	for (int i = 0; i < num_q; ++i) {
+		int32_t* const idx = matches.indices(i);
+		for (int j = 0; j < matches.count(i); ++j) idx[j] = static_cast<int32_t>(ids[idx[j]]);
+	}
+}
+
+template <const bool multithreading>
+void K2NN(const koral::BitSlicedSet& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold) {
+	if (train.bits() != query.bits()) throw std::invalid_argument("K2NN: training and query descriptors differ in length.");
+	const int num_q = static_cast<int>(query.size());
+	switch (train.bits()) {
+	case 128: runK2NNSliced<multithreading, 128>(train, query.data(), num_q, matches, threshold); break;
+	case 256: runK2NNSliced<multithreading, 256>(train, query.data(), num_q, matches, threshold); break;
+	case 384: runK2NNSliced<multithreading, 384>(train, query.data(), num_q, matches, threshold); break;
+	default:  runK2NNSliced<multithreading, 512>(train, query.data(), num_q, matches, threshold); break;
+	}
+}
+
+template <const int bits>
+void K2NNReference(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold) {
+	constexpr int words = bits >> 6;
+	for (int q = 0; q < num_q; ++q) {
+		int best_v = 100000, second_v = 200000, best_i = -1;
+		for (int t = 0; t < num_t; ++t) {
+			int d = 0;
+			for (int w = 0; w < words; ++w) d += static_cast<int>(_mm_popcnt_u64(query[static_cast<size_t>(q) * words + w] ^ train[static_cast<size_t>(t) * words + w]));
+			second_v = std::min(d, second_v);
+			if (d < best_v) {
+				second_v = best_v;
+				best_i = t;
+				best_v = d;
+			}
+		}
+		matches[q] = second_v - best_v > static_cast<uint8_t>(threshold) ? best_i : -1;
+	}
+}
+
+template void K2NN<true, 128>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NN<true, 256>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NN<true, 384>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NN<true, 512>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NN<false, 128>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NN<false, 256>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NN<false, 384>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NN<false, 512>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNReference<128>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNReference<256>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNReference<384>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNReference<512>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NN<true>(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+template void K2NN<false>(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+template void K2NNEarlyExit<true, 128>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNEarlyExit<true, 256>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNEarlyExit<true, 384>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNEarlyExit<true, 512>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNEarlyExit<false, 128>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNEarlyExit<false, 256>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNEarlyExit<false, 384>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNEarlyExit<false, 512>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNEarlyExit<true>(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+template void K2NNEarlyExit<false>(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+template void K2NNMutual<true, 128>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNMutual<true, 256>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNMutual<true, 384>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNMutual<true, 512>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNMutual<false, 128>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNMutual<false, 256>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNMutual<false, 384>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNMutual<false, 512>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, int* const __restrict matches, const int threshold);
+template void K2NNMutual<true>(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+template void K2NNMutual<false>(const koral::DescriptorView& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+template void KNN<true, 128>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int k, koral::MatchSet& matches);
+template void KNN<true, 256>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int k, koral::MatchSet& matches);
+template void KNN<true, 384>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int k, koral::MatchSet& matches);
+template void KNN<true, 512>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int k, koral::MatchSet& matches);
+template void KNN<false, 128>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int k, koral::MatchSet& matches);
+template void KNN<false, 256>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int k, koral::MatchSet& matches);
+template void KNN<false, 384>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int k, koral::MatchSet& matches);
+template void KNN<false, 512>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int k, koral::MatchSet& matches);
+template void KNN<true>(const koral::DescriptorView& train, const koral::DescriptorView& query, const int k, koral::MatchSet& matches);
+template void KNN<false>(const koral::DescriptorView& train, const koral::DescriptorView& query, const int k, koral::MatchSet& matches);
+template void K2NNImages<true, 128>(const uint64_t* const __restrict train, const uint32_t* const __restrict offsets, const int num_images, const uint64_t* const __restrict query, const int num_q, const int threshold, koral::ImageMatchSet& matches);
+template void K2NNImages<true, 256>(const uint64_t* const __restrict train, const uint32_t* const __restrict offsets, const int num_images, const uint64_t* const __restrict query, const int num_q, const int threshold, koral::ImageMatchSet& matches);
+template void K2NNImages<true, 384>(const uint64_t* const __restrict train, const uint32_t* const __restrict offsets, const int num_images, const uint64_t* const __restrict query, const int num_q, const int threshold, koral::ImageMatchSet& matches);
+template void K2NNImages<true, 512>(const uint64_t* const __restrict train, const uint32_t* const __restrict offsets, const int num_images, const uint64_t* const __restrict query, const int num_q, const int threshold, koral::ImageMatchSet& matches);
+template void K2NNImages<false, 128>(const uint64_t* const __restrict train, const uint32_t* const __restrict offsets, const int num_images, const uint64_t* const __restrict query, const int num_q, const int threshold, koral::ImageMatchSet& matches);
+template void K2NNImages<false, 256>(const uint64_t* const __restrict train, const uint32_t* const __restrict offsets, const int num_images, const uint64_t* const __restrict query, const int num_q, const int threshold, koral::ImageMatchSet& matches);
+template void K2NNImages<false, 384>(const uint64_t* const __restrict train, const uint32_t* const __restrict offsets, const int num_images, const uint64_t* const __restrict query, const int num_q, const int threshold, koral::ImageMatchSet& matches);
+template void K2NNImages<false, 512>(const uint64_t* const __restrict train, const uint32_t* const __restrict offsets, const int num_images, const uint64_t* const __restrict query, const int num_q, const int threshold, koral::ImageMatchSet& matches);
+template void K2NNImages<true>(const koral::DescriptorView& train, const std::vector<uint32_t>& offsets, const koral::DescriptorView& query, const int threshold, koral::ImageMatchSet& matches);
+template void K2NNImages<false>(const koral::DescriptorView& train, const std::vector<uint32_t>& offsets, const koral::DescriptorView& query, const int threshold, koral::ImageMatchSet& matches);
+template void K2NN<true>(const koral::TrainingStore& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+template void K2NN<false>(const koral::TrainingStore& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+template void KNN<true>(const koral::TrainingStore& train, const koral::DescriptorView& query, const int k, koral::MatchSet& matches);
+template void KNN<false>(const koral::TrainingStore& train, const koral::DescriptorView& query, const int k, koral::MatchSet& matches);
+template void RadiusMatch<true, 128>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int radius, koral::RadiusMatchSet& matches, const int max_results);
+template void RadiusMatch<true, 256>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int radius, koral::RadiusMatchSet& matches, const int max_results);
+template void RadiusMatch<true, 384>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int radius, koral::RadiusMatchSet& matches, const int max_results);
+template void RadiusMatch<true, 512>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int radius, koral::RadiusMatchSet& matches, const int max_results);
+template void RadiusMatch<false, 128>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int radius, koral::RadiusMatchSet& matches, const int max_results);
+template void RadiusMatch<false, 256>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int radius, koral::RadiusMatchSet& matches, const int max_results);
+template void RadiusMatch<false, 384>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int radius, koral::RadiusMatchSet& matches, const int max_results);
+template void RadiusMatch<false, 512>(const uint64_t* const __restrict train, const int num_t, const uint64_t* const __restrict query, const int num_q, const int radius, koral::RadiusMatchSet& matches, const int max_results);
+template void RadiusMatch<true>(const koral::DescriptorView& train, const koral::DescriptorView& query, const int radius, koral::RadiusMatchSet& matches, const int max_results);
+template void RadiusMatch<false>(const koral::DescriptorView& train, const koral::DescriptorView& query, const int radius, koral::RadiusMatchSet& matches, const int max_results);
+template void K2NN<true>(const koral::BitSlicedSet& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
+template void K2NN<false>(const koral::BitSlicedSet& train, const koral::DescriptorView& query, int* const __restrict matches, const int threshold);
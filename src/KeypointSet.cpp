@@ -0,0 +1,88 @@
+/*******************************************************************
+*   KeypointSet.cpp
+*   KORAL
+*******************************************************************/
+//
+// Vectorized passes over KeypointSet columns.
+// See KeypointSet.h for details.
+//
+
+#include "koral/KeypointSet.h"
+
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+
+void koral::KeypointSet::toLevel0(float* const __restrict x0, float* const __restrict y0) const {
+	const size_t n = size();
+	const float* const __restrict s = level_scales.data();
+	const int32_t* const __restrict px = x.data();
+	const int32_t* const __restrict py = y.data();
+	const uint8_t* const __restrict pl = level.data();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i l = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pl + i)));
+		const __m256 f = _mm256_i32gather_ps(s, l, 4);
+		_mm256_storeu_ps(x0 + i, _mm256_mul_ps(f, _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(px + i)))));
+		_mm256_storeu_ps(y0 + i, _mm256_mul_ps(f, _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(py + i)))));
+	}
+	for (; i < n; ++i) {
+		x0[i] = s[pl[i]] * static_cast<float>(px[i]);
+		y0[i] = s[pl[i]] * static_cast<float>(py[i]);
+	}
+}
+
+void koral::KeypointSet::retainBest(const size_t n) {
+	const size_t num = size();
+	if (num <= n) return;
+	if (n == 0) {
+		clear();
+		return;
+	}
+
+	// score histogram, then the cutoff is the lowest score that still fits:
+	// everything above it is kept, plus the first 'quota' keypoints at it
+	size_t hist[256] = {};
+	for (size_t i = 0; i < num; ++i) ++hist[score[i]];
+	int cutoff = 255;
+	size_t above = 0;
+	while (above + hist[cutoff] < n) above += hist[cutoff--];
+	size_t quota = n - above;
+
+	// 32 keep/tie flags per compare, then compact in place in the order of the set bits
+	const __m256i flip = _mm256_set1_epi8(static_cast<char>(0x80));
+	const __m256i c = _mm256_set1_epi8(static_cast<char>(cutoff ^ 0x80));
+	size_t out = 0;
+	for (size_t base = 0; base < num; base += 32) {
+		uint32_t gt, eq;
+		if (base + 32 <= num) {
+			const __m256i s = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(score.data() + base)), flip);
+			gt = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(s, c)));
+			eq = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(s, c)));
+		}
+		else {
+			gt = eq = 0;
+			for (size_t k = 0; base + k < num; ++k) {
+				gt |= static_cast<uint32_t>(score[base + k] > cutoff) << k;
+				eq |= static_cast<uint32_t>(score[base + k] == cutoff) << k;
+			}
+		}
+		// admit ties in order until the quota runs out
+		uint32_t ties = 0;
+		while (eq && quota) {
+			ties |= eq & (0U - eq);
+			eq &= eq - 1;
+			--quota;
+		}
+		for (uint32_t keep = gt | ties; keep; keep &= keep - 1) {
+			const size_t i = base + _tzcnt_u32(keep);
+			x[out] = x[i];
+			y[out] = y[i];
+			score[out] = score[i];
+			angle[out] = angle[i];
+			level[out] = level[i];
+			++out;
+		}
+	}
+	resize(n);
+}
@@ -0,0 +1,285 @@
+/*******************************************************************
+*   LATCH.cpp
+*   KORAL
+*******************************************************************/
+//
+// CPU implementation of the CLATCH binary descriptor.
+// See LATCH.h for details.
+//
+
+#include "koral/LATCH.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <immintrin.h>
+#include <thread>
+#include <vector>
+
+// samples the 64x64 rotated region around the keypoint into the first
+// 64 columns of the 72-column ROI, exactly as CLATCH_kernel does,
+// including the clamp at the level borders
+static inline void sampleROI(const koral::ImageLevel& level, const int32_t kx, const int32_t ky, const float angle, uint8_t* const __restrict ROI) {
+	const float s = std::sin(angle), c = std::cos(angle);
+	const int32_t xmax = level.w - 1, ymax = level.h - 1;
+	for (int32_t i = 0; i < 64; ++i) {
+		const float y_offset = static_cast<float>(i - 32);
+		for (int32_t k = 0; k < 64; ++k) {
+			const float x_offset = static_cast<float>(k - 32);
+			const int32_t x = std::min(std::max(static_cast<int32_t>((kx + (x_offset*c - y_offset*s)) + 0.5f), 0), xmax);
+			const int32_t y = std::min(std::max(static_cast<int32_t>((ky + (x_offset*s + y_offset*c)) + 0.5f), 0), ymax);
+			ROI[i * 72 + k] = level.img[y*level.stride + x];
+		}
+	}
+}
+
+koral::LATCHTables::LATCHTables(const ImageLevel* const levels, const int num_levels, const int bins) : num_bins(bins), strides(num_levels), dxy(static_cast<size_t>(bins) << 13), offs((static_cast<size_t>(num_levels) * bins) << 12) {
+	for (int b = 0; b < bins; ++b) {
+		const float angle = 6.2831853f * static_cast<float>(b) / static_cast<float>(bins);
+		const float s = std::sin(angle), c = std::cos(angle);
+		int8_t* d = &dxy[static_cast<size_t>(b) << 13];
+		for (int32_t i = 0; i < 64; ++i) {
+			const float y_offset = static_cast<float>(i - 32);
+			for (int32_t k = 0; k < 64; ++k, d += 2) {
+				const float x_offset = static_cast<float>(k - 32);
+				d[0] = static_cast<int8_t>(std::floor((x_offset*c - y_offset*s) + 0.5f));
+				d[1] = static_cast<int8_t>(std::floor((x_offset*s + y_offset*c) + 0.5f));
+			}
+		}
+	}
+	for (int l = 0; l < num_levels; ++l) {
+		strides[l] = levels[l].stride;
+		for (int b = 0; b < bins; ++b) {
+			const int8_t* d = deltas(b);
+			int32_t* o = &offs[(static_cast<size_t>(l) * bins + b) << 12];
+			for (int32_t i = 0; i < 4096; ++i) o[i] = d[(i << 1) + 1] * strides[l] + d[i << 1];
+		}
+	}
+}
+
+int koral::LATCHTables::bin(const float angle) const {
+	const int b = static_cast<int>(std::floor(angle * (static_cast<float>(num_bins) / 6.2831853f) + 0.5f)) % num_bins;
+	return b < 0 ? b + num_bins : b;
+}
+
+// rotated ROI through the pre-rotated tables. The rotated 64x64 region
+// reaches at most 47 pixels from the keypoint, and the gathers read 4 bytes per pixel,
+// so keypoints with at least 47 pixels (50 to the right) of margin take the pure gather path.
+static inline void sampleROIBinned(const koral::ImageLevel& level, const int32_t kx, const int32_t ky, const float angle, const uint8_t scale, const koral::LATCHTables& tables, uint8_t* const __restrict ROI) {
+	const int b = tables.bin(angle);
+	if (kx >= 47 && ky >= 47 && kx + 50 < level.w && ky + 47 < level.h && scale < tables.levels() && tables.stride(scale) == level.stride) {
+		const int32_t* __restrict o = tables.offsets(scale, b);
+		const int* const base = reinterpret_cast<const int*>(level.img + ky*level.stride + kx);
+		const __m256i lo = _mm256_set1_epi32(0xFF);
+		const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+		for (int32_t i = 0; i < 64; ++i) {
+			for (int32_t k = 0; k < 64; k += 32, o += 32) {
+				const __m256i g0 = _mm256_and_si256(_mm256_i32gather_epi32(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(o)), 1), lo);
+				const __m256i g1 = _mm256_and_si256(_mm256_i32gather_epi32(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(o + 8)), 1), lo);
+				const __m256i g2 = _mm256_and_si256(_mm256_i32gather_epi32(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(o + 16)), 1), lo);
+				const __m256i g3 = _mm256_and_si256(_mm256_i32gather_epi32(base, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(o + 24)), 1), lo);
+				// pack the low bytes of the 32 gathered ints back into pixel order
+				const __m256i p = _mm256_packus_epi16(_mm256_packus_epi32(g0, g1), _mm256_packus_epi32(g2, g3));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(ROI + i * 72 + k), _mm256_permutevar8x32_epi32(p, order));
+			}
+		}
+	}
+	else {
+		const int8_t* __restrict d = tables.deltas(b);
+		const int32_t xmax = level.w - 1, ymax = level.h - 1;
+		for (int32_t i = 0; i < 64; ++i) {
+			for (int32_t k = 0; k < 64; ++k, d += 2) {
+				const int32_t x = std::min(std::max(kx + d[0], 0), xmax);
+				const int32_t y = std::min(std::max(ky + d[1], 0), ymax);
+				ROI[i * 72 + k] = level.img[y*level.stride + x];
+			}
+		}
+	}
+}
+
+// axis-aligned ROI for upright mode: the rotated ROI at angle 0, but
+// each row is one contiguous 64-byte copy when the ROI is inside the level
+static inline void sampleROIUpright(const koral::ImageLevel& level, const int32_t kx, const int32_t ky, uint8_t* const __restrict ROI) {
+	if (kx >= 32 && ky >= 32 && kx + 32 <= level.w && ky + 32 <= level.h) {
+		const uint8_t* __restrict p = level.img + (ky - 32)*level.stride + (kx - 32);
+		for (int32_t i = 0; i < 64; ++i, p += level.stride) {
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(ROI + i * 72), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(ROI + i * 72 + 32), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32)));
+		}
+	}
+	else {
+		const int32_t xmax = level.w - 1, ymax = level.h - 1;
+		for (int32_t i = 0; i < 64; ++i) {
+			const uint8_t* const __restrict row = level.img + std::min(std::max(ky + i - 32, 0), ymax)*level.stride;
+			for (int32_t k = 0; k < 64; ++k) {
+				ROI[i * 72 + k] = row[std::min(std::max(kx + k - 32, 0), xmax)];
+			}
+		}
+	}
+}
+
+// two consecutive 8-pixel patch rows, widened to 16 x int16
+static inline __m256i load2rows(const uint8_t* const __restrict p) {
+	return _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + 72))));
+}
+
+// evaluates the first 'bits' triplets on a sampled ROI, 8 triplets (one output byte) at a time
+template <const int bits>
+static inline void describeROI(const uint8_t* const __restrict ROI, uint8_t* const __restrict desc) {
+	for (int32_t g = 0; g < (bits >> 3); ++g) {
+		__m256i acc[8];
+		for (int32_t j = 0; j < 8; ++j) {
+			const uint16_t* const t = triplets + (((g << 3) + j) << 2);
+			const uint8_t* pa = ROI + t[0];
+			const uint8_t* pb = ROI + t[1];
+			const uint8_t* pc = ROI + t[2];
+			__m256i sum = _mm256_setzero_si256();
+			for (int32_t r = 0; r < 8; r += 2, pa += 144, pb += 144, pc += 144) {
+				const __m256i a = load2rows(pa), b = load2rows(pb), c = load2rows(pc);
+				// (a - b)^2 - (c - b)^2 == (a - c)(a + c - 2b), and both factors fit in int16,
+				// so one madd does 16 pixels' worth of both SSDs
+				sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_sub_epi16(a, c), _mm256_sub_epi16(_mm256_add_epi16(a, c), _mm256_add_epi16(b, b))));
+			}
+			acc[j] = sum;
+		}
+
+		// transpose-reduce the 8 accumulators so that element j holds the total for triplet j
+		const __m256i h0123 = _mm256_hadd_epi32(_mm256_hadd_epi32(acc[0], acc[1]), _mm256_hadd_epi32(acc[2], acc[3]));
+		const __m256i h4567 = _mm256_hadd_epi32(_mm256_hadd_epi32(acc[4], acc[5]), _mm256_hadd_epi32(acc[6], acc[7]));
+		const __m256i sums = _mm256_add_epi32(_mm256_permute2x128_si256(h0123, h4567, 0x20), _mm256_permute2x128_si256(h0123, h4567, 0x31));
+
+		// bit is SET if the sum is negative
+		desc[g] = static_cast<uint8_t>(_mm256_movemask_ps(_mm256_castsi256_ps(sums)));
+	}
+}
+
+template <const int bits, const bool upright>
+static inline void describeKeypoint(const koral::ImageLevel* const __restrict levels, const int32_t x, const int32_t y, const float angle, const uint8_t scale, const koral::LATCHTables* const tables, uint8_t* const __restrict ROI, uint64_t* const __restrict desc) {
+	if (upright) {
+		sampleROIUpright(levels[scale], x, y, ROI);
+	}
+	else if (tables) {
+		sampleROIBinned(levels[scale], x, y, angle, scale, *tables, ROI);
+	}
+	else {
+		sampleROI(levels[scale], x, y, angle, ROI);
+	}
+	describeROI<bits>(ROI, reinterpret_cast<uint8_t*>(desc));
+}
+
+template <const int bits, const bool upright>
+static void _LATCH(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int start, const int end, uint64_t* const __restrict desc, const koral::LATCHTables* const tables) {
+	alignas(32) uint8_t ROI[4608];
+	for (int i = start; i < end; ++i) {
+		const koral::Keypoint& kp = kps[i];
+		describeKeypoint<bits, upright>(levels, kp.x, kp.y, kp.angle, kp.scale, tables, ROI, desc + static_cast<size_t>(i) * (bits >> 6));
+	}
+}
+
+// straight from the columns of a KeypointSet
+template <const int bits, const bool upright>
+static void _LATCH(const koral::ImageLevel* const __restrict levels, const koral::KeypointSet* const __restrict kps, const int start, const int end, uint64_t* const __restrict desc, const koral::LATCHTables* const tables) {
+	const int32_t* const __restrict px = kps->x.data();
+	const int32_t* const __restrict py = kps->y.data();
+	const float* const __restrict pa = kps->angle.data();
+	const uint8_t* const __restrict pl = kps->level.data();
+	alignas(32) uint8_t ROI[4608];
+	for (int i = start; i < end; ++i) {
+		describeKeypoint<bits, upright>(levels, px[i], py[i], pa[i], pl[i], tables, ROI, desc + static_cast<size_t>(i) * (bits >> 6));
+	}
+}
+
+template <const bool multithreading, const int bits, const bool upright, typename KPs>
+static void describeAll(const koral::ImageLevel* const __restrict levels, const KPs kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables) {
+	static_assert(bits == 128 || bits == 256 || bits == 384 || bits == 512, "LATCH supports 128, 256, 384, or 512 bits.");
+	void (*const describe)(const koral::ImageLevel*, KPs, int, int, uint64_t*, const koral::LATCHTables*) = _LATCH<bits, upright>;
+	const int hw_concur = multithreading ? std::min(num_kps >> 6, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		describe(levels, kps, 0, num_kps, desc, tables);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (num_kps - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, describe, levels, kps, start, end, desc, tables);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+template <const bool multithreading, const bool upright, typename KPs>
+static void describeSet(const koral::ImageLevel* const __restrict levels, const KPs kps, const int num_kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables) {
+	desc.resize(num_kps);
+	switch (desc.bits()) {
+	case 128: describeAll<multithreading, 128, upright>(levels, kps, num_kps, desc.data(), tables); break;
+	case 256: describeAll<multithreading, 256, upright>(levels, kps, num_kps, desc.data(), tables); break;
+	case 384: describeAll<multithreading, 384, upright>(levels, kps, num_kps, desc.data(), tables); break;
+	default:  describeAll<multithreading, 512, upright>(levels, kps, num_kps, desc.data(), tables); break;
+	}
+}
+
+template <const bool multithreading, const int bits, const bool upright>
+void LATCH(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables) {
+	describeAll<multithreading, bits, upright>(levels, kps, num_kps, desc, tables);
+}
+
+template <const bool multithreading, const bool upright>
+void LATCH(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables) {
+	describeSet<multithreading, upright>(levels, kps, num_kps, desc, tables);
+}
+
+template <const bool multithreading, const bool upright>
+void LATCH(const koral::ImageLevel* const __restrict levels, const koral::KeypointSet& kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables) {
+	describeSet<multithreading, upright>(levels, &kps, static_cast<int>(kps.size()), desc, tables);
+}
+
+void LATCHReference(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const int bits) {
+	uint8_t ROI[4608] = {};
+	for (int i = 0; i < num_kps; ++i) {
+		sampleROI(levels[kps[i].scale], kps[i].x, kps[i].y, kps[i].angle, ROI);
+		uint64_t* const d = desc + static_cast<size_t>(i) * (bits >> 6);
+		memset(d, 0, bits >> 3);
+		for (int32_t n = 0; n < bits; ++n) {
+			const uint16_t* const t = triplets + (n << 2);
+			int32_t sum = 0;
+			for (int32_t r = 0; r < 8; ++r) {
+				for (int32_t k = 0; k < 8; ++k) {
+					const int32_t b = ROI[t[1] + r * 72 + k];
+					const int32_t a = ROI[t[0] + r * 72 + k] - b;
+					const int32_t c = ROI[t[2] + r * 72 + k] - b;
+					sum += a * a - c * c;
+				}
+			}
+			d[n >> 6] |= static_cast<uint64_t>(sum < 0) << (n & 63);
+		}
+	}
+}
+
+template void LATCH<true, 128, false>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<false, 128, false>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<true, 256, false>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<false, 256, false>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<true, 384, false>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<false, 384, false>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<true, 512, false>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<false, 512, false>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<true, false>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables);
+template void LATCH<false, false>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables);
+template void LATCH<true, false>(const koral::ImageLevel* const __restrict levels, const koral::KeypointSet& kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables);
+template void LATCH<false, false>(const koral::ImageLevel* const __restrict levels, const koral::KeypointSet& kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables);
+template void LATCH<true, 128, true>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<false, 128, true>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<true, 256, true>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<false, 256, true>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<true, 384, true>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<false, 384, true>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<true, 512, true>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<false, 512, true>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, uint64_t* const __restrict desc, const koral::LATCHTables* const tables);
+template void LATCH<true, true>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables);
+template void LATCH<false, true>(const koral::ImageLevel* const __restrict levels, const koral::Keypoint* const __restrict kps, const int num_kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables);
+template void LATCH<true, true>(const koral::ImageLevel* const __restrict levels, const koral::KeypointSet& kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables);
+template void LATCH<false, true>(const koral::ImageLevel* const __restrict levels, const koral::KeypointSet& kps, koral::DescriptorSet& desc, const koral::LATCHTables* const tables);
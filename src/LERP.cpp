@@ -0,0 +1,104 @@
+/*******************************************************************
+*   LERP.cpp
+*   KORAL
+*******************************************************************/
+//
+// CPU bilinear image resize.
+// See LERP.h for details.
+//
+
+#include "koral/LERP.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <immintrin.h>
+#include <thread>
+#include <vector>
+
+static void _LERP(const uint8_t* __restrict const src, const int32_t h, const int32_t src_stride, const float f,
+	uint8_t* __restrict const dst, const int32_t neww, const int32_t start_row, const int32_t end_row, const int32_t dst_stride,
+	const int32_t* __restrict const x0, const int32_t* __restrict const x1, const float* __restrict const wt_x, const int32_t vec_begin, const int32_t vec_end) {
+	for (int32_t y = start_row; y < end_row; ++y) {
+		const float fy = (static_cast<float>(y) + 0.5f)*f - 0.5f;
+		const float fl = std::floor(fy);
+		const float wt_y = fy - fl;
+		const float invwt_y = 1.0f - wt_y;
+		const int32_t yi = static_cast<int32_t>(fl);
+		const uint8_t* __restrict const r0 = src + std::min(std::max(yi, 0), h - 1)*src_stride;
+		const uint8_t* __restrict const r1 = src + std::min(std::max(yi + 1, 0), h - 1)*src_stride;
+		uint8_t* __restrict const out = dst + y*dst_stride;
+
+		int32_t x = 0;
+		for (; x < vec_begin; ++x) {
+			const float xa = (1.0f - wt_x[x])*r0[x0[x]] + wt_x[x]*r0[x1[x]];
+			const float xb = (1.0f - wt_x[x])*r1[x0[x]] + wt_x[x]*r1[x1[x]];
+			out[x] = static_cast<uint8_t>(invwt_y*xa + wt_y*xb + 0.5f);
+		}
+
+		// both neighbors come from one 4-byte gather per source row
+		const __m256i lo = _mm256_set1_epi32(0xFF);
+		const __m256 vwt_y = _mm256_set1_ps(wt_y), vinvwt_y = _mm256_set1_ps(invwt_y);
+		const __m256i order = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+		for (; x + 8 <= vec_end; x += 8) {
+			const __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x0 + x));
+			const __m256i g0 = _mm256_i32gather_epi32(reinterpret_cast<const int*>(r0), idx, 1);
+			const __m256i g1 = _mm256_i32gather_epi32(reinterpret_cast<const int*>(r1), idx, 1);
+			const __m256 wx = _mm256_loadu_ps(wt_x + x);
+			const __m256 invwx = _mm256_sub_ps(_mm256_set1_ps(1.0f), wx);
+			const __m256 xa = _mm256_add_ps(_mm256_mul_ps(invwx, _mm256_cvtepi32_ps(_mm256_and_si256(g0, lo))), _mm256_mul_ps(wx, _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(g0, 8), lo))));
+			const __m256 xb = _mm256_add_ps(_mm256_mul_ps(invwx, _mm256_cvtepi32_ps(_mm256_and_si256(g1, lo))), _mm256_mul_ps(wx, _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(g1, 8), lo))));
+			const __m256i res = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vinvwt_y, xa), _mm256_mul_ps(vwt_y, xb)), _mm256_set1_ps(0.5f)));
+			const __m256i p = _mm256_packus_epi16(_mm256_packus_epi32(res, res), _mm256_setzero_si256());
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(p, order)));
+		}
+
+		for (; x < neww; ++x) {
+			const float xa = (1.0f - wt_x[x])*r0[x0[x]] + wt_x[x]*r0[x1[x]];
+			const float xb = (1.0f - wt_x[x])*r1[x0[x]] + wt_x[x]*r1[x1[x]];
+			out[x] = static_cast<uint8_t>(invwt_y*xa + wt_y*xb + 0.5f);
+		}
+	}
+}
+
+template <const bool multithreading>
+void LERP(const uint8_t* __restrict const src, const int32_t w, const int32_t h, const int32_t src_stride, const float f,
+	uint8_t* __restrict const dst, const int32_t neww, const int32_t newh, const int32_t dst_stride) {
+	// per-column neighbors and weights, shared by every row
+	std::vector<int32_t> x0(neww), x1(neww);
+	std::vector<float> wt_x(neww);
+	int32_t vec_begin = neww, vec_end = neww;
+	for (int32_t x = 0; x < neww; ++x) {
+		const float fx = (static_cast<float>(x) + 0.5f)*f - 0.5f;
+		const float fl = std::floor(fx);
+		const int32_t xi = static_cast<int32_t>(fl);
+		wt_x[x] = fx - fl;
+		x0[x] = std::min(std::max(xi, 0), w - 1);
+		x1[x] = std::min(std::max(xi + 1, 0), w - 1);
+		// the gathers read 4 bytes from x0, so they must stay inside the row
+		if (xi >= 0 && vec_begin == neww) vec_begin = x;
+		if (xi + 3 >= w && vec_end == neww) vec_end = x;
+	}
+	vec_end = std::max(vec_begin, vec_end);
+
+	const int32_t hw_concur = multithreading ? std::min(newh >> 4, static_cast<int32_t>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		_LERP(src, h, src_stride, f, dst, neww, 0, newh, dst_stride, x0.data(), x1.data(), wt_x.data(), vec_begin, vec_end);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int32_t start = 0;
+	for (int32_t i = 0; i < hw_concur; ++i) {
+		const int32_t end = start + (newh - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, _LERP, src, h, src_stride, f, dst, neww, start, end, dst_stride, x0.data(), x1.data(), wt_x.data(), vec_begin, vec_end);
+		start = end;
+	}
+	for (auto& fu : fut) fu.wait();
+}
+
+template void LERP<true>(const uint8_t* __restrict const src, const int32_t w, const int32_t h, const int32_t src_stride, const float f,
+	uint8_t* __restrict const dst, const int32_t neww, const int32_t newh, const int32_t dst_stride);
+template void LERP<false>(const uint8_t* __restrict const src, const int32_t w, const int32_t h, const int32_t src_stride, const float f,
+	uint8_t* __restrict const dst, const int32_t neww, const int32_t newh, const int32_t dst_stride);
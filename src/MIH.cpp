@@ -0,0 +1,225 @@
+/*******************************************************************
+*   MIH.cpp
+*   KORAL
+*******************************************************************/
+//
+// Multi-index hashing for 2NN matching.
+// See MIH.h for details.
+//
+
+#include "koral/MIH.h"
+
+#include "koral/Hamming.h"
+#include "koral/K2NN.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <immintrin.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+// in distances of a tiled K2NN scan, a bucket probe costs about probe_cost, plus
+// item_cost for each descriptor it finds (a scattered read that usually misses cache)
+static constexpr uint64_t probe_cost = 64;
+static constexpr uint64_t item_cost = 192;
+
+static inline uint64_t binomial(const int n, const int k) {
+	if (k < 0 || k > n) return 0;
+	uint64_t c = 1;
+	for (int i = 1; i <= k; ++i) c = c * static_cast<uint64_t>(n - k + i) / static_cast<uint64_t>(i);
+	return c;
+}
+
+static inline uint32_t slot(const uint32_t key, const int shift) {
+	return static_cast<uint32_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL) >> shift);
+}
+
+koral::MIHIndex::MIHIndex(const DescriptorView& train, const int substrings) : desc(train.bits()) {
+	desc.append(train);
+	const int bits = static_cast<int>(desc.bits());
+	const int min_m = (bits + 31) >> 5;
+	int m = substrings;
+	if (m <= 0) {
+		const int b = std::min(std::max(static_cast<int>(std::log2(static_cast<double>(std::max<size_t>(desc.size(), 2))) + 0.5), 8), 32);
+		m = std::max((bits + (b >> 1)) / b, min_m);
+	}
+	else if (m < min_m || m > bits) {
+		throw std::invalid_argument("MIHIndex: substrings must be between bits / 32 and bits.");
+	}
+
+	tables.resize(m);
+	for (int j = 0, offset = 0; j < m; ++j) {
+		tables[j].offset = offset;
+		tables[j].length = bits / m + (j < bits % m);
+		offset += tables[j].length;
+	}
+
+	const int hw_concur = std::min(m, static_cast<int>(std::thread::hardware_concurrency()));
+	if (hw_concur <= 1) {
+		for (auto& t : tables) buildTable(t);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (m - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, [this, start, end]() { for (int j = start; j < end; ++j) buildTable(tables[j]); });
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+uint32_t koral::MIHIndex::substring(const uint64_t* const d, const Table& table) const {
+	const int w = table.offset >> 6, s = table.offset & 63;
+	uint64_t v = d[w] >> s;
+	if (s + table.length > 64) v |= d[w + 1] << (64 - s);
+	return static_cast<uint32_t>(v & ((1ULL << table.length) - 1));
+}
+
+void koral::MIHIndex::buildTable(Table& table) const {
+	const size_t n = desc.size();
+
+	// (value, id) pairs in order give the buckets, each in ascending id order
+	std::vector<uint64_t> pairs(n);
+	for (size_t i = 0; i < n; ++i) pairs[i] = (static_cast<uint64_t>(substring(desc[i], table)) << 32) | i;
+	std::sort(pairs.begin(), pairs.end());
+
+	table.ids.resize(n);
+	table.keys.clear();
+	table.starts.clear();
+	for (size_t i = 0; i < n; ++i) {
+		const uint32_t key = static_cast<uint32_t>(pairs[i] >> 32);
+		if (i == 0 || key != table.keys.back()) {
+			table.keys.push_back(key);
+			table.starts.push_back(static_cast<uint32_t>(i));
+		}
+		table.ids[i] = static_cast<uint32_t>(pairs[i]);
+	}
+	table.starts.push_back(static_cast<uint32_t>(n));
+	table.probe_cost = probe_cost + ((item_cost * n) >> table.length);
+
+	// at most half full
+	int log_slots = 1;
+	while ((1ULL << log_slots) < (table.keys.size() << 1)) ++log_slots;
+	table.shift = 64 - log_slots;
+	table.slots.assign(1ULL << log_slots, -1);
+	const uint32_t mask = static_cast<uint32_t>((1ULL << log_slots) - 1);
+	for (size_t k = 0; k < table.keys.size(); ++k) {
+		uint32_t s = slot(table.keys[k], table.shift);
+		while (table.slots[s] >= 0) s = (s + 1) & mask;
+		table.slots[s] = static_cast<int32_t>(k);
+	}
+}
+
+int koral::MIHIndex::matchOne(const uint64_t* const q, const int threshold, std::vector<uint32_t>& seen, uint32_t& stamp) const {
+	const int words = static_cast<int>(desc.words());
+	const int n = static_cast<int>(desc.size());
+	const int m = static_cast<int>(tables.size());
+	const int thresh = static_cast<uint8_t>(threshold);
+
+	// the result CUDAK2NN would give, scanning in index order: ties keep the lower index
+	int best_v = 100000, second_v = 200000, best_i = -1;
+	auto update = [&](const int id) {
+		const int d = hamming(q, desc[id], words);
+		if (d < best_v || (d == best_v && id < best_i)) {
+			second_v = best_v;
+			best_v = d;
+			best_i = id;
+		}
+		else {
+			second_v = std::min(second_v, d);
+		}
+	};
+	auto result = [&]() { return second_v - best_v > thresh ? best_i : -1; };
+
+	if (++stamp == 0) {
+		std::fill(seen.begin(), seen.end(), 0);
+		stamp = 1;
+	}
+
+	// gives up (-2) once probing would cost more than brute force
+	uint64_t cost = 0;
+	for (int r = 0; ; ++r) {
+		// past the longest substring, every descriptor has been seen
+		if (r > tables[0].length) return result();
+		for (int j = 0; j < m; ++j) {
+			const Table& t = tables[j];
+			cost += binomial(t.length, r) * t.probe_cost;
+			if (cost > static_cast<uint64_t>(n)) return -2;
+			const uint32_t qs = substring(q, t);
+			const uint32_t slot_mask = static_cast<uint32_t>(t.slots.size() - 1);
+
+			// every length-bit mask with r bits set, in increasing order (Gosper's hack)
+			const uint64_t limit = 1ULL << t.length;
+			for (uint64_t flip = (1ULL << r) - 1; flip < limit;) {
+				const uint32_t key = qs ^ static_cast<uint32_t>(flip);
+				for (uint32_t s = slot(key, t.shift); t.slots[s] >= 0; s = (s + 1) & slot_mask) {
+					const int32_t k = t.slots[s];
+					if (t.keys[k] != key) continue;
+					for (uint32_t e = t.starts[k]; e < t.starts[k + 1]; ++e) {
+						const uint32_t id = t.ids[e];
+						if (seen[id] == stamp) continue;
+						seen[id] = stamp;
+						update(static_cast<int>(id));
+					}
+					break;
+				}
+				if (flip == 0) break;
+				const uint64_t c = flip & (~flip + 1), rr = flip + c;
+				flip = (((rr ^ flip) >> 2) / c) | rr;
+			}
+
+			// every unseen descriptor is at least this far away. The result is settled once
+			// none can beat or tie the best, and either the second best is already within
+			// threshold or none can come within threshold of the best.
+			const int bound = m * r + j + 1;
+			if (bound > best_v && (second_v - best_v <= thresh || bound > best_v + thresh)) return result();
+		}
+	}
+}
+
+void koral::MIHIndex::matchRange(const DescriptorView& query, const int start, const int end, int* const __restrict matches, const int threshold) const {
+	std::vector<uint32_t> seen(desc.size(), 0);
+	uint32_t stamp = 0;
+	std::vector<int> rest;
+	for (int i = start; i < end; ++i) {
+		matches[i] = matchOne(query[i], threshold, seen, stamp);
+		if (matches[i] == -2) rest.push_back(i);
+	}
+	if (rest.empty()) return;
+
+	// queries with no close neighbor go to K2NN together, which keeps the index in cache across them
+	DescriptorSet far(desc.bits(), rest.size());
+	for (size_t i = 0; i < rest.size(); ++i) memcpy(far[i], query[rest[i]], desc.bits() >> 3);
+	std::vector<int> far_matches(rest.size());
+	K2NN<false>(desc.view(), far.view(), far_matches.data(), threshold);
+	for (size_t i = 0; i < rest.size(); ++i) matches[rest[i]] = far_matches[i];
+}
+
+template <const bool multithreading>
+void koral::MIHIndex::match(const DescriptorView& query, int* const __restrict matches, const int threshold) const {
+	if (query.bits() != desc.bits()) throw std::invalid_argument("MIHIndex: query descriptors differ in length from the index.");
+	const int num_q = static_cast<int>(query.size());
+	const int hw_concur = multithreading ? std::min(num_q >> 4, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		matchRange(query, 0, num_q, matches, threshold);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (num_q - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, &MIHIndex::matchRange, this, std::cref(query), start, end, matches, threshold);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+template void koral::MIHIndex::match<true>(const DescriptorView& query, int* const __restrict matches, const int threshold) const;
+template void koral::MIHIndex::match<false>(const DescriptorView& query, int* const __restrict matches, const int threshold) const;
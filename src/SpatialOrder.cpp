@@ -0,0 +1,117 @@
+/*******************************************************************
+*   SpatialOrder.cpp
+*   KORAL
+*******************************************************************/
+//
+// Morton-order keypoint sorting.
+// See SpatialOrder.h for details.
+//
+
+#include "koral/SpatialOrder.h"
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// spreads the low 16 bits of v to the even bit positions
+static inline uint32_t spread(uint32_t v) {
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+static inline uint64_t spatialKey(const int32_t x, const int32_t y, const uint8_t level, const int tile_shift) {
+	const uint32_t tx = static_cast<uint32_t>(x) >> tile_shift;
+	const uint32_t ty = static_cast<uint32_t>(y) >> tile_shift;
+	return (static_cast<uint64_t>(level) << 32) | spread(tx) | (spread(ty) << 1);
+}
+
+// stable LSD radix sort of indices by 40-bit key, 8 bits per pass
+static void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& perm) {
+	const size_t n = keys.size();
+	perm.resize(n);
+	for (size_t i = 0; i < n; ++i) perm[i] = static_cast<uint32_t>(i);
+	std::vector<uint64_t> keys_tmp(n);
+	std::vector<uint32_t> perm_tmp(n);
+	for (int shift = 0; shift < 40; shift += 8) {
+		size_t count[256] = {};
+		for (size_t i = 0; i < n; ++i) ++count[(keys[i] >> shift) & 0xFF];
+		if (n == 0 || count[(keys[0] >> shift) & 0xFF] == n) continue;
+		size_t sum = 0;
+		for (int d = 0; d < 256; ++d) {
+			const size_t c = count[d];
+			count[d] = sum;
+			sum += c;
+		}
+		for (size_t i = 0; i < n; ++i) {
+			const size_t dst = count[(keys[i] >> shift) & 0xFF]++;
+			keys_tmp[dst] = keys[i];
+			perm_tmp[dst] = perm[i];
+		}
+		keys.swap(keys_tmp);
+		perm.swap(perm_tmp);
+	}
+}
+
+template <typename T>
+static void gather(std::vector<T>& v, const std::vector<uint32_t>& perm) {
+	std::vector<T> out(v.size());
+	for (size_t i = 0; i < perm.size(); ++i) out[i] = v[perm[i]];
+	v.swap(out);
+}
+
+template <typename T>
+static void scatter(std::vector<T>& v, const std::vector<uint32_t>& perm) {
+	std::vector<T> out(v.size());
+	for (size_t i = 0; i < perm.size(); ++i) out[perm[i]] = v[i];
+	v.swap(out);
+}
+
+void koral::spatialPermutation(const Keypoint* const kps, const size_t num_kps, std::vector<uint32_t>& perm, const int tile_shift) {
+	std::vector<uint64_t> keys(num_kps);
+	for (size_t i = 0; i < num_kps; ++i) keys[i] = spatialKey(kps[i].x, kps[i].y, kps[i].scale, tile_shift);
+	radixSort(keys, perm);
+}
+
+void koral::spatialPermutation(const KeypointSet& kps, std::vector<uint32_t>& perm, const int tile_shift) {
+	std::vector<uint64_t> keys(kps.size());
+	for (size_t i = 0; i < kps.size(); ++i) keys[i] = spatialKey(kps.x[i], kps.y[i], kps.level[i], tile_shift);
+	radixSort(keys, perm);
+}
+
+void koral::spatialOrder(std::vector<Keypoint>& kps, std::vector<uint32_t>& perm, const int tile_shift) {
+	spatialPermutation(kps.data(), kps.size(), perm, tile_shift);
+	gather(kps, perm);
+}
+
+void koral::spatialOrder(KeypointSet& kps, std::vector<uint32_t>& perm, const int tile_shift) {
+	spatialPermutation(kps, perm, tile_shift);
+	gather(kps.x, perm);
+	gather(kps.y, perm);
+	gather(kps.score, perm);
+	gather(kps.angle, perm);
+	gather(kps.level, perm);
+}
+
+void koral::restoreOrder(std::vector<Keypoint>& kps, const std::vector<uint32_t>& perm) {
+	scatter(kps, perm);
+}
+
+void koral::restoreOrder(KeypointSet& kps, const std::vector<uint32_t>& perm) {
+	scatter(kps.x, perm);
+	scatter(kps.y, perm);
+	scatter(kps.score, perm);
+	scatter(kps.angle, perm);
+	scatter(kps.level, perm);
+}
+
+void koral::restoreOrder(DescriptorSet& desc, const std::vector<uint32_t>& perm) {
+	DescriptorSet out(desc.bits(), desc.size());
+	const size_t row = desc.bits() >> 3;
+	for (size_t i = 0; i < perm.size(); ++i) memcpy(out[perm[i]], desc[i], row);
+	desc = std::move(out);
+}
@@ -0,0 +1,156 @@
+/*******************************************************************
+*   StereoMatcher.cpp
+*   KORAL
+*******************************************************************/
+//
+// 2NN matching along rows of a rectified stereo pair.
+// See StereoMatcher.h for details.
+//
+
+#include "koral/StereoMatcher.h"
+
+#include "koral/Hamming.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <immintrin.h>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+template <const int bits>
+static uint64_t dist4(const uint64_t* const q, const uint64_t* const t0, const uint64_t* const t1, const uint64_t* const t2, const uint64_t* const t3) {
+	__m256i qv[koral::HammingChunks<bits>::total];
+	koral::hammingLoad<bits>(q, qv);
+	return static_cast<uint64_t>(_mm_cvtsi128_si64(koral::hamming4<bits>(qv, t0, t1, t2, t3)));
+}
+
+koral::StereoMatcher::StereoMatcher(const KeypointSet& right_kps, const DescriptorView& right) : min_y(0.0f), rows(1), desc(right.bits()) {
+	if (right_kps.size() != right.size()) throw std::invalid_argument("StereoMatcher: keypoint and descriptor counts differ.");
+	switch (desc.bits()) {
+	case 128: dist4 = ::dist4<128>; break;
+	case 256: dist4 = ::dist4<256>; break;
+	case 384: dist4 = ::dist4<384>; break;
+	default:  dist4 = ::dist4<512>; break;
+	}
+
+	const size_t n = right.size();
+	std::vector<float> x0(n), y0(n);
+	right_kps.toLevel0(x0.data(), y0.data());
+	float max_y = 0.0f;
+	if (n) min_y = max_y = y0[0];
+	for (size_t i = 0; i < n; ++i) {
+		min_y = std::min(min_y, y0[i]);
+		max_y = std::max(max_y, y0[i]);
+	}
+	rows = static_cast<int>(max_y - min_y) + 1;
+
+	// counting sort by row, then by x within each row
+	std::vector<uint32_t> row(n);
+	starts.assign(static_cast<size_t>(rows) + 1, 0);
+	for (size_t i = 0; i < n; ++i) {
+		row[i] = static_cast<uint32_t>(std::min(static_cast<int>(y0[i] - min_y), rows - 1));
+		++starts[row[i] + 1];
+	}
+	for (size_t r = 1; r < starts.size(); ++r) starts[r] += starts[r - 1];
+	std::vector<uint32_t> fill(starts.begin(), starts.end() - 1);
+	ids.resize(n);
+	for (size_t i = 0; i < n; ++i) ids[fill[row[i]]++] = static_cast<uint32_t>(i);
+	for (int r = 0; r < rows; ++r) {
+		std::sort(ids.begin() + starts[r], ids.begin() + starts[r + 1], [&](const uint32_t a, const uint32_t b) {
+			return x0[a] < x0[b] || (x0[a] == x0[b] && a < b);
+		});
+	}
+
+	xs.resize(n);
+	ys.resize(n);
+	levels.resize(n);
+	desc.resize(n);
+	for (size_t j = 0; j < n; ++j) {
+		const uint32_t i = ids[j];
+		xs[j] = x0[i];
+		ys[j] = y0[i];
+		levels[j] = right_kps.level[i];
+		memcpy(desc[j], right[i], right.words() * sizeof(uint64_t));
+	}
+}
+
+void koral::StereoMatcher::matchRange(const KeypointSet& left_kps, const DescriptorView& left, const uint32_t* const order, const int start, const int end, const float* const lx, const float* const ly, const float min_disparity, const float max_disparity, const float row_tolerance, int* const matches, const int threshold, const int level_window) const {
+	const int words = static_cast<int>(desc.words());
+	for (int k = start; k < end; ++k) {
+		const int qi = static_cast<int>(order[k]);
+		const uint64_t* const q = left[qi];
+		int bi = -1, bd = 100000, sd = 200000;
+		auto update = [&](const int d, const int id) {
+			if (d < bd || (d == bd && id < bi)) {
+				sd = bd;
+				bd = d;
+				bi = id;
+			}
+			else {
+				sd = std::min(sd, d);
+			}
+		};
+
+		const float fr0 = std::max(ly[qi] - row_tolerance - min_y, 0.0f), fr1 = std::min(ly[qi] + row_tolerance - min_y, static_cast<float>(rows - 1));
+		// the band overlaps the rows; clamped bounds are compared before truncation
+		if (!ids.empty() && fr0 < static_cast<float>(rows) && fr1 >= 0.0f && row_tolerance >= 0.0f && min_disparity <= max_disparity) {
+			const int lev = left_kps.level[qi];
+			const int l0 = level_window < 0 ? 0 : lev - level_window, l1 = level_window < 0 ? 255 : lev + level_window;
+			const float x0 = lx[qi] - max_disparity, x1 = lx[qi] - min_disparity;
+			uint32_t cand[4];
+			int num_c = 0;
+			for (int r = static_cast<int>(fr0); r <= static_cast<int>(fr1); ++r) {
+				const float* const rb = xs.data() + starts[r];
+				const float* const re = xs.data() + starts[r + 1];
+				for (uint32_t e = static_cast<uint32_t>(std::lower_bound(rb, re, x0) - xs.data()); e < starts[r + 1] && xs[e] <= x1; ++e) {
+					if (std::fabs(ys[e] - ly[qi]) > row_tolerance || levels[e] < l0 || levels[e] > l1) continue;
+					cand[num_c++] = e;
+					if (num_c == 4) {
+						const uint64_t d4 = dist4(q, desc[cand[0]], desc[cand[1]], desc[cand[2]], desc[cand[3]]);
+						for (int j = 0; j < 4; ++j) update(static_cast<int>((d4 >> (j << 4)) & 0xFFFF), static_cast<int>(ids[cand[j]]));
+						num_c = 0;
+					}
+				}
+			}
+			for (int j = 0; j < num_c; ++j) update(hamming(q, desc[cand[j]], words), static_cast<int>(ids[cand[j]]));
+		}
+		matches[qi] = sd - bd > static_cast<uint8_t>(threshold) ? bi : -1;
+	}
+}
+
+template <const bool multithreading>
+void koral::StereoMatcher::match(const KeypointSet& left_kps, const DescriptorView& left, const float min_disparity, const float max_disparity, const float row_tolerance, int* const __restrict matches, const int threshold, const int level_window) const {
+	if (left.bits() != desc.bits()) throw std::invalid_argument("StereoMatcher: left descriptors differ in length from the right descriptors.");
+	if (left_kps.size() != left.size()) throw std::invalid_argument("StereoMatcher: keypoint and descriptor counts differ.");
+	const int num_q = static_cast<int>(left.size());
+	std::vector<float> lx(num_q), ly(num_q);
+	left_kps.toLevel0(lx.data(), ly.data());
+
+	// left keypoints by row, so that threads take bands of rows
+	std::vector<uint32_t> order(num_q);
+	for (int i = 0; i < num_q; ++i) order[i] = static_cast<uint32_t>(i);
+	std::stable_sort(order.begin(), order.end(), [&](const uint32_t a, const uint32_t b) { return ly[a] < ly[b]; });
+
+	const int hw_concur = multithreading ? std::min(num_q >> 6, static_cast<int>(std::thread::hardware_concurrency())) : 1;
+	if (hw_concur <= 1) {
+		matchRange(left_kps, left, order.data(), 0, num_q, lx.data(), ly.data(), min_disparity, max_disparity, row_tolerance, matches, threshold, level_window);
+		return;
+	}
+
+	std::vector<std::future<void>> fut(hw_concur);
+	int start = 0;
+	for (int i = 0; i < hw_concur; ++i) {
+		const int end = start + (num_q - start) / (hw_concur - i);
+		fut[i] = std::async(std::launch::async, &StereoMatcher::matchRange, this, std::cref(left_kps), std::cref(left), order.data(), start, end, lx.data(), ly.data(), min_disparity, max_disparity, row_tolerance, matches, threshold, level_window);
+		start = end;
+	}
+	for (auto& f : fut) f.wait();
+}
+
+template void koral::StereoMatcher::match<true>(const KeypointSet& left_kps, const DescriptorView& left, const float min_disparity, const float max_disparity, const float row_tolerance, int* const __restrict matches, const int threshold, const int level_window) const;
+template void koral::StereoMatcher::match<false>(const KeypointSet& left_kps, const DescriptorView& left, const float min_disparity, const float max_disparity, const float row_tolerance, int* const __restrict matches, const int threshold, const int level_window) const;
@@ -0,0 +1,64 @@
+/*******************************************************************
+*   TrainingStore.cpp
+*   KORAL
+*******************************************************************/
+//
+// Incrementally updated training descriptors.
+// See TrainingStore.h for details.
+//
+
+#include "koral/TrainingStore.h"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+koral::TrainingStore::TrainingStore(const uint16_t bits, const size_t capacity) : desc(bits), next_id(0) {
+	desc.reserve(capacity);
+	ids.reserve(capacity);
+	live.reserve(capacity);
+}
+
+uint32_t koral::TrainingStore::add(const DescriptorView& train) {
+	if (train.bits() != desc.bits()) throw std::invalid_argument("TrainingStore: descriptors differ in length from the store.");
+	const uint32_t first_id = next_id;
+	const size_t first_slot = desc.size();
+	desc.append(train);
+	for (size_t i = 0; i < train.size(); ++i) {
+		ids.push_back(next_id);
+		live.push_back(1);
+		slot_of.emplace(next_id++, static_cast<uint32_t>(first_slot + i));
+	}
+	return first_id;
+}
+
+bool koral::TrainingStore::remove(const uint32_t id) {
+	const auto it = slot_of.find(id);
+	if (it == slot_of.end()) return false;
+	live[it->second] = 0;
+	slot_of.erase(it);
+	if (dead() > size()) compact();
+	return true;
+}
+
+void koral::TrainingStore::compact() {
+	const size_t words = desc.words();
+	size_t out = 0;
+	for (size_t s = 0; s < desc.size(); ++s) {
+		if (!live[s]) continue;
+		if (out != s) {
+			memcpy(desc[out], desc[s], words * sizeof(uint64_t));
+			ids[out] = ids[s];
+			slot_of[ids[out]] = static_cast<uint32_t>(out);
+		}
+		++out;
+	}
+	desc.resize(out);
+	ids.resize(out);
+	live.assign(out, 1);
+}
+
+int64_t koral::TrainingStore::slot(const uint32_t id) const {
+	const auto it = slot_of.find(id);
+	return it == slot_of.end() ? -1 : static_cast<int64_t>(it->second);
+}
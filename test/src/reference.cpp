@@ -0,0 +1,844 @@
+/*******************************************************************
+*   reference.cpp
+*   KORAL
+*******************************************************************/
+//
+// Checks the vectorized CPU paths against their scalar reference
+// implementations, which define the expected output bit for bit.
+//
+// K2NN<multithreading, bits> is compared with K2NNReference<bits>
+// on random training sets of several sizes, with queries that are
+// either random or perturbed copies of training descriptors, and with
+// duplicated training rows so that exact ties (which must go to the
+// lower index, and never match) occur. The other matchers run on
+// the same sets:
+// - K2NNEarlyExit() must equal K2NNReference, on the sets as given
+//   and with their bits reordered by a BitOrder from the training
+//   set, which must be a permutation and leave the training set's
+//   bits by non-increasing variance. A candidate whose distance lies
+//   entirely in the first 128 bits, 1 below the second best, must
+//   not be abandoned.
+// - MIHIndex::match(), with automatic, the fewest, and 16 substrings,
+//   must equal K2NNReference.
+// - K2NN() on a BitSlicedSet must equal K2NNReference, and
+//   toDescriptors() must restore the training set.
+// - K2NNMutual() must equal the intersection of K2NNReference query
+//   -> train and train -> query.
+// - KNN() must return the k smallest distances of each query, by
+//   distance then index, with empty slots past the training set.
+// - K2NNImages(), on the training set cut into 5 images at random
+//   (one of them empty), must return the top 2 of every (query,
+//   image) pair and the 2NN matches within each image.
+// - RadiusMatch(), at radii up to the full length, must return
+//   everything within the radius by distance then index, or with
+//   max_results only the first max_results of it.
+//
+// A TrainingStore goes through rounds of add() and remove(), with an
+// explicit compact() in one: ids, slots, and stored descriptors must
+// follow a plain list of everything added, dead slots must never
+// outnumber live ones, and K2NN() and KNN() on the store must equal
+// them on its live descriptors, returning ids.
+//
+// ClusterTreeIndex rejects too few trees, branches, or leaf slots.
+// With max_checks of the whole training set, its search is
+// exhaustive and match() must equal K2NNReference. So must HNSWIndex
+// with ef of at least the training set size, on clustered
+// descriptors with many exact and near copies. With a smaller ef, a
+// query equal to a descriptor copied once, or 200 times, must find
+// the first copy, at distance 0 from a second.
+//
+// LATCH<multithreading, bits> is compared with LATCHReference at
+// every descriptor length, and BRIEF<multithreading> with
+// BRIEFReference, on a two-level synthetic textured pyramid with
+// keypoints at random angles, including some at the level borders.
+// Upright LATCH is compared with LATCHReference at angle 0.
+// The BRIEF levels are smoothed both ways, which must agree.
+//
+// LATCH with LATCHTables is compared with itself on tables covering
+// none of the levels, which forces the clamped path for every
+// keypoint: the gather path must give the same descriptors. Tables
+// covering only level 0 leave level 1 out of their range. At quarter
+// turns, the 4-bin tables must also match LATCH without tables.
+// LATCH on a KeypointSet must equal LATCH on the same Keypoints.
+//
+// CPUKORAL's fused per-tile pipeline is compared with the unfused
+// whole-level one, with LATCH and BRIEF, on a frame whose levels are
+// not multiples of the tile size: the keypoints and descriptors must
+// be the same, up to order.
+//
+// Returns nonzero, after printing the first mismatch, on failure.
+//
+
+#include "koral/BRIEF.h"
+#include "koral/BitOrder.h"
+#include "koral/CPUKORAL.h"
+#include "koral/ClusterTree.h"
+#include "koral/HNSW.h"
+#include "koral/K2NN.h"
+#include "koral/LATCH.h"
+#include "koral/MIH.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+static std::mt19937_64 rng(36);
+
+// num_t random descriptors, a tenth of them duplicating an earlier one
+static std::vector<uint64_t> trainingSet(const int bits, const int num_t) {
+	const int words = bits >> 6;
+	std::vector<uint64_t> train(static_cast<size_t>(num_t) * words);
+	for (auto& w : train) w = rng();
+	for (int i = 1; i < num_t; ++i) {
+		if (rng() % 10 == 0) std::copy_n(&train[static_cast<size_t>(rng() % i) * words], words, &train[static_cast<size_t>(i) * words]);
+	}
+	return train;
+}
+
+// half random queries, half training rows with up to 39 bits flipped
+static std::vector<uint64_t> querySet(const int bits, const std::vector<uint64_t>& train, const int num_q) {
+	const int words = bits >> 6;
+	const size_t num_t = train.size() / words;
+	std::vector<uint64_t> query(static_cast<size_t>(num_q) * words);
+	for (int i = 0; i < num_q; ++i) {
+		uint64_t* const q = &query[static_cast<size_t>(i) * words];
+		if (num_t == 0 || (i & 1)) {
+			for (int j = 0; j < words; ++j) q[j] = rng();
+		}
+		else {
+			std::copy_n(&train[static_cast<size_t>(rng() % num_t) * words], words, q);
+			for (int flips = static_cast<int>(rng() % 40); flips > 0; --flips) {
+				const int b = static_cast<int>(rng() % bits);
+				q[b >> 6] ^= 1ULL << (b & 63);
+			}
+		}
+	}
+	return query;
+}
+
+// all query x training Hamming distances, row-major by query
+static std::vector<uint16_t> distanceTable(const koral::DescriptorView& train, const koral::DescriptorView& query) {
+	std::vector<uint16_t> dist(query.size() * train.size());
+	for (size_t q = 0; q < query.size(); ++q) {
+		for (size_t t = 0; t < train.size(); ++t) {
+			int d = 0;
+			for (size_t w = 0; w < train.words(); ++w) d += static_cast<int>(__builtin_popcountll(query[q][w] ^ train[t][w]));
+			dist[q * train.size() + t] = static_cast<uint16_t>(d);
+		}
+	}
+	return dist;
+}
+
+// the 8 nearest training indices of each query by (distance, index), -1 past the training set
+static std::vector<int> nearest8(const std::vector<uint16_t>& dist, const int num_t, const int num_q) {
+	std::vector<int> nearest(static_cast<size_t>(num_q) << 3, -1), order(num_t);
+	for (int q = 0; q < num_q; ++q) {
+		const uint16_t* const row = &dist[static_cast<size_t>(q) * num_t];
+		for (int t = 0; t < num_t; ++t) order[t] = t;
+		const int n = std::min(num_t, 8);
+		std::partial_sort(order.begin(), order.begin() + n, order.end(), [&](const int a, const int b) { return row[a] < row[b] || (row[a] == row[b] && a < b); });
+		std::copy_n(order.begin(), n, &nearest[static_cast<size_t>(q) << 3]);
+	}
+	return nearest;
+}
+
+static bool sameMatches(const char* const what, const int* const actual, const int* const expected, const int num_q) {
+	for (int i = 0; i < num_q; ++i) {
+		if (actual[i] != expected[i]) {
+			std::printf("%s: query %d matched %d, expected %d\n", what, i, actual[i], expected[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+template <const bool multithreading, const int bits>
+static bool checkK2NN(const koral::DescriptorView& train, const koral::DescriptorView& query, const std::vector<int>& expected, const int threshold) {
+	std::vector<int> actual(query.size(), -2);
+	K2NN<multithreading, bits>(train.data(), static_cast<int>(train.size()), query.data(), static_cast<int>(query.size()), actual.data(), threshold);
+	return sameMatches(multithreading ? "K2NN<true>" : "K2NN<false>", actual.data(), expected.data(), static_cast<int>(query.size()));
+}
+
+// on the sets as given, and with their bits reordered by the same BitOrder
+template <const bool multithreading, const int bits>
+static bool checkEarlyExit(const koral::DescriptorView& train, const koral::DescriptorView& query, const koral::DescriptorView& train_ordered, const koral::DescriptorView& query_ordered, const std::vector<int>& expected, const int threshold) {
+	std::vector<int> actual(query.size(), -2);
+	K2NNEarlyExit<multithreading, bits>(train.data(), static_cast<int>(train.size()), query.data(), static_cast<int>(query.size()), actual.data(), threshold);
+	if (!sameMatches(multithreading ? "K2NNEarlyExit<true>" : "K2NNEarlyExit<false>", actual.data(), expected.data(), static_cast<int>(query.size()))) return false;
+	K2NNEarlyExit<multithreading>(train_ordered, query_ordered, actual.data(), threshold);
+	return sameMatches(multithreading ? "K2NNEarlyExit<true>, reordered" : "K2NNEarlyExit<false>, reordered", actual.data(), expected.data(), static_cast<int>(query.size()));
+}
+
+// a candidate whose distance is all in the first chunk, 1 below the second best, must not be abandoned there
+template <const int bits>
+static bool checkEarlyExit() {
+	constexpr int words = bits >> 6;
+	std::vector<uint64_t> train_words = trainingSet(bits, 8);
+	const std::vector<uint64_t> query_words = trainingSet(bits, 1);
+	auto flipped = [&](const int t, const int first_bit, const int flips) {
+		uint64_t* const d = &train_words[static_cast<size_t>(t) * words];
+		std::copy_n(query_words.data(), words, d);
+		for (int b = first_bit; b < first_bit + flips; ++b) d[b >> 6] ^= 1ULL << (b & 63);
+	};
+	// second best 5 from the first 4, all in the last chunk; then 4 in the first chunk, beside 3 random descriptors
+	flipped(0, bits - 4, 4);
+	flipped(1, bits - 5, 5);
+	flipped(2, bits - 9, 9);
+	flipped(3, bits - 9, 9);
+	flipped(4, 0, 4);
+	const koral::DescriptorView train(train_words.data(), 8, bits), query(query_words.data(), 1, bits);
+	int expected = -2;
+	K2NNReference<bits>(train.data(), 8, query.data(), 1, &expected, 0);
+	const std::vector<int> expected_v(1, expected);
+	if (!(checkEarlyExit<false, bits>(train, query, train, query, expected_v, 0) && checkEarlyExit<true, bits>(train, query, train, query, expected_v, 0))) {
+		std::printf("  at %d bits, with the distance in the first chunk\n", bits);
+		return false;
+	}
+	return true;
+}
+
+// a permutation that leaves the bits of the reordered training set by non-increasing variance
+static bool checkBitOrder(const koral::BitOrder& order, const koral::DescriptorSet& ordered) {
+	const int bits = order.bits();
+	std::vector<int> sources(bits, 0);
+	for (int i = 0; i < bits; ++i) ++sources[order.source(i)];
+	if (std::count(sources.begin(), sources.end(), 1) != bits) {
+		std::printf("BitOrder: %d bits: not a permutation\n", bits);
+		return false;
+	}
+	const size_t n = ordered.size();
+	size_t last = SIZE_MAX;
+	for (int b = 0; b < bits; ++b) {
+		size_t ones = 0;
+		for (size_t i = 0; i < n; ++i) ones += (ordered[i][b >> 6] >> (b & 63)) & 1;
+		if (ones * (n - ones) > last) {
+			std::printf("BitOrder: %d bits, %zu descriptors: bit %d varies more than bit %d\n", bits, n, b, b - 1);
+			return false;
+		}
+		last = ones * (n - ones);
+	}
+	return true;
+}
+
+template <const bool multithreading>
+static bool checkSliced(const koral::BitSlicedSet& train, const koral::DescriptorView& query, const std::vector<int>& expected, const int threshold) {
+	std::vector<int> actual(query.size(), -2);
+	K2NN<multithreading>(train, query, actual.data(), threshold);
+	return sameMatches(multithreading ? "BitSlicedSet K2NN<true>" : "BitSlicedSet K2NN<false>", actual.data(), expected.data(), static_cast<int>(query.size()));
+}
+
+template <const bool multithreading>
+static bool checkMIH(const koral::MIHIndex& index, const koral::DescriptorView& query, const std::vector<int>& expected, const int threshold) {
+	std::vector<int> actual(query.size(), -2);
+	index.match<multithreading>(query, actual.data(), threshold);
+	return sameMatches(multithreading ? "MIHIndex::match<true>" : "MIHIndex::match<false>", actual.data(), expected.data(), static_cast<int>(query.size()));
+}
+
+// the intersection of K2NNReference both ways
+template <const bool multithreading, const int bits>
+static bool checkMutual(const koral::DescriptorView& train, const koral::DescriptorView& query, const std::vector<int>& forward, const int threshold) {
+	const int num_t = static_cast<int>(train.size()), num_q = static_cast<int>(query.size());
+	std::vector<int> backward(num_t), expected(num_q), actual(num_q, -2);
+	K2NNReference<bits>(query.data(), num_q, train.data(), num_t, backward.data(), threshold);
+	for (int i = 0; i < num_q; ++i) expected[i] = forward[i] >= 0 && backward[forward[i]] == i ? forward[i] : -1;
+	K2NNMutual<multithreading, bits>(train.data(), num_t, query.data(), num_q, actual.data(), threshold);
+	return sameMatches(multithreading ? "K2NNMutual<true>" : "K2NNMutual<false>", actual.data(), expected.data(), num_q);
+}
+
+// the k nearest by brute force, nearest first, ties to the lower index; empty slots are -1 and 0xFFFF
+template <const bool multithreading, const int bits>
+static bool checkKNN(const koral::DescriptorView& train, const koral::DescriptorView& query, const std::vector<uint16_t>& dist, const std::vector<int>& nearest, const int k) {
+	const int num_t = static_cast<int>(train.size()), num_q = static_cast<int>(query.size());
+	koral::MatchSet matches;
+	KNN<multithreading, bits>(train.data(), num_t, query.data(), num_q, k, matches);
+	if (matches.size() != query.size() || matches.k() != k) {
+		std::printf("KNN<%s>: k = %d: MatchSet is %zu x %d\n", multithreading ? "true" : "false", k, matches.size(), matches.k());
+		return false;
+	}
+	for (int q = 0; q < num_q; ++q) {
+		const int* const expected = &nearest[static_cast<size_t>(q) << 3];
+		bool same = matches.count(q) == std::min(k, num_t);
+		for (int i = 0; same && i < k; ++i) {
+			same = matches.index(q, i) == expected[i] && matches.distance(q, i) == (expected[i] < 0 ? 0xFFFF : dist[static_cast<size_t>(q) * num_t + expected[i]]);
+		}
+		if (!same) {
+			std::printf("KNN<%s>: k = %d: query %d differs from the sorted distances\n", multithreading ? "true" : "false", k, q);
+			return false;
+		}
+	}
+	return true;
+}
+
+// the training set cut into 5 images at random points, image 1 empty
+static std::vector<uint32_t> imageOffsets(const int num_t) {
+	std::vector<uint32_t> offsets(6, 0);
+	for (int i = 1; i < 5; ++i) offsets[i] = static_cast<uint32_t>(rng() % (num_t + 1));
+	offsets[5] = static_cast<uint32_t>(num_t);
+	std::sort(offsets.begin(), offsets.end());
+	offsets[2] = offsets[1];
+	return offsets;
+}
+
+// the top 2 of each (query, image) by brute force, and the 2NN matches of each image ascending by query
+template <const bool multithreading, const int bits>
+static bool checkImages(const koral::DescriptorView& train, const koral::DescriptorView& query, const std::vector<uint16_t>& dist, const std::vector<uint32_t>& offsets, const int threshold) {
+	const int num_t = static_cast<int>(train.size()), num_q = static_cast<int>(query.size()), images = static_cast<int>(offsets.size()) - 1;
+	koral::ImageMatchSet matches;
+	K2NNImages<multithreading, bits>(train.data(), offsets.data(), images, query.data(), num_q, threshold, matches);
+	const char* const what = multithreading ? "K2NNImages<true>" : "K2NNImages<false>";
+	if (matches.size() != query.size() || matches.images() != static_cast<size_t>(images)) {
+		std::printf("%s: ImageMatchSet is %zu x %zu\n", what, matches.size(), matches.images());
+		return false;
+	}
+	std::vector<std::vector<int>> match_q(images), match_t(images);
+	for (int q = 0; q < num_q; ++q) {
+		for (int img = 0; img < images; ++img) {
+			int best_v = 100000, second_v = 200000, best_i = -1;
+			for (int t = static_cast<int>(offsets[img]); t < static_cast<int>(offsets[img + 1]); ++t) {
+				const int d = dist[static_cast<size_t>(q) * num_t + t];
+				second_v = std::min(d, second_v);
+				if (d < best_v) {
+					second_v = best_v;
+					best_i = t;
+					best_v = d;
+				}
+			}
+			if (matches.bestIndex(q, img) != best_i || matches.bestDistance(q, img) != best_v || matches.secondDistance(q, img) != second_v) {
+				std::printf("%s: query %d, image %d: top 2 (%d, %d, %d), expected (%d, %d, %d)\n", what, q, img, matches.bestIndex(q, img), matches.bestDistance(q, img), matches.secondDistance(q, img), best_i, best_v, second_v);
+				return false;
+			}
+			if (best_i >= 0 && second_v - best_v > static_cast<uint8_t>(threshold)) {
+				match_q[img].push_back(q);
+				match_t[img].push_back(best_i);
+			}
+		}
+	}
+	for (int img = 0; img < images; ++img) {
+		if (matches.matches(img) != match_q[img].size() || !std::equal(match_q[img].begin(), match_q[img].end(), matches.matchQueries(img)) || !std::equal(match_t[img].begin(), match_t[img].end(), matches.matchTrain(img))) {
+			std::printf("%s: image %d: %zu matches, expected %zu\n", what, img, matches.matches(img), match_q[img].size());
+			return false;
+		}
+	}
+	return true;
+}
+
+// (distance << 32 | training index) of everything within radius of each query, ascending
+static std::vector<std::vector<uint64_t>> withinRadius(const std::vector<uint16_t>& dist, const int num_t, const int num_q, const int radius) {
+	std::vector<std::vector<uint64_t>> within(num_q);
+	for (int q = 0; q < num_q; ++q) {
+		const uint16_t* const row = &dist[static_cast<size_t>(q) * num_t];
+		for (int t = 0; t < num_t; ++t) {
+			if (row[t] <= radius) within[q].push_back(static_cast<uint64_t>(row[t]) << 32 | static_cast<uint64_t>(t));
+		}
+		std::sort(within[q].begin(), within[q].end());
+	}
+	return within;
+}
+
+// everything within the radius by distance then index, or the first max_results of it
+template <const bool multithreading, const int bits>
+static bool checkRadius(const koral::DescriptorView& train, const koral::DescriptorView& query, const std::vector<std::vector<uint64_t>>& within, const int radius, const int max_results) {
+	koral::RadiusMatchSet matches;
+	RadiusMatch<multithreading, bits>(train.data(), static_cast<int>(train.size()), query.data(), static_cast<int>(query.size()), radius, matches, max_results);
+	if (matches.size() != query.size()) {
+		std::printf("RadiusMatch<%s>: %zu queries, expected %zu\n", multithreading ? "true" : "false", matches.size(), query.size());
+		return false;
+	}
+	for (size_t q = 0; q < query.size(); ++q) {
+		const size_t n = max_results ? std::min(within[q].size(), static_cast<size_t>(max_results)) : within[q].size();
+		bool same = matches.count(q) == n;
+		for (size_t i = 0; same && i < n; ++i) same = matches.indices(q)[i] == static_cast<int32_t>(within[q][i] & 0xFFFFFFFF) && matches.distances(q)[i] == within[q][i] >> 32;
+		if (!same) {
+			std::printf("RadiusMatch<%s>: radius %d, max_results %d: query %zu has %zu results, expected %zu\n", multithreading ? "true" : "false", radius, max_results, q, matches.count(q), n);
+			return false;
+		}
+	}
+	return true;
+}
+
+// every matcher against the scalar reference, on the same training and query sets
+template <const int bits>
+static bool checkMatchers() {
+	const int sizes[] = { 0, 1, 2, 7, 300, 5000 };
+	const int thresholds[] = { 0, 5, 64, 300 };
+	for (const int num_t : sizes) {
+		const std::vector<uint64_t> train_words = trainingSet(bits, num_t);
+		const std::vector<uint64_t> query_words = querySet(bits, train_words, 777);
+		const koral::DescriptorView train(train_words.data(), num_t, bits), query(query_words.data(), 777, bits);
+		const int num_q = static_cast<int>(query.size());
+		const std::vector<uint16_t> dist = distanceTable(train, query);
+		const std::vector<int> nearest = nearest8(dist, num_t, num_q);
+		const std::vector<uint32_t> offsets = imageOffsets(num_t);
+		for (const int radius : { 0, 5, bits / 4, bits }) {
+			// everything is within the full length; enough to check on the smaller sets
+			if (radius == bits && num_t > 300) continue;
+			const std::vector<std::vector<uint64_t>> within = withinRadius(dist, num_t, num_q, radius);
+			for (const int max_results : { 0, 1, 3 }) {
+				if (!(checkRadius<false, bits>(train, query, within, radius, max_results) && checkRadius<true, bits>(train, query, within, radius, max_results))) {
+					std::printf("  at %d bits, %d training descriptors\n", bits, num_t);
+					return false;
+				}
+			}
+		}
+		for (const int k : { 1, 2, 5, 8 }) {
+			if (!(checkKNN<false, bits>(train, query, dist, nearest, k) && checkKNN<true, bits>(train, query, dist, nearest, k))) {
+				std::printf("  at %d bits, %d training descriptors\n", bits, num_t);
+				return false;
+			}
+		}
+
+		const koral::BitSlicedSet sliced(train);
+		koral::DescriptorSet unsliced(bits);
+		sliced.toDescriptors(unsliced);
+		if (sliced.size() != train.size() || unsliced.size() != train.size() || !std::equal(train_words.begin(), train_words.end(), unsliced.data())) {
+			std::printf("BitSlicedSet: %d bits, %d descriptors: toDescriptors() does not restore them\n", bits, num_t);
+			return false;
+		}
+
+		// the order from the training set, which must also leave it sorted by variance
+		const koral::BitOrder order(train);
+		koral::DescriptorSet train_ordered(bits), query_ordered(bits);
+		order.apply(train, train_ordered);
+		order.apply(query, query_ordered);
+		if (!checkBitOrder(order, train_ordered)) return false;
+
+		// automatic substrings, the fewest allowed, and short ones of 8 to 32 bits
+		std::vector<std::unique_ptr<koral::MIHIndex>> mih;
+		for (const int m : { 0, bits / 32, 16 }) mih.emplace_back(new koral::MIHIndex(train, m));
+
+		for (const int threshold : thresholds) {
+			std::vector<int> expected(num_q);
+			K2NNReference<bits>(train.data(), num_t, query.data(), num_q, expected.data(), threshold);
+			bool ok = checkK2NN<false, bits>(train, query, expected, threshold) && checkK2NN<true, bits>(train, query, expected, threshold);
+			ok = ok && checkEarlyExit<false, bits>(train, query, train_ordered, query_ordered, expected, threshold) && checkEarlyExit<true, bits>(train, query, train_ordered, query_ordered, expected, threshold);
+			ok = ok && checkSliced<false>(sliced, query, expected, threshold) && checkSliced<true>(sliced, query, expected, threshold);
+			ok = ok && checkMutual<false, bits>(train, query, expected, threshold) && checkMutual<true, bits>(train, query, expected, threshold);
+			ok = ok && checkImages<false, bits>(train, query, dist, offsets, threshold) && checkImages<true, bits>(train, query, dist, offsets, threshold);
+			for (const auto& index : mih) ok = ok && checkMIH<false>(*index, query, expected, threshold) && checkMIH<true>(*index, query, expected, threshold);
+			if (!ok) {
+				std::printf("  at %d bits, %d training descriptors, threshold %d\n", bits, num_t, threshold);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// K2NN and KNN on a TrainingStore must equal them on its live descriptors in id order, with ids for indices
+template <const bool multithreading, const int bits>
+static bool checkStoreMatch(const koral::TrainingStore& store, const std::vector<uint64_t>& live_words, const std::vector<uint32_t>& live_ids) {
+	const int num_live = static_cast<int>(live_ids.size());
+	const koral::DescriptorView live(live_words.data(), num_live, bits);
+	const std::vector<uint64_t> query_words = querySet(bits, live_words, 300);
+	const koral::DescriptorView query(query_words.data(), 300, bits);
+	const char* const what = multithreading ? "TrainingStore K2NN<true>" : "TrainingStore K2NN<false>";
+
+	std::vector<int> expected(300), actual(300, -2);
+	for (const int threshold : { 0, 5 }) {
+		K2NNReference<bits>(live.data(), num_live, query.data(), 300, expected.data(), threshold);
+		for (auto& m : expected) m = m < 0 ? -1 : static_cast<int>(live_ids[m]);
+		K2NN<multithreading>(store, query, actual.data(), threshold);
+		if (!sameMatches(what, actual.data(), expected.data(), 300)) return false;
+	}
+
+	koral::MatchSet expected_knn, actual_knn;
+	KNN<multithreading, bits>(live.data(), num_live, query.data(), 300, 5, expected_knn);
+	KNN<multithreading>(store, query, 5, actual_knn);
+	for (int q = 0; q < 300; ++q) {
+		bool same = actual_knn.count(q) == expected_knn.count(q);
+		for (int i = 0; same && i < expected_knn.count(q); ++i) {
+			same = actual_knn.index(q, i) == static_cast<int32_t>(live_ids[expected_knn.index(q, i)]) && actual_knn.distance(q, i) == expected_knn.distance(q, i);
+		}
+		if (!same) {
+			std::printf("TrainingStore KNN<%s>: query %d differs from KNN on the live descriptors\n", multithreading ? "true" : "false", q);
+			return false;
+		}
+	}
+	return true;
+}
+
+// rounds of add() and remove(), then compact(), against a plain list of every descriptor ever added
+template <const int bits>
+static bool checkStore() {
+	constexpr int words = bits >> 6;
+	koral::TrainingStore store(bits);
+	std::vector<uint64_t> added;
+	std::vector<uint8_t> removed;
+	for (int round = 0; round < 6; ++round) {
+		const int n = static_cast<int>(rng() % 700);
+		const std::vector<uint64_t> batch = trainingSet(bits, n);
+		const uint32_t first = store.add(koral::DescriptorView(batch.data(), n, bits));
+		if (first != added.size() / words) {
+			std::printf("TrainingStore<%d>: add() returned id %u, expected %zu\n", bits, first, added.size() / words);
+			return false;
+		}
+		added.insert(added.end(), batch.begin(), batch.end());
+		removed.resize(added.size() / words, 0);
+
+		// about a third of the ids, some twice, and some never added
+		const uint32_t num_ids = static_cast<uint32_t>(removed.size());
+		for (uint32_t i = 0, n_remove = num_ids / 3 + 1; i < n_remove; ++i) {
+			const uint32_t id = static_cast<uint32_t>(rng() % (num_ids + 10));
+			const bool was_live = id < num_ids && !removed[id];
+			if (store.remove(id) != was_live) {
+				std::printf("TrainingStore<%d>: remove(%u) returned %d\n", bits, id, !was_live);
+				return false;
+			}
+			if (was_live) removed[id] = 1;
+			if (store.dead() > store.size()) {
+				std::printf("TrainingStore<%d>: %zu dead slots for %zu live\n", bits, store.dead(), store.size());
+				return false;
+			}
+		}
+		if (round == 4) store.compact();
+
+		std::vector<uint64_t> live_words;
+		std::vector<uint32_t> live_ids;
+		for (uint32_t id = 0; id < num_ids; ++id) {
+			const int64_t slot = store.slot(id);
+			if (store.contains(id) == static_cast<bool>(removed[id]) || (slot < 0) != static_cast<bool>(removed[id])) {
+				std::printf("TrainingStore<%d>: id %u is %s\n", bits, id, removed[id] ? "still live" : "missing");
+				return false;
+			}
+			if (removed[id]) continue;
+			const uint64_t* const d = &added[static_cast<size_t>(id) * words];
+			if (store.id(static_cast<size_t>(slot)) != id || !store.alive(static_cast<size_t>(slot)) || !std::equal(d, d + words, store.view()[static_cast<size_t>(slot)])) {
+				std::printf("TrainingStore<%d>: slot %lld of id %u holds the wrong descriptor\n", bits, static_cast<long long>(slot), id);
+				return false;
+			}
+			live_words.insert(live_words.end(), d, d + words);
+			live_ids.push_back(id);
+		}
+		if (store.size() != live_ids.size() || (round == 4 && store.dead() != 0)) {
+			std::printf("TrainingStore<%d>: %zu live and %zu dead, expected %zu live\n", bits, store.size(), store.dead(), live_ids.size());
+			return false;
+		}
+		if (!(checkStoreMatch<false, bits>(store, live_words, live_ids) && checkStoreMatch<true, bits>(store, live_words, live_ids))) return false;
+	}
+	return true;
+}
+
+// every descriptor checked, the forest is exhaustive
+template <const bool multithreading, const int bits>
+static bool checkClusterTree(const koral::ClusterTreeIndex& index, const koral::DescriptorView& train, const koral::DescriptorView& query) {
+	const int num_t = static_cast<int>(train.size()), num_q = static_cast<int>(query.size());
+	std::vector<int> expected(num_q), actual(num_q, -2);
+	for (const int threshold : { 0, 5, 64 }) {
+		K2NNReference<bits>(train.data(), num_t, query.data(), num_q, expected.data(), threshold);
+		index.match<multithreading>(query, actual.data(), threshold, std::max(num_t, 1));
+		if (!sameMatches(multithreading ? "ClusterTreeIndex<true>" : "ClusterTreeIndex<false>", actual.data(), expected.data(), num_q)) {
+			std::printf("  at %d bits, %d training descriptors, threshold %d\n", bits, num_t, threshold);
+			return false;
+		}
+	}
+	return true;
+}
+
+template <const int bits>
+static bool checkClusterTree() {
+	const std::vector<uint64_t> one = trainingSet(bits, 1);
+	const koral::DescriptorView view(one.data(), 1, bits);
+	for (const auto& args : std::vector<std::vector<int>>{ { -1, 32, 100 }, { 0, 32, 100 }, { 4, 1, 100 }, { 4, 32, 0 } }) {
+		bool rejected = false;
+		try {
+			koral::ClusterTreeIndex(view, args[0], args[1], args[2]);
+		}
+		catch (const std::invalid_argument&) {
+			rejected = true;
+		}
+		if (!rejected) {
+			std::printf("ClusterTreeIndex: %d trees, branching %d, leaf size %d not rejected\n", args[0], args[1], args[2]);
+			return false;
+		}
+	}
+
+	for (const int num_t : { 0, 1, 7, 1000 }) {
+		const std::vector<uint64_t> train_words = trainingSet(bits, num_t);
+		const std::vector<uint64_t> query_words = querySet(bits, train_words, 300);
+		const koral::DescriptorView train(train_words.data(), num_t, bits), query(query_words.data(), 300, bits);
+		// small branching and leaves, so that the trees are several levels deep
+		const koral::ClusterTreeIndex index(train, 3, 4, 8, num_t);
+		if (!(checkClusterTree<false, bits>(index, train, query) && checkClusterTree<true, bits>(index, train, query))) return false;
+	}
+	return true;
+}
+
+// num_t descriptors around 20 centers, up to 3 bits from one, a tenth of them duplicating an earlier one
+static std::vector<uint64_t> clusteredSet(const int bits, const int num_t) {
+	const int words = bits >> 6;
+	const std::vector<uint64_t> centers = trainingSet(bits, 20);
+	std::vector<uint64_t> train = trainingSet(bits, num_t);
+	for (int i = 0; i < num_t; ++i) {
+		uint64_t* const t = &train[static_cast<size_t>(i) * words];
+		if (i && rng() % 10 == 0) {
+			std::copy_n(&train[static_cast<size_t>(rng() % i) * words], words, t);
+			continue;
+		}
+		std::copy_n(&centers[static_cast<size_t>(rng() % 20) * words], words, t);
+		for (int flips = static_cast<int>(rng() % 4); flips > 0; --flips) {
+			const int b = static_cast<int>(rng() % bits);
+			t[b >> 6] ^= 1ULL << (b & 63);
+		}
+	}
+	return train;
+}
+
+template <const bool multithreading, const int bits>
+static bool checkHNSW(const koral::HNSWIndex& index, const koral::DescriptorView& train, const koral::DescriptorView& query) {
+	const int num_t = static_cast<int>(train.size()), num_q = static_cast<int>(query.size());
+	std::vector<int> expected(num_q), actual(num_q, -2);
+	for (const int threshold : { 0, 5, 64 }) {
+		K2NNReference<bits>(train.data(), num_t, query.data(), num_q, expected.data(), threshold);
+		index.match<multithreading>(query, actual.data(), threshold, 4 * num_t);
+		if (!sameMatches(multithreading ? "HNSWIndex<true>" : "HNSWIndex<false>", actual.data(), expected.data(), num_q)) {
+			std::printf("  at %d bits, %d training descriptors, threshold %d\n", bits, num_t, threshold);
+			return false;
+		}
+	}
+	return true;
+}
+
+template <const int bits>
+static bool checkHNSW() {
+	constexpr int words = bits >> 6;
+	for (const int num_t : { 0, 1, 7, 1000 }) {
+		std::vector<uint64_t> train_words = clusteredSet(bits, num_t);
+		const std::vector<uint64_t> query_words = querySet(bits, train_words, 300);
+		const koral::DescriptorView train(train_words.data(), num_t, bits), query(query_words.data(), 300, bits);
+		koral::HNSWIndex index(bits, 16, 100, num_t);
+		index.add<false>(train);
+		if (!(checkHNSW<false, bits>(index, train, query) && checkHNSW<true, bits>(index, train, query))) return false;
+		if (num_t < 1000) continue;
+
+		// the copies after the first are twins of it, found with it
+		const uint64_t* const copied = &train_words[static_cast<size_t>(num_t - 1) * words];
+		const std::vector<uint64_t> copied_words(copied, copied + words);
+		for (const int num_copies : { 1, 200 }) {
+			for (int i = 0; i < num_copies; ++i) std::copy_n(copied_words.data(), words, &train_words[static_cast<size_t>(5 * i + 3) * words]);
+			koral::HNSWIndex copies(bits, 16, 100, num_t);
+			copies.add<false>(train);
+			int best_i = -2, best_d = -2, second_d = -2;
+			copies.top2<false>(koral::DescriptorView(copied_words.data(), 1, bits), 64, &best_i, &best_d, &second_d);
+			if (best_i != 3 || best_d != 0 || second_d != 0) {
+				std::printf("HNSWIndex: %d bits: a descriptor with %d more copies found %d at %d, second at %d\n", bits, num_copies, best_i, best_d, second_d);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// sinusoids plus noise, so that the ROI comparisons are not degenerate
+static std::vector<uint8_t> texture(const int w, const int h, const int stride) {
+	std::vector<uint8_t> img(static_cast<size_t>(stride) * h + 64);
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			const float v = 128.0f + 60.0f*std::sin(0.3f*x + 0.1f*y) + 40.0f*std::sin(0.05f*x - 0.21f*y) + static_cast<float>(rng() % 41) - 20.0f;
+			img[y*stride + x] = static_cast<uint8_t>(std::min(std::max(v, 0.0f), 255.0f));
+		}
+	}
+	return img;
+}
+
+// half of the coordinates within 40 pixels of either border, where the fast paths hand over to clamping
+static int32_t coordinate(const int32_t n) {
+	const int32_t edge = static_cast<int32_t>(rng() % 40);
+	switch (rng() % 4) {
+	case 0:  return edge;
+	case 1:  return n - 1 - edge;
+	default: return static_cast<int32_t>(rng() % n);
+	}
+}
+
+static std::vector<koral::Keypoint> keypoints(const koral::ImageLevel* const levels, const int num_levels, const int num_kps, const bool upright) {
+	std::vector<koral::Keypoint> kps(num_kps);
+	for (auto& kp : kps) {
+		kp.scale = static_cast<uint8_t>(rng() % num_levels);
+		kp.x = coordinate(levels[kp.scale].w);
+		kp.y = coordinate(levels[kp.scale].h);
+		kp.score = 0;
+		kp.angle = upright ? 0.0f : static_cast<float>(rng() % 62832) * 0.0001f;
+	}
+	return kps;
+}
+
+template <const bool multithreading, const int bits, const bool upright>
+static bool checkLATCH(const koral::ImageLevel* const levels, const std::vector<koral::Keypoint>& kps) {
+	constexpr int words = bits >> 6;
+	const int num_kps = static_cast<int>(kps.size());
+	std::vector<uint64_t> expected(static_cast<size_t>(num_kps) * words), actual(static_cast<size_t>(num_kps) * words);
+	LATCHReference(levels, kps.data(), num_kps, expected.data(), bits);
+	LATCH<multithreading, bits, upright>(levels, kps.data(), num_kps, actual.data());
+	for (int i = 0; i < num_kps; ++i) {
+		if (!std::equal(&actual[static_cast<size_t>(i) * words], &actual[static_cast<size_t>(i + 1) * words], &expected[static_cast<size_t>(i) * words])) {
+			std::printf("LATCH<%s, %d, %s>: keypoint %d (%d, %d) at level %d differs\n", multithreading ? "true" : "false", bits, upright ? "true" : "false", i, kps[i].x, kps[i].y, kps[i].scale);
+			return false;
+		}
+	}
+	return true;
+}
+
+template <const bool multithreading, const bool upright>
+static bool checkLATCH(const koral::ImageLevel* const levels, const std::vector<koral::Keypoint>& kps) {
+	return checkLATCH<multithreading, 128, upright>(levels, kps) && checkLATCH<multithreading, 256, upright>(levels, kps)
+		&& checkLATCH<multithreading, 384, upright>(levels, kps) && checkLATCH<multithreading, 512, upright>(levels, kps);
+}
+
+// tables over the first num_levels levels; bins = 0 describes without tables
+template <const bool multithreading, const int bits>
+static std::vector<uint64_t> describeLATCH(const koral::ImageLevel* const levels, const std::vector<koral::Keypoint>& kps, const int num_levels, const int bins) {
+	std::vector<uint64_t> desc(kps.size() * (bits >> 6));
+	if (bins) {
+		const koral::LATCHTables tables(levels, num_levels, bins);
+		LATCH<multithreading, bits>(levels, kps.data(), static_cast<int>(kps.size()), desc.data(), &tables);
+	}
+	else {
+		LATCH<multithreading, bits>(levels, kps.data(), static_cast<int>(kps.size()), desc.data());
+	}
+	return desc;
+}
+
+template <const bool multithreading, const int bits>
+static bool checkLATCHTables(const koral::ImageLevel* const levels, const std::vector<koral::Keypoint>& kps, const int bins, const bool quarter_turns) {
+	const std::vector<uint64_t> expected = describeLATCH<multithreading, bits>(levels, kps, 0, quarter_turns ? 0 : bins);
+	for (int num_levels = 1; num_levels <= 2; ++num_levels) {
+		if (describeLATCH<multithreading, bits>(levels, kps, num_levels, bins) != expected) {
+			std::printf("LATCH<%s, %d>: %d bins, tables for %d levels: descriptors differ from the %s\n", multithreading ? "true" : "false", bits, bins, num_levels, quarter_turns ? "exact rotation" : "clamped path");
+			return false;
+		}
+	}
+	return true;
+}
+
+template <const bool multithreading>
+static bool checkLATCHTables(const koral::ImageLevel* const levels, std::vector<koral::Keypoint> kps) {
+	if (!(checkLATCHTables<multithreading, 128>(levels, kps, 32, false) && checkLATCHTables<multithreading, 512>(levels, kps, 32, false)
+		&& checkLATCHTables<multithreading, 512>(levels, kps, 64, false))) return false;
+	// at quarter turns the rotated offsets are integers, so binning changes nothing
+	for (auto& kp : kps) kp.angle = 6.2831853f * static_cast<float>(rng() % 4) / 4.0f;
+	return checkLATCHTables<multithreading, 512>(levels, kps, 4, true);
+}
+
+template <const bool multithreading, const bool upright>
+static bool checkLATCHSet(const koral::ImageLevel* const levels, const std::vector<koral::Keypoint>& kps, const uint16_t bits, const koral::LATCHTables* const tables) {
+	koral::DescriptorSet expected(bits), actual(bits);
+	LATCH<multithreading, upright>(levels, kps.data(), static_cast<int>(kps.size()), expected, tables);
+	LATCH<multithreading, upright>(levels, koral::KeypointSet(kps, 1.3f, 2), actual, tables);
+	if (actual.size() != expected.size() || !std::equal(actual.data(), actual.data() + actual.size() * actual.words(), expected.data())) {
+		std::printf("LATCH<%s, %s>: %d bits%s: descriptors from a KeypointSet differ\n", multithreading ? "true" : "false", upright ? "true" : "false", bits, tables ? ", with tables" : "");
+		return false;
+	}
+	return true;
+}
+
+template <const bool multithreading>
+static bool checkLATCHSet(const koral::ImageLevel* const levels, const std::vector<koral::Keypoint>& kps) {
+	const koral::LATCHTables tables(levels, 2);
+	return checkLATCHSet<multithreading, false>(levels, kps, 512, nullptr) && checkLATCHSet<multithreading, false>(levels, kps, 256, &tables)
+		&& checkLATCHSet<multithreading, true>(levels, kps, 128, nullptr);
+}
+
+template <const bool multithreading>
+static bool checkBRIEF(const koral::ImageLevel* const smoothed, const koral::BRIEFTables& tables, const std::vector<koral::Keypoint>& kps) {
+	const int num_kps = static_cast<int>(kps.size());
+	std::vector<uint64_t> expected(static_cast<size_t>(num_kps) << 2), actual(static_cast<size_t>(num_kps) << 2);
+	BRIEFReference(smoothed, kps.data(), num_kps, expected.data());
+	BRIEF<multithreading>(smoothed, kps.data(), num_kps, actual.data(), tables);
+	for (int i = 0; i < num_kps; ++i) {
+		if (!std::equal(&actual[static_cast<size_t>(i) << 2], &actual[static_cast<size_t>(i + 1) << 2], &expected[static_cast<size_t>(i) << 2])) {
+			std::printf("BRIEF<%s>: keypoint %d (%d, %d) at level %d differs\n", multithreading ? "true" : "false", i, kps[i].x, kps[i].y, kps[i].scale);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool checkBRIEF(const koral::ImageLevel* const levels, const std::vector<koral::Keypoint>& kps) {
+	std::vector<uint8_t> smooth[2];
+	koral::ImageLevel smoothed[2];
+	for (int l = 0; l < 2; ++l) {
+		smooth[l].resize(static_cast<size_t>(levels[l].w) * levels[l].h + 64);
+		std::vector<uint8_t> st(smooth[l].size());
+		BRIEFSmooth<false>(levels[l], smooth[l].data());
+		BRIEFSmooth<true>(levels[l], st.data());
+		if (st != smooth[l]) {
+			std::printf("BRIEFSmooth<true>: level %d differs\n", l);
+			return false;
+		}
+		smoothed[l] = koral::ImageLevel(smooth[l].data(), levels[l].w, levels[l].h, levels[l].w);
+	}
+	const koral::BRIEFTables tables(smoothed, 2);
+	return checkBRIEF<false>(smoothed, tables, kps) && checkBRIEF<true>(smoothed, tables, kps);
+}
+
+static bool checkDescriptors() {
+	// level 0 is padded, to check that strides are honored
+	const int w0 = 640, h0 = 480, s0 = 656, w1 = 320, h1 = 240;
+	const std::vector<uint8_t> img0 = texture(w0, h0, s0), img1 = texture(w1, h1, w1);
+	const koral::ImageLevel levels[2] = { koral::ImageLevel(img0.data(), w0, h0, s0), koral::ImageLevel(img1.data(), w1, h1, w1) };
+
+	const std::vector<koral::Keypoint> kps = keypoints(levels, 2, 1000, false), upright_kps = keypoints(levels, 2, 1000, true);
+	return checkLATCH<false, false>(levels, kps) && checkLATCH<true, false>(levels, kps)
+		&& checkLATCH<false, true>(levels, upright_kps) && checkLATCH<true, true>(levels, upright_kps)
+		&& checkLATCHTables<false>(levels, kps) && checkLATCHTables<true>(levels, kps)
+		&& checkLATCHSet<false>(levels, kps) && checkLATCHSet<true>(levels, kps)
+		&& checkBRIEF(levels, kps);
+}
+
+// indices of kps in (scale, y, x) order
+static std::vector<int> byPosition(const std::vector<koral::Keypoint>& kps) {
+	std::vector<int> order(kps.size());
+	for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<int>(i);
+	std::sort(order.begin(), order.end(), [&](const int a, const int b) {
+		return kps[a].scale != kps[b].scale ? kps[a].scale < kps[b].scale : kps[a].y != kps[b].y ? kps[a].y < kps[b].y : kps[a].x < kps[b].x;
+	});
+	return order;
+}
+
+static bool checkFused(const uint8_t* const image, const uint32_t w, const uint32_t h, const uint16_t bits, const bool upright, const koral::CPUDescriptor engine) {
+	koral::CPUKORAL fused(1.3f, 4, bits, upright, true, 64, engine), unfused(1.3f, 4, bits, upright, false, 64, engine);
+	fused.go(image, w, h, 40);
+	unfused.go(image, w, h, 40);
+	const char* const name = engine == koral::CPUDescriptor::BRIEF ? "BRIEF" : "LATCH";
+	if (fused.kps.size() != unfused.kps.size() || fused.kps.empty()) {
+		std::printf("CPUKORAL %s, %d bits%s: %zu keypoints fused, %zu unfused\n", name, bits, upright ? ", upright" : "", fused.kps.size(), unfused.kps.size());
+		return false;
+	}
+	const std::vector<int> f = byPosition(fused.kps), u = byPosition(unfused.kps);
+	const size_t words = fused.desc.words();
+	for (size_t i = 0; i < f.size(); ++i) {
+		const koral::Keypoint& a = fused.kps[f[i]];
+		const koral::Keypoint& b = unfused.kps[u[i]];
+		if (a.x != b.x || a.y != b.y || a.scale != b.scale || a.score != b.score || a.angle != b.angle || !std::equal(fused.desc[f[i]], fused.desc[f[i]] + words, unfused.desc[u[i]])) {
+			std::printf("CPUKORAL %s, %d bits%s: fused keypoint (%d, %d) at level %d differs from unfused\n", name, bits, upright ? ", upright" : "", a.x, a.y, a.scale);
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool checkFused() {
+	// 674 = 10 * 64 + 34 and 517 = 8 * 64 + 5, so the last tiles of each row and column are wider.
+	// With its halo, the last tile of a level 0 row is 102 pixels, which KFAST ends with a full 32-column tail.
+	const uint32_t w = 674, h = 517;
+	const std::vector<uint8_t> image = texture(w, h, w);
+	return checkFused(image.data(), w, h, 512, false, koral::CPUDescriptor::LATCH) && checkFused(image.data(), w, h, 256, true, koral::CPUDescriptor::LATCH)
+		&& checkFused(image.data(), w, h, 256, false, koral::CPUDescriptor::BRIEF);
+}
+
+int main() {
+	bool ok = checkMatchers<128>() && checkMatchers<256>() && checkMatchers<384>() && checkMatchers<512>();
+	ok = ok && checkEarlyExit<256>() && checkEarlyExit<384>() && checkEarlyExit<512>();
+	ok = ok && checkStore<128>() && checkStore<256>() && checkStore<384>() && checkStore<512>();
+	ok = ok && checkClusterTree<128>() && checkClusterTree<256>() && checkClusterTree<384>() && checkClusterTree<512>();
+	ok = ok && checkHNSW<128>() && checkHNSW<256>() && checkHNSW<384>() && checkHNSW<512>();
+	ok = ok && checkDescriptors();
+	ok = ok && checkFused();
+	std::printf(ok ? "All reference checks passed.\n" : "Reference checks FAILED.\n");
+	return ok ? 0 : 1;
+}